@@ -0,0 +1,284 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PchSeekbar.h"
+#include "Archive.h"
+#include "Signature.h"
+#include "util/Parallel.h"
+#include <chrono>
+#include <thread>
+
+namespace wave
+{
+	namespace archive
+	{
+		static char const magic[4] = { 'W', 'S', 'A', 'X' };
+		static t_uint32 const end_marker = ~(t_uint32)0;
+		static size_t const batch_size = 256;
+
+		// Anything larger is a damaged archive rather than a waveform.
+		static t_uint32 const max_location_length = 1 << 16, max_data_size = 1 << 24;
+
+		typedef std::chrono::steady_clock clock;
+
+		static double elapsed_ms(clock::time_point since)
+		{
+			return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+		}
+
+		static size_t transcode_thread_count()
+		{
+			return (std::max)(1u, std::thread::hardware_concurrency());
+		}
+
+		template <typename T>
+		static void write_pod(std::vector<char>& out, T const& t)
+		{
+			char const* p = (char const*)&t;
+			out.insert(out.end(), p, p + sizeof(T));
+		}
+
+		static pfc::string8 trimmed(char const* begin, char const* end)
+		{
+			while (begin < end && isspace((unsigned char)*begin))
+				++begin;
+			while (end > begin && isspace((unsigned char)end[-1]))
+				--end;
+			pfc::string8 out;
+			out.set_string(begin, end - begin);
+			return out;
+		}
+
+		static pfc::string8 as_location(pfc::string8 const& prefix)
+		{
+			if (strstr(prefix, "://"))
+				return prefix;
+			pfc::string8 out = "file://";
+			out << prefix;
+			return out;
+		}
+
+		static bool is_separator(char c)
+		{
+			return c == '\\' || c == '/';
+		}
+
+		std::vector<prefix_remap> parse_remaps(char const* spec)
+		{
+			std::vector<prefix_remap> out;
+			while (*spec)
+			{
+				char const* end = spec + strcspn(spec, "|");
+				char const* arrow = std::find(spec, end, '>');
+				pfc::string8 from = trimmed(spec, arrow);
+				if (arrow != end && from.length())
+				{
+					prefix_remap r;
+					r.from = as_location(from);
+					r.to = as_location(trimmed(arrow + 1, end));
+					out.push_back(r);
+				}
+				spec = *end ? end + 1 : end;
+			}
+			return out;
+		}
+
+		bool remap_location(std::vector<prefix_remap> const& remaps, pfc::string8& location)
+		{
+			char const* p = location.get_ptr();
+			for (auto I = remaps.begin(); I != remaps.end(); ++I)
+			{
+				size_t const n = I->from.length();
+				if (location.length() < n || stricmp_utf8_ex(p, n, I->from, n) != 0)
+					continue;
+				// Only whole path components match, "D:\Music" is no prefix of "D:\Music2".
+				if (p[n] && !is_separator(p[n]) && !is_separator(I->from.get_ptr()[n - 1]))
+					continue;
+				pfc::string8 out = I->to;
+				out << (p + n);
+				location = out;
+				return true;
+			}
+			return false;
+		}
+
+		void export_store(backing_store& store, char const* path, threaded_process_status& status, abort_callback& abort_cb)
+		{
+			auto start = clock::now();
+			std::vector<stamped_location> entries;
+			store.get_all_stamped(entries);
+
+			service_ptr_t<file> out;
+			filesystem::g_open_write_new(out, path, abort_cb);
+
+			std::vector<char> chunk;
+			chunk.insert(chunk.end(), magic, magic + 4);
+			write_pod(chunk, (t_uint32)format_version);
+			write_pod(chunk, (t_uint64)0);
+			out->write(chunk.data(), chunk.size(), abort_cb);
+
+			size_t written = 0;
+			std::vector<ref_ptr<waveform>> waves(batch_size);
+			std::vector<char> found(batch_size);
+			std::vector<std::vector<char>> blobs(batch_size);
+			for (size_t first = 0; first < entries.size(); first += batch_size)
+			{
+				abort_cb.check();
+				status.set_progress(first, entries.size());
+				size_t const n = (std::min)(batch_size, entries.size() - first);
+
+				// The stores serialize reads anyway, so only the encoding is spread over the cores.
+				for (size_t i = 0; i < n; ++i)
+					found[i] = store.get(waves[i], entries[first + i].location);
+				util::parallel_for(0, n, transcode_thread_count(), [&](size_t i)
+				{
+					blobs[i].clear();
+					if (!found[i])
+						return;
+					try
+					{
+						signature::planar_data planar;
+						waveform_to_planar(waves[i], planar);
+						signature::encode(planar, signature::quantization_16bit, blobs[i]);
+					}
+					catch (std::exception&)
+					{
+						blobs[i].clear();
+					}
+				});
+
+				chunk.clear();
+				for (size_t i = 0; i < n; ++i)
+				{
+					if (blobs[i].empty())
+						continue;
+					auto const& e = entries[first + i];
+					char const* location = e.location.get_path();
+					t_uint32 const length = (t_uint32)strlen(location);
+					write_pod(chunk, length);
+					write_pod(chunk, (t_uint32)e.location.get_subsong());
+					write_pod(chunk, (t_uint64)e.stats.m_size);
+					write_pod(chunk, (t_uint64)e.stats.m_timestamp);
+					write_pod(chunk, (t_uint32)blobs[i].size());
+					chunk.insert(chunk.end(), location, location + length);
+					chunk.insert(chunk.end(), blobs[i].begin(), blobs[i].end());
+					++written;
+				}
+				out->write(chunk.data(), chunk.size(), abort_cb);
+			}
+			out->write_lendian_t(end_marker, abort_cb);
+			out.release();
+
+			double ms = elapsed_ms(start);
+			console::formatter() << "Waveform export: wrote " << written << " of " << entries.size() << " waveforms in "
+				<< pfc::format_float(ms, 0, 0) << " ms (" << pfc::format_float(written * 1000.0 / (std::max)(ms, 1.0), 0, 0) << " records per second).";
+		}
+
+		void import_store(backing_store& store, char const* path, std::vector<prefix_remap> const& remaps,
+			threaded_process_status& status, abort_callback& abort_cb)
+		{
+			auto start = clock::now();
+			service_ptr_t<file> in;
+			filesystem::g_open_read(in, path, abort_cb);
+			t_filesize const total = in->get_size(abort_cb);
+
+			{
+				char header[16];
+				in->read_object(header, sizeof(header), abort_cb);
+				t_uint32 version;
+				memcpy(&version, header + 4, sizeof(version));
+				if (!std::equal(magic, magic + 4, header) || version != format_version)
+					throw exception_io_data("not a waveform archive");
+			}
+
+			// Tracks are often copied without their modification times, so imported waveforms
+			// go in unstamped and are taken as current the first time they are looked at.
+			auto const q = preferred_quantization();
+			size_t record_count = 0, imported = 0, present_count = 0, remapped = 0, damaged = 0;
+			std::vector<playable_location_impl> locations;
+			std::vector<std::vector<char>> blobs;
+			bool at_end = false;
+			while (!at_end)
+			{
+				abort_cb.check();
+				locations.clear();
+				blobs.clear();
+				while (locations.size() < batch_size)
+				{
+					t_uint32 length, subsong, data_size;
+					t_uint64 size, timestamp;
+					in->read_lendian_t(length, abort_cb);
+					if (length == end_marker)
+					{
+						at_end = true;
+						break;
+					}
+					in->read_lendian_t(subsong, abort_cb);
+					in->read_lendian_t(size, abort_cb);
+					in->read_lendian_t(timestamp, abort_cb);
+					in->read_lendian_t(data_size, abort_cb);
+					if (length > max_location_length || data_size > max_data_size)
+						throw exception_io_data("damaged waveform archive");
+
+					std::vector<char> name(length);
+					in->read_object(name.data(), length, abort_cb);
+					pfc::string8 location;
+					location.set_string(name.data(), length);
+					if (remap_location(remaps, location))
+						++remapped;
+
+					blobs.push_back(std::vector<char>(data_size));
+					in->read_object(blobs.back().data(), data_size, abort_cb);
+					locations.push_back(playable_location_impl(location, subsong));
+				}
+				record_count += locations.size();
+				if (total != filesize_invalid)
+					status.set_progress(in->get_position(abort_cb), total);
+
+				std::vector<bool> present;
+				store.has_all(locations, present);
+
+				std::vector<encoded_waveform> out(locations.size());
+				std::vector<char> ok(locations.size());
+				util::parallel_for(0, locations.size(), transcode_thread_count(), [&](size_t i)
+				{
+					if (present[i])
+						return;
+					try
+					{
+						signature::planar_data planar;
+						if (!signature::decode(blobs[i].data(), blobs[i].size(), planar))
+							return;
+						out[i].location = locations[i];
+						out[i].channel_map = planar.channel_map;
+						signature::encode(planar, q, out[i].signature);
+						ok[i] = 1;
+					}
+					catch (std::exception&)
+					{
+					}
+				});
+
+				std::vector<encoded_waveform> batch;
+				for (size_t i = 0; i < out.size(); ++i)
+				{
+					if (present[i])
+						++present_count;
+					else if (!ok[i])
+						++damaged;
+					else
+						batch.push_back(std::move(out[i]));
+				}
+				store.put_all(batch);
+				imported += batch.size();
+			}
+
+			double ms = elapsed_ms(start);
+			console::formatter() << "Waveform import: " << imported << " imported, " << present_count << " already present and "
+				<< damaged << " damaged of " << record_count << " records (" << remapped << " remapped) in "
+				<< pfc::format_float(ms, 0, 0) << " ms (" << pfc::format_float(record_count * 1000.0 / (std::max)(ms, 1.0), 0, 0) << " records per second).";
+		}
+	}
+}
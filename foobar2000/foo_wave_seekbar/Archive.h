@@ -0,0 +1,34 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "BackingStore.h"
+
+namespace wave
+{
+	namespace archive
+	{
+		/* Portable dump of a waveform cache, independent of the store it came from, little-endian:
+		 *   16 bytes header: magic "WSAX", u32 version, u64 reserved
+		 *   records: u32 location length, u32 subsong, u64 track size, u64 track timestamp,
+		 *            u32 data size, location (UTF-8), data (signature v2 blob, 16-bit)
+		 *   end: u32 0xFFFFFFFF
+		 */
+		unsigned const format_version = 1;
+
+		struct prefix_remap
+		{
+			pfc::string8 from, to;
+		};
+
+		// Parses "old>new" pairs separated by '|', prefixes without a protocol are taken as file://.
+		std::vector<prefix_remap> parse_remaps(char const* spec);
+		bool remap_location(std::vector<prefix_remap> const& remaps, pfc::string8& location);
+
+		void export_store(backing_store& store, char const* path, threaded_process_status& status, abort_callback& abort_cb);
+		void import_store(backing_store& store, char const* path, std::vector<prefix_remap> const& remaps,
+			threaded_process_status& status, abort_callback& abort_cb);
+	}
+}
@@ -6,342 +6,212 @@
 #include "PchSeekbar.h"
 #include "BackingStore.h"
 #include "waveform_sdk/WaveformImpl.h"
-#include "Helpers.h"
-#include "Pack.h"
-#include "waveform_sdk/Optional.h"
+#include "Signature.h"
+#include "util/Filesystem.h"
+#include "util/Parallel.h"
+
+extern const GUID guid_seekbar_branch;
+
+// {6C3E8F0B-2B0D-4C2E-9D4A-1F5E7A3B9C21}
+static const GUID guid_store_8bit_signatures = { 0x6c3e8f0b, 0x2b0d, 0x4c2e, { 0x9d, 0x4a, 0x1f, 0x5e, 0x7a, 0x3b, 0x9c, 0x21 } };
+
+static advconfig_checkbox_factory g_store_8bit_signatures("Store waveforms at 8-bit precision (smaller database)", guid_store_8bit_signatures, guid_seekbar_branch, 0.0, false);
 
 namespace wave
 {
-	backing_store::backing_store(pfc::string const& cache_filename)
+	void waveform_to_planar(ref_ptr<waveform> const& in, signature::planar_data& out)
 	{
+		auto w = as_waveform_v2(in);
+		unsigned const n = w->get_bucket_count();
+		out.channel_count = w->get_channel_count();
+		out.bucket_count = n;
+		out.channel_map = w->get_channel_map();
+
+		std::vector<float>* fields[] = { &out.minimum, &out.maximum, &out.rms };
+		for (int f = 0; f < field::count; ++f)
 		{
-			sqlite3* p = 0;
-			sqlite3_open(cache_filename.get_ptr(), &p);
-			backing_db.reset(p, &sqlite3_close);
+			auto& dst = *fields[f];
+			dst.resize(out.channel_count * n);
+			for (unsigned c = 0; c < out.channel_count; ++c)
+			{
+				auto span = w->get_span((field::type)f, c);
+				std::copy(span.begin(), span.end(), dst.begin() + c*n);
+			}
 		}
-
-		sqlite3_exec(
-			backing_db.get(),
-			"PRAGMA foreign_keys = ON",
-			0, 0, 0);
-
-		sqlite3_exec(
-			backing_db.get(),
-			"CREATE TABLE IF NOT EXISTS file ("
-			"fid INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
-			"location TEXT NOT NULL,"
-			"subsong INTEGER NOT NULL,"
-			"UNIQUE (location, subsong))",
-			0, 0, 0);
-
-		sqlite3_exec(
-			backing_db.get(),
-			"CREATE TABLE IF NOT EXISTS wave ("
-			"fid INTEGER PRIMARY KEY NOT NULL,"
-			"min BLOB,"
-			"max BLOB,"
-			"rms BLOB,"
-			"FOREIGN KEY (fid) REFERENCES file(fid))",
-			0, 0, 0);
-
-		sqlite3_exec(
-			backing_db.get(),
-			"CREATE TABLE IF NOT EXISTS job ("
-			"jid INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
-			"location TEXT NOT NULL,"
-			"subsong INTEGER NOT NULL,"
-			"user_submitted INTEGER,"
-			"UNIQUE (location, subsong))",
-			0, 0, 0);
-		
-		sqlite3_exec(
-			backing_db.get(),
-			"DROP TRIGGER resonance_cascade",
-			0, 0, 0);
-
-		sqlite3_exec(
-			backing_db.get(),
-			"CREATE TRIGGER resonance_cascade BEFORE DELETE ON file BEGIN DELETE FROM wave WHERE wave.fid = OLD.fid; END",
-			0, 0, 0);
-
-		sqlite3_exec(
-			backing_db.get(),
-			"ALTER TABLE wave ADD channels INT",
-			0, 0, 0);
-
-		sqlite3_exec(
-			backing_db.get(),
-			"ALTER TABLE wave ADD compression INT",
-			0, 0, 0);
 	}
 
-	backing_store::~backing_store()
+	std::vector<float*> channel_buffers(waveform_impl& w)
 	{
+		std::vector<float*> out;
+		unsigned const channel_count = w.get_channel_count();
+		for (int f = 0; f < field::count; ++f)
+		{
+			for (unsigned c = 0; c < channel_count; ++c)
+				out.push_back(w.get_mutable((field::type)f, c));
+		}
+		return out;
 	}
 
-	bool backing_store::has(playable_location const& file)
+	ref_ptr<waveform> planar_to_waveform(signature::planar_data const& in)
 	{
-		auto stmt = prepare_statement(
-			"SELECT 1 "
-			"FROM file as f, wave AS w "
-			"WHERE f.location = ? AND f.subsong = ? AND f.fid = w.fid");
-
-		sqlite3_bind_text(stmt.get(), 1, file.get_path(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(stmt.get(), 2, file.get_subsong());
-
-		if (SQLITE_ROW == sqlite3_step(stmt.get())) {
-			return true;
+		unsigned const n = in.bucket_count;
+		ref_ptr<waveform_impl> w(new waveform_impl(in.channel_count, n, in.channel_map));
+		auto channels = channel_buffers(**w);
+		std::vector<float> const* fields[] = { &in.minimum, &in.maximum, &in.rms };
+		for (int f = 0; f < field::count; ++f)
+		{
+			for (unsigned c = 0; c < in.channel_count; ++c)
+				std::copy_n(fields[f]->data() + c*n, n, channels[f*in.channel_count + c]);
 		}
-		return false;
+		return w;
 	}
 
-	void backing_store::remove(playable_location const& file)
+	ref_ptr<waveform> signature_to_waveform(void const* src, size_t cb)
 	{
-		auto stmt = prepare_statement(
-			"DELETE FROM file WHERE file.location = ? AND file.subsong = ?");
-		sqlite3_bind_text(stmt.get(), 1, file.get_path(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(stmt.get(), 2, file.get_subsong());
-		sqlite3_step(stmt.get());
+		signature::layout l;
+		if (!signature::parse_layout(src, cb, l))
+			return ref_ptr<waveform>();
+		ref_ptr<waveform_impl> w(new waveform_impl(l.channel_count, l.bucket_count, l.channel_map));
+		auto channels = channel_buffers(**w);
+		if (!signature::decode_into(src, cb, channels.data()))
+			return ref_ptr<waveform>();
+		return w;
 	}
 
-	bool backing_store::get(ref_ptr<waveform>& out, playable_location const& file)
+	signature::quantization preferred_quantization()
 	{
-		out.reset();
-		wave::optional<int> compression;
-		{
-			auto stmt = prepare_statement(
-				"SELECT w.min, w.max, w.rms, w.channels, w.compression "
-				"FROM file AS f NATURAL JOIN wave AS w "
-				"WHERE f.location = ? AND f.subsong = ?");
-
-			sqlite3_bind_text(stmt.get(), 1, file.get_path(), -1, SQLITE_STATIC);
-			sqlite3_bind_int(stmt.get(), 2, file.get_subsong());
-
-			if (SQLITE_ROW != sqlite3_step(stmt.get())) {
-				return false;
-			}
-		
-			wave::optional<int> channels;
-
-			if (sqlite3_column_type(stmt.get(), 3) != SQLITE_NULL)
-				channels = sqlite3_column_int(stmt.get(), 3);
-			if (sqlite3_column_type(stmt.get(), 4) != SQLITE_NULL)
-				compression = sqlite3_column_int(stmt.get(), 4);
-
-			if (compression.valid() && *compression > 1)
-				return false;
-
-			unsigned channel_count = channels.valid() ? count_bits_set(*channels) : 1;
-
-			if (compression.valid() && *compression < 0 || channels.valid() && *channels < 0 || channel_count > 18) {
-				remove(file); // corrupt entry
-			}
-
-			ref_ptr<waveform_impl> w(new waveform_impl);
-			auto clear_and_set = [&stmt, compression, channel_count, &w](pfc::string name, size_t col) -> bool
-			{
-				pfc::list_t<waveform_impl::signal> list;
-			
-				float const* data = (float const*)sqlite3_column_blob(stmt.get(), col);
-				t_size count = sqlite3_column_bytes(stmt.get(), col);
-
-				if (compression.valid())
-				{
-					typedef std::back_insert_iterator<std::vector<char>> Iterator;
-					bool (*unpack_func)(void const*, size_t, Iterator) = 0;
-					switch (*compression) {
-					case 0: unpack_func = &pack::z_unpack<Iterator>; break;
-					case 1: unpack_func = &pack::lzma_unpack<Iterator>; break;
-					default: return false; // unknown compression scheme
-					}
-
-					std::vector<char> dst;
-					dst.reserve(2048 * channel_count * sizeof(float));
-					if (!unpack_func(data, count, std::back_inserter(dst)))
-					{
-						return false;
-					}
-
-					if (dst.size() != channel_count * 2048 * sizeof(float))
-					{
-						return false;
-					}
+		return g_store_8bit_signatures.get() ? signature::quantization_8bit : signature::quantization_16bit;
+	}
 
-					for (unsigned c = 0; c < channel_count; ++c)
-					{
-						waveform_impl::signal channel;
-						float const * fs = (float*)&dst[2048 * c * sizeof(float)];
-						channel.add_items_fromptr(fs, 2048);
-						list.add_item(channel);
-					}
-				}
-				else
-				{
-					for (unsigned c = 0; c < channel_count; ++c)
-					{
-						waveform_impl::signal channel;
-						channel.add_items_fromptr(data + 2048*c, 2048);
-						list.add_item(channel);
-					}
-				}
-				w->fields[name] = list;
-				return true;
-			};
+	namespace
+	{
+		enum liveness { entry_unknown, entry_alive, entry_dead };
 
-			if (clear_and_set("minimum", 0) && 
-				clear_and_set("maximum", 1) &&
-				clear_and_set("rms", 2))
+		struct path_less
+		{
+			bool operator () (pfc::string8 const& a, pfc::string8 const& b) const
 			{
-				w->channel_map = channels.valid() ? *channels : audio_chunk::channel_config_mono;
+				return pfc::io::path::compare(a, b) < 0;
+			}
+		};
 
-				out = w;
+		// Checks single locations, used for anything that is not a plain directory.
+		liveness check_exists(char const* location, abort_callback& abort_cb)
+		{
+			try {
+				return filesystem::g_exists(location, abort_cb) ? entry_alive : entry_dead;
 			}
-			else
-			{
-				remove(file); // it's corrupt, and thus useless
+			catch (exception_io_not_found&) {
+				return entry_dead;
 			}
+			catch (exception_io&) {}
+			return entry_unknown;
 		}
 
-		if (!compression.valid() || *compression == 0)
+		// Lists the directory once and resolves all its entries against the listing.
+		// A directory that cannot be reached for other reasons than being gone keeps its entries.
+		void check_directory(char const* directory, std::vector<size_t> const& members,
+			std::vector<playable_location_impl> const& locations, std::vector<char>& verdicts, abort_callback& abort_cb)
 		{
-			put(out, file);
-		}
-		return out.is_valid();
-	}
-
-	void backing_store::put(ref_ptr<waveform> const& w, playable_location const& file)
-	{
-		auto stmt = prepare_statement(
-			"INSERT INTO file (location, subsong) "
-			"VALUES (?, ?)");
-		sqlite3_bind_text(stmt.get(), 1, file.get_path(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(stmt.get(), 2, file.get_subsong());
-		sqlite3_step(stmt.get());
-
-		stmt = prepare_statement(
-			"REPLACE INTO wave (fid, min, max, rms, channels, compression) "
-			"SELECT f.fid, ?, ?, ?, ?, ? "
-			"FROM file AS f "
-			"WHERE f.location = ? AND f.subsong = ?");
-
-#		define BIND_LIST(Member, Idx) \
-			std::vector<char> Member; \
-			{ \
-				std::vector<float> src_buf; \
-				for (size_t c = 0; c < w->get_channel_count(); ++c) \
-				{ \
-					pfc::list_t<float> channel; \
-					w->get_field(#Member, c, list_array_sink<float>(channel)); \
-					float * p = (float *)channel.get_ptr(); \
-					std::copy(p, p + channel.get_size(), std::back_inserter(src_buf)); \
-				} \
-				pack::lzma_pack(&src_buf[0], src_buf.size() * sizeof(float), std::back_inserter(Member)); \
-			} \
-			sqlite3_bind_blob(stmt.get(), Idx, &Member[0], Member.size(), SQLITE_STATIC)
-			
-		BIND_LIST(minimum, 1);
-		BIND_LIST(maximum, 2);
-		BIND_LIST(rms    , 3);
-
-#		undef  BIND_LIST
-
-		sqlite3_bind_int(stmt.get(), 4, w->get_channel_map());
-		sqlite3_bind_int(stmt.get(), 5, 1); // LZMA compression
-		sqlite3_bind_text(stmt.get(), 6, file.get_path(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(stmt.get(), 7, file.get_subsong());
-
-		while (SQLITE_ROW == sqlite3_step(stmt.get()));
-	}
-
-	void backing_store::get_jobs(std::deque<job>& out)
-	{
-		auto stmt = prepare_statement(
-			"SELECT location, subsong, user_submitted FROM job ORDER BY jid");
+			std::vector<pfc::string8> listing;
+			try {
+				directory_callback_impl cb(false);
+				filesystem::g_list_directory(directory, cb, abort_cb);
+				listing.reserve(cb.get_count());
+				for (t_size i = 0; i < cb.get_count(); ++i)
+					listing.push_back(cb[i]);
+			}
+			catch (exception_io_not_found&) {
+				for (auto I = members.begin(); I != members.end(); ++I)
+					verdicts[*I] = entry_dead;
+				return;
+			}
+			catch (exception_io&) {
+				return;
+			}
 
-		out.clear();
-		while (SQLITE_ROW == sqlite3_step(stmt.get()))
-		{
-			char const* loc = (char const*)sqlite3_column_text(stmt.get(), 0);
-			t_uint32 sub = (t_uint32)sqlite3_column_int(stmt.get(), 1);
-			bool user = !!sqlite3_column_int(stmt.get(), 2);
-			out.push_back(make_job(playable_location_impl(loc, sub), user));
+			std::sort(listing.begin(), listing.end(), path_less());
+			for (auto I = members.begin(); I != members.end(); ++I)
+			{
+				pfc::string8 path = locations[*I].get_path();
+				bool found = std::binary_search(listing.begin(), listing.end(), path, path_less());
+				verdicts[*I] = found ? entry_alive : entry_dead;
+			}
 		}
 	}
 
-	void backing_store::put_jobs(std::deque<job> const& jobs)
+	void backing_store::remove_dead(threaded_process_status& status, abort_callback& abort_cb)
 	{
-		sqlite3_exec(backing_db.get(), "BEGIN", 0, 0, 0);
-		sqlite3_exec(backing_db.get(), "DELETE FROM job", 0, 0, 0);
-		auto stmt = prepare_statement(
-			"INSERT INTO job (location, subsong, user_submitted) "
-			"VALUES (?, ?, ?)");
+		size_t const sweep_thread_count = 8, directory_batch_size = 32, delete_batch_size = 512;
 
-		for (size_t i = 0; i < jobs.size(); ++i)
+		std::vector<playable_location_impl> locations;
 		{
-			auto& j = jobs[i];
-			sqlite3_bind_text(stmt.get(), 1, j.loc.get_path(), -1, SQLITE_STATIC);
-			sqlite3_bind_int(stmt.get(), 2, j.loc.get_subsong());
-			sqlite3_bind_int(stmt.get(), 3, j.user);
-			sqlite3_step(stmt.get());
-			sqlite3_reset(stmt.get());
+			pfc::list_t<playable_location_impl> all;
+			get_all(all);
+			locations.reserve(all.get_count());
+			all.enumerate([&](playable_location_impl const& loc) { locations.push_back(loc); });
 		}
-		sqlite3_exec(backing_db.get(), "COMMIT", 0, 0, 0);
-	}
 
-	void file_exists(sqlite3_context* ctx, int argc, sqlite3_value** argv)
-	{
-		char const* loc = (char const*)sqlite3_value_text(argv[0]);
-		abort_callback_dummy cb;
-		try {
-			bool exists = filesystem::g_exists(loc, cb);
-
-			if (exists)
+		// Group entries by their directory, non-file protocols are checked one by one.
+		std::map<pfc::string8, std::vector<size_t>, path_less> directories;
+		std::vector<size_t> singles;
+		for (size_t i = 0; i < locations.size(); ++i)
+		{
+			char const* path = locations[i].get_path();
+			char const* separator = strrchr(path, '\\');
+			if (!util::starts_with(path, "file://") || !separator)
 			{
-				sqlite3_result_int(ctx, exists);
-				return;
+				singles.push_back(i);
+				continue;
 			}
+			directories[pfc::string8(path, separator - path)].push_back(i);
 		}
-		catch (exception_io&) {}
-		sqlite3_result_null(ctx);
-	}
-
-	void backing_store::remove_dead()
-	{
-		sqlite3_create_function(
-			backing_db.get(),
-			"file_exists", 1, SQLITE_UTF8, 0,
-			&file_exists, 0, 0);
-		sqlite3_exec(backing_db.get(), "DELETE FROM file WHERE file_exists(file.location) IS NULL", 0, 0, 0);
-		console::info("Waveform cache: removed dead entries from the database.");
-	}
 
-	void backing_store::compact()
-	{
-		sqlite3_exec(backing_db.get(), "VACUUM", 0, 0, 0);
-		console::info("Waveform cache: compacted the database.");
-	}
+		typedef std::pair<pfc::string8, std::vector<size_t>> directory_entry;
+		std::vector<directory_entry> work(directories.begin(), directories.end());
+		std::vector<char> verdicts(locations.size(), entry_unknown);
+		size_t const work_count = work.size() + singles.size();
 
-	void backing_store::get_all(pfc::list_t<playable_location_impl>& out)
-	{
-		auto stmt = prepare_statement(
-			"SELECT location, subsong FROM file ORDER BY location, subsong");
+		for (size_t first = 0; first < work_count; first += directory_batch_size)
+		{
+			abort_cb.check();
+			status.set_progress(first, work_count);
+			size_t last = (std::min)(work_count, first + directory_batch_size);
+			util::parallel_for(first, last, sweep_thread_count, [&](size_t i)
+			{
+				if (abort_cb.is_aborting())
+					return;
+				// The body must not throw. An abort mid-listing leaves the entries unknown.
+				try {
+					if (i < work.size())
+					{
+						check_directory(work[i].first, work[i].second, locations, verdicts, abort_cb);
+					}
+					else
+					{
+						size_t idx = singles[i - work.size()];
+						verdicts[idx] = check_exists(locations[idx].get_path(), abort_cb);
+					}
+				}
+				catch (std::exception&) {}
+			});
+		}
+		abort_cb.check();
 
-		out.remove_all();
-		while (SQLITE_ROW == sqlite3_step(stmt.get()))
+		std::vector<playable_location_impl> dead;
+		for (size_t i = 0; i < locations.size(); ++i)
 		{
-			char const* loc = (char const*)sqlite3_column_text(stmt.get(), 0);
-			t_uint32 sub = (t_uint32)sqlite3_column_int(stmt.get(), 1);
-			out.add_item(playable_location_impl(loc, sub));
+			if (verdicts[i] == entry_dead)
+				dead.push_back(locations[i]);
 		}
-	}
 
-	std::shared_ptr<sqlite3_stmt> backing_store::prepare_statement(std::string const& query)
-	{
-		sqlite3_stmt* p = 0;
-		sqlite3_prepare_v2(
-			backing_db.get(),
-			query.c_str(),
-			query.size(), &p, 0);
-		return std::shared_ptr<sqlite3_stmt>(p, &sqlite3_finalize);
+		for (size_t first = 0; first < dead.size(); first += delete_batch_size)
+		{
+			abort_cb.check();
+			status.set_progress_secondary(first, dead.size());
+			size_t last = (std::min)(dead.size(), first + delete_batch_size);
+			remove_all(std::vector<playable_location_impl>(dead.begin() + first, dead.begin() + last));
+		}
+		console::formatter() << "Waveform cache: removed " << dead.size() << " dead entries out of " << locations.size() << " from the database.";
 	}
 }
@@ -5,29 +5,98 @@
 
 #pragma once
 #include "Job.h"
+#include "Signature.h"
+#include "Statistics.h"
 #include "waveform_sdk/Waveform.h"
+#include <vector>
 
 namespace wave
 {
+	struct waveform_impl;
+
+	void waveform_to_planar(ref_ptr<waveform> const& w, signature::planar_data& out);
+	ref_ptr<waveform> planar_to_waveform(signature::planar_data const& in);
+
+	// The channel buffers of w, every channel of the minimum first, then the maximum, then the rms.
+	std::vector<float*> channel_buffers(waveform_impl& w);
+
+	// Dequantizes a signature blob straight into a new waveform, null if the blob is damaged.
+	ref_ptr<waveform> signature_to_waveform(void const* src, size_t cb);
+	signature::quantization preferred_quantization();
+
+	// Values of the compression column of stored waveforms. The envelope codec
+	// only applies to signature blobs, see Envelope.h.
+	namespace compression_scheme
+	{
+		enum type
+		{
+			zlib = 0,
+			lzma = 1,
+			envelope = 2,
+		};
+	}
+
+	struct stamped_location
+	{
+		playable_location_impl location;
+		t_filestats stats;
+		bool has_content_key; // false if the store has no content key for it
+	};
+
+	// A waveform already in signature form, for bulk transfers.
+	struct encoded_waveform
+	{
+		playable_location_impl location;
+		unsigned channel_map;
+		std::vector<char> signature;
+	};
+
+	// Storage for waveforms and the job queue, see SqliteStore.h and PackStore.h.
 	struct backing_store
 	{
-		explicit backing_store(pfc::string const& cache_filename);
-		~backing_store();
+		virtual ~backing_store() {}
+
+		virtual bool has(playable_location const& file) abstract;
+		virtual void remove(playable_location const& file) abstract;
+		virtual bool get(ref_ptr<waveform>& out, playable_location const& file) abstract;
+		virtual void put(ref_ptr<waveform> const& in, playable_location const& file) abstract;
+		virtual void has_all(std::vector<playable_location_impl> const& files, std::vector<bool>& out) abstract;
+		virtual void put_all(std::vector<encoded_waveform> const& in) abstract;
+		virtual void set_content_key(playable_location const& file, char const* content_key) abstract;
+		virtual bool has_content_key(playable_location const& file) abstract;
+
+		// False for stores that cannot record content keys, which are then never backfilled.
+		virtual bool keeps_content_keys() abstract;
+
+		// Relinking is split in two so that the caller can look for the original track
+		// between the calls without holding up other users of the store.
+		// find_content gives the location of a waveform stored with the content key, and
+		// relink gives it to file, taking the row along if the original is gone.
+		virtual bool find_content(char const* content_key, t_uint32 subsong, pfc::string8& original) abstract;
+		virtual bool relink(playable_location const& file, char const* content_key, bool original_exists) abstract;
+		virtual void set_file_stats(playable_location const& file, t_filestats const& stats) abstract;
+		virtual bool get_file_stats(playable_location const& file, t_filestats& out) abstract;
+		virtual void remove_all(std::vector<playable_location_impl> const& files) abstract;
+		virtual void compact() abstract;
+
+		// Hands up to max_bytes of unused space back to the file system without
+		// blocking for long, returning the bytes freed; 0 when there is nothing to do.
+		virtual t_uint64 compact_step(t_uint64 max_bytes) abstract;
+
+		// Brings the layout of a store made by an older version up to date. Runs on a thread
+		// of its own after startup; until it is done the store answers from the old layout.
+		virtual void upgrade(abort_callback& abort_cb) abstract;
 
-		bool has(playable_location const& file);
-		void remove(playable_location const& file);
-		bool get(ref_ptr<waveform>& out, playable_location const& file);
-		void put(ref_ptr<waveform> const& in, playable_location const& file);
-		void remove_dead();
-		void compact();
+		virtual void get_jobs(std::deque<job>&) abstract;
+		virtual void put_jobs(std::deque<job> const&) abstract;
 
-		void get_jobs(std::deque<job>&);
-		void put_jobs(std::deque<job> const&);
+		virtual void get_all(pfc::list_t<playable_location_impl>&) abstract;
+		virtual void get_all_stamped(std::vector<stamped_location>&) abstract;
 
-		void get_all(pfc::list_t<playable_location_impl>&);
+		// Row counts, blob sizes and file usage for the statistics report.
+		virtual void get_statistics(store_statistics& out) abstract;
 
-	private:
-		std::shared_ptr<sqlite3_stmt> prepare_statement(std::string const& query);
-		std::shared_ptr<sqlite3> backing_db;
+		// Shared by all stores, in terms of get_all and remove_all.
+		void remove_dead(threaded_process_status& status, abort_callback& abort_cb);
 	};
 }
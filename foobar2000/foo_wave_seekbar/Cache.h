@@ -65,6 +65,10 @@ namespace wave
 		virtual void remove_dead_waveforms() abstract;
 		virtual void compact_storage() abstract;
 		virtual void rescan_waveforms() abstract;
+		virtual void rescan_changed_waveforms() abstract;
+		virtual void export_waveforms(char const* path) abstract;
+		virtual void import_waveforms(char const* path) abstract;
+		virtual void report_statistics() abstract;
 
 		virtual bool has_waveform(playable_location const& loc) abstract;
 		virtual void remove_waveform(playable_location const& loc) abstract;
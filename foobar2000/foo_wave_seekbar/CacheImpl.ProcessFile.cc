@@ -6,10 +6,12 @@
 #include "PchSeekbar.h"
 #include "CacheImpl.h"
 #include "BackingStore.h"
+#include "ContentKey.h"
 #include "waveform_sdk/WaveformImpl.h"
 #include "waveform_sdk/Downmix.h"
 #include "waveform_sdk/Optional.h"
 #include "Helpers.h"
+#include "MonoMix.h"
 #include <chrono>
 #include <regex>
 #include <sstream>
@@ -23,11 +25,15 @@ static const GUID guid_analyse_tracks_outside_library = { 0xec789b1b, 0x23a0, 0x
 // {9752AFF1-DF5A-4F80-AB9E-B285AF48CB86}
 static const GUID guid_report_incremental_results = { 0x9752aff1, 0xdf5a, 0x4f80, { 0xab, 0x9e, 0xb2, 0x85, 0xaf, 0x48, 0xcb, 0x86 } };
 
+// {5B0C7E52-8F3A-4D61-A2E9-36C4D1F07B88}
+static const GUID guid_relink_by_content = { 0x5b0c7e52, 0x8f3a, 0x4d61, { 0xa2, 0xe9, 0x36, 0xc4, 0xd1, 0xf0, 0x7b, 0x88 } };
+
 
 static advconfig_branch_factory g_seekbar_branch("Waveform Seekbar", guid_seekbar_branch, advconfig_entry::guid_branch_tools, 0.0);
 static advconfig_checkbox_factory g_downmix_in_analysis("Store analysed tracks in mono", guid_downmix_in_analysis, guid_seekbar_branch, 0.0, false);
 static advconfig_checkbox_factory g_analyse_tracks_outside_library("Analyse tracks not in the media library", guid_analyse_tracks_outside_library, guid_seekbar_branch, 0.0, true);
 static advconfig_checkbox_factory g_report_incremental_results("Incremental update of waveforms being scanned", guid_report_incremental_results, guid_seekbar_branch, 0.0, false);
+static advconfig_checkbox_factory g_relink_by_content("Reuse waveforms of moved or copied tracks (matched by content)", guid_relink_by_content, guid_seekbar_branch, 0.0, true);
 
 namespace wave
 {
@@ -89,23 +95,39 @@ namespace wave
 		return true;
 	}
 
-	template <typename C1, typename C2>
-	void transpose(C1& out, C2 const& in, size_t width, int valid_input_rows)
+	bool try_get_file_stats(char const* path, t_filestats& out, abort_callback& abort_cb)
 	{
-		int in_rows = in.get_size()/width, in_cols = width;
-		int out_rows = in_cols, out_cols = in_rows;
+		try
+		{
+			bool is_writeable;
+			filesystem::g_get_stats(path, out, is_writeable, abort_cb);
+			return true;
+		}
+		catch (foobar2000_io::exception_io&)
+		{
+		}
+		return false;
+	}
+
+	bool file_stats_differ(t_filestats const& stored, t_filestats const& current)
+	{
+		if (stored.m_size != filesize_invalid && current.m_size != filesize_invalid && stored.m_size != current.m_size)
+			return true;
+		if (stored.m_timestamp != filetimestamp_invalid && current.m_timestamp != filetimestamp_invalid && stored.m_timestamp != current.m_timestamp)
+			return true;
+		return false;
+	}
 
-		out.set_size(out_rows);
-		for (int out_row = 0; out_row < out_rows; ++out_row)
+	// One channel per row of the field, the buckets past valid_input_rows stay zero.
+	template <typename C>
+	void transpose(waveform_impl& out, field::type f, C const& in, size_t width, int valid_input_rows)
+	{
+		for (size_t out_row = 0; out_row < width; ++out_row)
 		{
-			out[out_row].set_size(out_cols);
+			float* dst = out.get_mutable(f, out_row);
 			for (int out_col = 0; out_col < valid_input_rows; ++out_col)
 			{
-				out[out_row][out_col] = in[out_col*width + out_row];
-			}
-			for (int out_col = valid_input_rows; out_col < out_cols; ++out_col)
-			{
-				out[out_row][out_col] = 0.0f;
+				dst[out_col] = in[out_col*width + out_row];
 			}
 		}
 	}
@@ -184,13 +206,14 @@ namespace wave
 	{
 		// buckets with interleaved channels
 		pfc::list_t<audio_sample> minimum, maximum, rms;
+		unsigned input_channel_count;
+		pfc::list_hybrid_t<audio_sample, 18> mono_weights; // when downmixing, the weight of every input channel
 		unsigned bucket;
 		t_int64 bucket_begins;
 		t_int64 samples_processed;
 		bool should_downmix;
 		abort_callback& abort_cb;
 
-		waveform_impl incremental_result;
 		std::shared_ptr<cache_impl::incremental_result_sink> incremental_output;
 
 		duration_query dur;
@@ -201,6 +224,7 @@ namespace wave
 		waveform_builder(t_int64 sample_count, bool should_downmix, abort_callback& abort_cb,
 			std::shared_ptr<cache_impl::incremental_result_sink> incremental_output)
 			: analysis_pass(sample_count)
+			, input_channel_count(0)
 			, bucket(0)
 			, bucket_begins(0)
 			, samples_processed(0)
@@ -249,9 +273,21 @@ namespace wave
 
 		void initialize(unsigned channel_count, unsigned channel_map)
 		{
+			this->input_channel_count = channel_count;
 			this->channel_count = channel_count;
 			this->channel_map = channel_map;
-			t_int32 const entry_count = channel_count*bucket_count;
+			if (should_downmix)
+			{
+				// The samples are mixed before they are reduced, so only the mono signal is accumulated.
+				pfc::list_hybrid_t<audio_sample, 18> left, right;
+				get_downmix_coefficients(channel_count, left, right);
+				mono_weights.set_size(channel_count);
+				for (unsigned c = 0; c < channel_count; ++c)
+					mono_weights[c] = audio_sample(0.5) * (left[c] + right[c]);
+				this->channel_count = 1;
+				this->channel_map = audio_chunk::channel_config_mono;
+			}
+			t_int32 const entry_count = this->channel_count*bucket_count;
 			minimum.add_items_repeat(FLT_MAX, entry_count);
 			maximum.add_items_repeat(-FLT_MAX, entry_count);
 			rms.add_items_repeat(0.0f, entry_count);
@@ -265,7 +301,10 @@ namespace wave
 			for (t_int64 i = 0; i < n;)
 			{
 				t_int64 const to_process = (std::min)(bucket_ends() - samples_processed, n - i);
-				process(data + i*channel_count, to_process);
+				if (should_downmix)
+					process_mixed(data + i*input_channel_count, to_process);
+				else
+					process(data + i*input_channel_count, to_process);
 				i += to_process;
 				if (bucket_boundary())
 				{
@@ -299,6 +338,13 @@ namespace wave
 			samples_processed += frames;
 		}
 
+		void process_mixed(audio_sample const* data, t_int64 frames)
+		{
+			accumulate_mixed(data, (size_t)frames, mono_weights.get_ptr(), input_channel_count,
+				minimum[bucket], maximum[bucket], rms[bucket]);
+			samples_processed += frames;
+		}
+
 		void finalize_bucket(t_int64 last_part_size)
 		{
 			for (unsigned ch = 0; ch < channel_count; ++ch)
@@ -317,54 +363,14 @@ namespace wave
 
 		ref_ptr<waveform> finalize_waveform() const
 		{
-			auto channel_count = this->channel_count;
-			auto channel_map = this->channel_map;
-			auto minimum = this->minimum;
-			auto maximum = this->maximum;
-			auto rms = this->rms;
-			if (should_downmix)
-			{
-				auto downmix_one = [this](audio_sample const* l) -> audio_sample
-				{
-					return downmix(l, this->channel_count);
-				};
-				for (size_t i = 0; i < bucket_count; ++i)
-				{
-					auto off = i*channel_count;
-					minimum[i] = downmix_one(minimum.get_ptr()+off);
-					maximum[i] = downmix_one(maximum.get_ptr()+off);
-					rms[i]     = downmix_one(rms.get_ptr()+off);
-				}
-				channel_count = 1;
-				channel_map = audio_chunk::channel_config_mono;
-				auto new_list_size = (t_size)(bucket_count * channel_count);
-				minimum.set_count(new_list_size);
-				maximum.set_count(new_list_size);
-				rms.set_count(new_list_size);
-			}
-
-			// one inner list per channel
-			pfc::list_t<pfc::list_t<float>> tr_minimum, tr_maximum, tr_rms;
-			{
-				pfc::list_t<float> one_channel;
-				one_channel.set_size(bucket_count);
-				tr_minimum.add_items_repeat(one_channel, channel_count);
-				tr_maximum.add_items_repeat(one_channel, channel_count);
-				tr_rms.add_items_repeat(one_channel, channel_count);
-			}
+			ref_ptr<waveform_impl> ret(new waveform_impl(channel_count, (unsigned)bucket_count, channel_map));
 
 			throw_if_aborting(abort_cb);
-			transpose(tr_minimum, minimum, channel_count, bucket);
+			transpose(*ret, field::minimum, minimum, channel_count, bucket);
 			throw_if_aborting(abort_cb);
-			transpose(tr_maximum, maximum, channel_count, bucket);
+			transpose(*ret, field::maximum, maximum, channel_count, bucket);
 			throw_if_aborting(abort_cb);
-			transpose(tr_rms, rms, channel_count, bucket);
-
-			ref_ptr<waveform_impl> ret(new waveform_impl);
-			ret->fields.set("minimum", tr_minimum);
-			ret->fields.set("maximum", tr_maximum);
-			ret->fields.set("rms", tr_rms);
-			ret->channel_map = channel_map;
+			transpose(*ret, field::rms, rms, channel_count, bucket);
 
 			return ret;
 		}
@@ -383,6 +389,10 @@ namespace wave
 		uint64_t last_update_time_count;
 		service_ptr_t<input_decoder> decoder;
 		abort_callback* abort_cb;
+		pfc::string8 content_key;
+		t_filestats file_stats;
+		uint64_t start_time_count;
+		double audio_seconds;
 
 		std::unique_ptr<waveform_builder> builder;
 		std::unique_ptr<audio_source> source;
@@ -392,7 +402,7 @@ namespace wave
 		delete state;
 	}
 
-	process_result::type cache_impl::process_file(service_ptr_t<waveform_query> q, std::shared_ptr<process_state>& state)
+	process_result::type cache_impl::process_file(service_ptr_t<waveform_query> q, std::shared_ptr<process_state>& state, ref_ptr<waveform>& found)
 	{
 		playable_location_impl loc = q->get_location();
 		try {
@@ -403,23 +413,45 @@ namespace wave
 				if (is_of_forbidden_protocol(loc) && !user_requested)
 				{
 					console::formatter() << "Wave cache: skipping location " << loc;
+					++stats.skipped;
 					return process_result::elided;
 				}
 
+				bool is_cached = false;
 				{
 					std::lock_guard<std::mutex> lk(cache_mutex);
 					if (!store || flush_callback.is_aborting())
 					{
 						return process_result::aborted;
 					}
-					if (!user_requested && store->has(loc))
-					{
+					is_cached = !user_requested && store->has(loc);
+				}
+				if (is_cached)
+				{
+					if (!is_stale(loc, flush_callback)) {
 						console::formatter() << "Wave cache: redundant request for " << loc;
-						if (store->has(loc)) {
-							return process_result::elided;
-						}
+						++stats.hits;
+						if (lacks_content_key(loc))
+							backfill_content_key(loc, flush_callback);
+						return process_result::elided;
 					}
+					console::formatter() << "Wave cache: track modified since last analysis, rescanning " << loc;
+					++stats.stale;
 				}
+				else if (!user_requested)
+				{
+					// Sidecar files are only read for tracks the store lacks.
+					if (get_sidecar_waveform(loc, found, flush_callback))
+					{
+						console::formatter() << "Wave cache: using sidecar waveform for " << loc;
+						++stats.sidecar_hits;
+						return process_result::elided;
+					}
+					++stats.misses;
+				}
+
+				t_filestats file_stats = filestats_invalid;
+				try_get_file_stats(loc.get_path(), file_stats, flush_callback);
 
 				// Test whether tracks are in the Media Library or not
 				if (!g_analyse_tracks_outside_library.get())
@@ -443,12 +475,27 @@ namespace wave
 						{
 							bool in_library = res.get();
 							if (!in_library)
+							{
+								++stats.skipped;
 								return process_result::elided;
+							}
 							break;
 						}
 					}
 				}
 
+				pfc::string8 content_key;
+				if (g_relink_by_content.get())
+				{
+					compute_content_key(loc.get_path(), content_key, flush_callback);
+					if (!user_requested && content_key.length() && relink_by_content(loc, content_key, file_stats, flush_callback))
+					{
+						console::formatter() << "Wave cache: reused waveform of identical content for " << loc;
+						++stats.hits;
+						return process_result::elided;
+					}
+				}
+
 				std::string location_string;
 				{
 					std::ostringstream oss;
@@ -460,11 +507,19 @@ namespace wave
 				state->buckets_filled = 0;
 				state->last_update_time_count = 0;
 				QueryPerformanceFrequency((LARGE_INTEGER*)&state->time_frequency);
+				QueryPerformanceCounter((LARGE_INTEGER*)&state->start_time_count);
+				state->audio_seconds = 0.0;
 				state->abort_cb = &flush_callback;
+				state->content_key = content_key;
+				state->file_stats = file_stats;
 				bool should_downmix = g_downmix_in_analysis.get();
 
+				++stats.scans_started;
 				if (!input_entry::g_is_supported_path(loc.get_path()))
+				{
+					++stats.failures[scan_failure::unsupported];
 					return process_result::failed;
+				}
 
 				input_entry::g_open_for_decoding(state->decoder, 0, loc.get_path(), *state->abort_cb);
 
@@ -472,16 +527,21 @@ namespace wave
 				{
 					state->decoder->initialize(subsong, input_flag_simpledecode, *state->abort_cb);
 					if (!state->decoder->can_seek())
+					{
+						++stats.failures[scan_failure::not_seekable];
 						return process_result::failed;
+					}
 
 					t_int64 sample_rate = 0;
 					t_int64 sample_count = 0;
-					if (!try_determine_song_parameters(state->decoder, subsong, sample_rate, sample_count, *state->abort_cb))
-						return process_result::failed;
-
 					// around a month ought to be enough for anyone
-					if (sample_count <= 0 || sample_count > sample_rate * 60 * 60 * 24 * 31)
+					if (!try_determine_song_parameters(state->decoder, subsong, sample_rate, sample_count, *state->abort_cb) ||
+						sample_count <= 0 || sample_count > sample_rate * 60 * 60 * 24 * 31)
+					{
+						++stats.failures[scan_failure::bad_length];
 						return process_result::failed;
+					}
+					state->audio_seconds = (double)sample_count / sample_rate;
 
 					state->builder.reset(new waveform_builder(sample_count, should_downmix, *state->abort_cb, incremental_output));
 					state->source.reset(new audio_source(*state->abort_cb, state->decoder, sample_count));
@@ -505,12 +565,23 @@ namespace wave
 					state->wf = state->builder->finalize_waveform();
 
 					console::formatter() << "Wave cache: finished analysis of " << loc;
-					std::lock_guard<std::mutex> lk(cache_mutex);
-					open_store();
-					if (store)
-						store->put(state->wf, loc);
-					else
-						console::formatter() << "Wave cache: could not open backend database, losing new data for " << loc;
+					uint64_t time_count;
+					QueryPerformanceCounter((LARGE_INTEGER*)&time_count);
+					stats.add_scan((time_count - state->start_time_count) / (double)state->time_frequency, state->audio_seconds);
+					{
+						std::lock_guard<std::mutex> lk(cache_mutex);
+						open_store();
+						if (store)
+						{
+							store->put(state->wf, loc);
+							if (state->content_key.length())
+								store->set_content_key(loc, state->content_key);
+							store->set_file_stats(loc, state->file_stats);
+						}
+						else
+							console::formatter() << "Wave cache: could not open backend database, losing new data for " << loc;
+					}
+					put_sidecar_waveform(loc, state->wf, state->file_stats);
 					return process_result::done;
 				}
 			}
@@ -518,23 +589,28 @@ namespace wave
 		catch (foobar2000_io::exception_aborted&)
 		{
 			// NOTE(zao): Abort state is detected in caller.
+			++stats.scans_aborted;
 			return process_result::aborted;
 		}
 		catch (foobar2000_io::exception_io_not_found& e)
 		{
 			console::formatter() << "Wave cache: could not open/find " << loc << ", " << e.what();
+			++stats.failures[scan_failure::not_found];
 		}
 		catch (foobar2000_io::exception_io& ex)
 		{
 			console::formatter() << "Wave cache: generic IO exception (" << ex.what() <<") for " << loc;
+			++stats.failures[scan_failure::io_error];
 		}
 		catch (channel_mismatch_exception&)
 		{
 			console::formatter() << "Wave cache: track with mismatching channels, bailing out on " << loc;
+			++stats.failures[scan_failure::channel_mismatch];
 		}
 		catch (std::exception& ex)
 		{
 			console::formatter() << "Wave cache: generic exception (" << ex.what() <<") for " << loc;
+			++stats.failures[scan_failure::other];
 		}
 		return process_result::failed;
 	}
@@ -547,6 +623,69 @@ namespace wave
 		return state->wf;
 	}
 
+	// Gives loc the waveform of a track with the same content. The original is looked for
+	// between two holds of the lock, as that can take long on a network share.
+	bool cache_impl::relink_by_content(playable_location const& loc, char const* content_key, t_filestats const& file_stats, abort_callback& abort_cb)
+	{
+		pfc::string8 original;
+		{
+			std::lock_guard<std::mutex> lk(cache_mutex);
+			if (!store || !store->find_content(content_key, loc.get_subsong(), original))
+				return false;
+		}
+
+		bool original_exists = false;
+		try {
+			original_exists = filesystem::g_exists(original, abort_cb);
+		}
+		catch (exception_io&) {}
+
+		std::lock_guard<std::mutex> lk(cache_mutex);
+		if (!store || !store->relink(loc, content_key, original_exists))
+			return false;
+		store->set_file_stats(loc, file_stats);
+		return true;
+	}
+
+	// A request answered from the store is scanned again if its track changed since, and
+	// otherwise gets the content key it may lack.
+	void cache_impl::recheck(service_ptr_t<waveform_query> request)
+	{
+		playable_location_impl loc = request->get_location();
+		try {
+			if (is_stale(loc, flush_callback))
+			{
+				// The rescan counts the lookup as stale instead.
+				--stats.hits;
+				enqueue_request(request);
+				return;
+			}
+			if (lacks_content_key(loc))
+				backfill_content_key(loc, flush_callback);
+		}
+		catch (std::exception&) {}
+	}
+
+	// Waveforms stored before content keys were recorded have none, so they could not be
+	// relinked once their tracks move. They get one when accessed or swept for changes.
+	bool cache_impl::lacks_content_key(playable_location const& loc)
+	{
+		if (!g_relink_by_content.get())
+			return false;
+		std::lock_guard<std::mutex> lk(cache_mutex);
+		return store && store->keeps_content_keys() && !store->has_content_key(loc);
+	}
+
+	void cache_impl::backfill_content_key(playable_location const& loc, abort_callback& abort_cb)
+	{
+		pfc::string8 content_key;
+		if (!g_relink_by_content.get() || !compute_content_key(loc.get_path(), content_key, abort_cb))
+			return;
+		std::lock_guard<std::mutex> lk(cache_mutex);
+		if (store)
+			store->set_content_key(loc, content_key);
+	}
+
 	bool cache_impl::is_refresh_due(process_state* state) {
 		if (!g_report_incremental_results.get()) {
 			return false;
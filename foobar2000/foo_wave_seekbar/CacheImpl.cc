@@ -5,15 +5,23 @@
 
 #include "PchSeekbar.h"
 #include "CacheImpl.h"
-#include "BackingStore.h"
+#include "SqliteStore.h"
+#include "PackStore.h"
+#include "SidecarStore.h"
+#include "Archive.h"
 #include "Helpers.h"
+#include "waveform_sdk/WaveformImpl.h"
 #include <regex>
 #include <stdint.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <thread>
 #include "util/Barrier.h"
+#include "util/Filesystem.h"
+#include "util/Parallel.h"
+#include "json/json.h"
 
 // {EBEABA3F-7A8E-4A54-A902-3DCF716E6A97}
 const GUID guid_seekbar_branch = { 0xebeaba3f, 0x7a8e, 0x4a54, { 0xa9, 0x2, 0x3d, 0xcf, 0x71, 0x6e, 0x6a, 0x97 } };
@@ -26,8 +34,48 @@ static const GUID guid_max_concurrent_jobs =
 static const GUID guid_always_rescan_user = 
 { 0x44aa5dab, 0xf35e, 0x4e21, { 0x80, 0x33, 0x80, 0x8, 0x7b, 0x25, 0x50, 0xfd } };
 
+// {0E6A4F3D-91C7-4B25-8D1E-7C2B5A9F6E14}
+static const GUID guid_rescan_stale_on_access = 
+{ 0xe6a4f3d, 0x91c7, 0x4b25, { 0x8d, 0x1e, 0x7c, 0x2b, 0x5a, 0x9f, 0x6e, 0x14 } };
+
+// {3F6B1C84-5E2D-4A97-B0C3-8D41E7A29F56}
+static const GUID guid_read_sidecars = 
+{ 0x3f6b1c84, 0x5e2d, 0x4a97, { 0xb0, 0xc3, 0x8d, 0x41, 0xe7, 0xa2, 0x9f, 0x56 } };
+
+// {A8D24E19-6C07-4F3B-9E85-12B7C0D6F3A4}
+static const GUID guid_write_sidecars = 
+{ 0xa8d24e19, 0x6c07, 0x4f3b, { 0x9e, 0x85, 0x12, 0xb7, 0xc0, 0xd6, 0xf3, 0xa4 } };
+
+// {71C5A0E3-D84B-4F26-9B17-6E3A2C8D05F9}
+static const GUID guid_use_pack_store = 
+{ 0x71c5a0e3, 0xd84b, 0x4f26, { 0x9b, 0x17, 0x6e, 0x3a, 0x2c, 0x8d, 0x5, 0xf9 } };
+
+// {5D2E8B47-C3A1-4F69-8E0D-B4716A3F92C8}
+static const GUID guid_background_compaction = 
+{ 0x5d2e8b47, 0xc3a1, 0x4f69, { 0x8e, 0xd, 0xb4, 0x71, 0x6a, 0x3f, 0x92, 0xc8 } };
+
+// {C6A3F08B-2D94-4E71-A5B8-0F19E7D34C62}
+static const GUID guid_import_remaps = 
+{ 0xc6a3f08b, 0x2d94, 0x4e71, { 0xa5, 0xb8, 0xf, 0x19, 0xe7, 0xd3, 0x4c, 0x62 } };
+
+// {5414CBBB-088F-49B6-AF84-62B88EC115A3}
+static const GUID guid_compact_finished_waveforms = 
+{ 0x5414cbbb, 0x88f, 0x49b6, { 0xaf, 0x84, 0x62, 0xb8, 0x8e, 0xc1, 0x15, 0xa3 } };
+
+// {3AE8B838-A742-4EC7-B0C8-A76A33081171}
+static const GUID guid_compact_scanning_waveforms = 
+{ 0x3ae8b838, 0xa742, 0x4ec7, { 0xb0, 0xc8, 0xa7, 0x6a, 0x33, 0x8, 0x11, 0x71 } };
+
 static advconfig_integer_factory g_max_concurrent_jobs("Number of concurrent scanning threads (capped by virtual processor count)", guid_max_concurrent_jobs, guid_seekbar_branch, 0.0, 3, 1, 16);
+static advconfig_checkbox_factory g_background_compaction("Compact the waveform database a little at a time while idle", guid_background_compaction, guid_seekbar_branch, 0.0, true);
 static advconfig_checkbox_factory g_always_rescan_user("Always rescan track if requested by user", guid_always_rescan_user, guid_seekbar_branch, 0.0, false);
+static advconfig_checkbox_factory g_rescan_stale_on_access("Rescan tracks modified since their waveform was stored", guid_rescan_stale_on_access, guid_seekbar_branch, 0.0, true);
+static advconfig_checkbox_factory g_read_sidecars("Read waveforms from sidecar files next to tracks", guid_read_sidecars, guid_seekbar_branch, 0.0, true);
+static advconfig_checkbox_factory g_use_pack_store("Store waveforms in a pack file instead of the database (starts out empty, requires restart)", guid_use_pack_store, guid_seekbar_branch, 0.0, false);
+static advconfig_string_factory g_import_remaps("Path prefixes to replace when importing waveforms (old>new, separated by |)", guid_import_remaps, guid_seekbar_branch, 0.0, "");
+static advconfig_checkbox_factory g_write_sidecars("Write waveforms to sidecar files next to tracks", guid_write_sidecars, guid_seekbar_branch, 0.0, false);
+static advconfig_checkbox_factory g_compact_finished_waveforms("Hold finished waveforms in memory at 16-bit precision", guid_compact_finished_waveforms, guid_seekbar_branch, 0.0, false);
+static advconfig_checkbox_factory g_compact_scanning_waveforms("Hold waveforms being scanned in memory at 16-bit precision", guid_compact_scanning_waveforms, guid_seekbar_branch, 0.0, false);
 
 extern "C" {
 uint32_t foo(char const* s);
@@ -44,13 +92,17 @@ namespace wave
 		std::thread* thread;
 		util::barrier init_sync;
 		std::mutex mutex;
-		std::condition_variable bump;
+		std::condition_variable bump, compactor_bump;
 		std::atomic<bool> should_shutdown;
 	};
 	static cache_run_state run_state;
 
 	static std::deque<service_ptr_t<waveform_query> > requests_by_urgency[3];
 
+	// Requests answered from the store, looked at again by the workers between chunks of
+	// their scans for a changed track or a missing content key.
+	static std::deque<service_ptr_t<waveform_query> > recheck_queue;
+
 	struct worker_result
 	{
 		playable_location_impl loc;
@@ -62,12 +114,22 @@ namespace wave
 	cache_impl::cache_impl()
 	{
 		is_initialized = 0;
+		jobs_in_progress = 0;
 	}
 
 	cache_impl::~cache_impl()
 	{
 	}
 
+	// Waveforms handed out are held by the queries and panels for as long as the track is shown,
+	// each tier can have them narrowed to 16 bits for that time.
+	static ref_ptr<waveform> hold_waveform(ref_ptr<waveform> const& wf, advconfig_checkbox_factory& compact)
+	{
+		if (!wf.is_valid() || !compact.get())
+			return wf;
+		return make_compact_waveform(wf);
+	}
+
 	struct waveform_query_shared : waveform_query
 	{
 		waveform_query_shared()
@@ -175,10 +237,48 @@ namespace wave
 	void cache_impl::open_store()
 	{
 		if (store) return;
+		bool use_pack = g_use_pack_store.get();
 		cache_filename = core_api::get_profile_path();
-		cache_filename += "\\wavecache.db";
+		cache_filename += use_pack ? "\\wavecache.pack" : "\\wavecache.db";
 		cache_filename = cache_filename.subString(7);
-		store.reset(new backing_store(cache_filename));
+		if (use_pack)
+			store.reset(new pack_store(cache_filename));
+		else
+			store.reset(new sqlite_store(cache_filename));
+		sidecars.reset(new sidecar_store);
+	}
+
+	bool cache_impl::get_sidecar_waveform(playable_location const& loc, ref_ptr<waveform>& out, abort_callback& abort_cb)
+	{
+		if (!sidecars || !g_read_sidecars.get())
+			return false;
+		return sidecars->get(out, loc, abort_cb);
+	}
+
+	// Never stale with the setting off. The file is looked at outside the lock, the store only under it.
+	bool cache_impl::is_stale(playable_location const& loc, abort_callback& abort_cb)
+	{
+		t_filestats stored, current;
+		if (!g_rescan_stale_on_access.get() || !try_get_file_stats(loc.get_path(), current, abort_cb))
+			return false;
+		std::lock_guard<std::mutex> lk(cache_mutex);
+		if (!store)
+			return false;
+		if (!store->get_file_stats(loc, stored))
+		{
+			// Entries from before stamps were recorded are assumed current.
+			store->set_file_stats(loc, current);
+			return false;
+		}
+		return file_stats_differ(stored, current);
+	}
+
+	void cache_impl::put_sidecar_waveform(playable_location const& loc, ref_ptr<waveform> const& wf, t_filestats const& stats)
+	{
+		if (!sidecars || !g_write_sidecars.get())
+			return;
+		if (!sidecars->put(wf, loc, stats))
+			console::formatter() << "Wave cache: could not write sidecar file for " << loc;
 	}
 
 	void dispatch_partial_response(std::function<void(std::shared_ptr<get_response>)> completion_handler, ref_ptr<waveform> waveform, size_t buckets_filled)
@@ -191,8 +291,20 @@ namespace wave
 
 	bool cache_impl::get_waveform_sync(playable_location const& loc, ref_ptr<waveform>& out)
 	{
-		if (has_waveform(loc))
-			return store->get(out, loc);
+		abort_callback_dummy abort_cb;
+		if (store && store->has(loc) && store->get(out, loc))
+		{
+			++stats.hits;
+			out = hold_waveform(out, g_compact_finished_waveforms);
+			return true;
+		}
+		if (get_sidecar_waveform(loc, out, abort_cb))
+		{
+			++stats.sidecar_hits;
+			out = hold_waveform(out, g_compact_finished_waveforms);
+			return true;
+		}
+		++stats.misses;
 		return false;
 	}
 
@@ -213,30 +325,48 @@ namespace wave
 		{
 			ref_ptr<waveform> wf;
 			store->get(wf, loc);
-			request->set_waveform(wf, 2048);
+			++stats.hits;
+			request->set_waveform(hold_waveform(wf, g_compact_finished_waveforms), 2048);
+
+			// Statting the track can stall on a network share, so whether it changed since is
+			// found out on a worker, which queues the request again if it did.
+			std::unique_lock<std::mutex> lk(worker_mutex);
+			recheck_queue.push_back(request);
+			worker_bump.notify_one();
 		}
 		else
 		{
-			std::unique_lock<std::mutex> lk(worker_mutex);
-			switch (request->get_urgency()) {
-			case waveform_query::needed_urgency: {
-				requests_by_urgency[waveform_query::needed_urgency].push_front(request);
-			} break;
-			case waveform_query::desired_urgency:
-			case waveform_query::bulk_urgency: {
-				requests_by_urgency[request->get_urgency()].push_back(request);
-			} break;
-			}
-			worker_bump.notify_one();
+			enqueue_request(request);
 		}
 	}
 
+	void cache_impl::enqueue_request(service_ptr_t<waveform_query> request)
+	{
+		std::unique_lock<std::mutex> lk(worker_mutex);
+		switch (request->get_urgency()) {
+		case waveform_query::needed_urgency: {
+			requests_by_urgency[waveform_query::needed_urgency].push_front(request);
+		} break;
+		case waveform_query::desired_urgency:
+		case waveform_query::bulk_urgency: {
+			requests_by_urgency[request->get_urgency()].push_back(request);
+		} break;
+		}
+		worker_bump.notify_one();
+	}
+
 	void cache_impl::remove_dead_waveforms()
 	{
 		if (store)
 		{
 			defer_action([this]{
-				store->remove_dead();
+				auto run = [this](threaded_process_status& status, abort_callback& abort_cb)
+				{
+					store->remove_dead(status, abort_cb);
+				};
+				threaded_process::g_run_modeless(threaded_process_callback_lambda::create(run),
+					threaded_process::flag_show_progress_dual | threaded_process::flag_show_abort | threaded_process::flag_show_delayed,
+					core_api::get_main_window(), "Removing dead waveforms");
 			});
 		}
 	}
@@ -246,7 +376,14 @@ namespace wave
 		if (store)
 		{
 			defer_action([this]{
-				store->compact();
+				// A full rewrite of a large database takes too long to hold up the caller.
+				auto run = [this](threaded_process_status&, abort_callback&)
+				{
+					store->compact();
+				};
+				threaded_process::g_run_modeless(threaded_process_callback_lambda::create(run),
+					threaded_process::flag_show_delayed,
+					core_api::get_main_window(), "Compacting waveform database");
 			});
 		}
 	}
@@ -266,12 +403,213 @@ namespace wave
 		}
 	}
 
+	void cache_impl::rescan_changed_waveforms()
+	{
+		if (store)
+		{
+			defer_action([this]{
+				auto run = [this](threaded_process_status& status, abort_callback& abort_cb)
+				{
+					size_t const stat_thread_count = 8, batch_size = 256;
+					enum { entry_fresh, entry_stale, entry_unstamped, entry_missing };
+
+					std::vector<stamped_location> entries;
+					store->get_all_stamped(entries);
+					bool const keeps_content_keys = store->keeps_content_keys();
+					std::vector<t_filestats> current(entries.size(), filestats_invalid);
+					std::vector<char> verdicts(entries.size(), entry_missing);
+
+					for (size_t first = 0; first < entries.size(); first += batch_size)
+					{
+						abort_cb.check();
+						status.set_progress(first, entries.size());
+						size_t last = (std::min)(entries.size(), first + batch_size);
+						util::parallel_for(first, last, stat_thread_count, [&](size_t i)
+						{
+							auto& entry = entries[i];
+							if (abort_cb.is_aborting() || !try_get_file_stats(entry.location.get_path(), current[i], abort_cb))
+								return;
+							if (entry.stats == filestats_invalid)
+								verdicts[i] = entry_unstamped;
+							else
+								verdicts[i] = file_stats_differ(entry.stats, current[i]) ? entry_stale : entry_fresh;
+
+							// Stale entries get their key when rescanned.
+							if (verdicts[i] != entry_stale && keeps_content_keys && !entry.has_content_key)
+							{
+								try {
+									backfill_content_key(entry.location, abort_cb);
+								}
+								catch (std::exception&) {}
+							}
+						});
+					}
+					abort_cb.check();
+
+					size_t stale_count = 0;
+					for (size_t i = 0; i < entries.size(); ++i)
+					{
+						if (verdicts[i] == entry_unstamped)
+						{
+							std::lock_guard<std::mutex> lk(cache_mutex);
+							store->set_file_stats(entries[i].location, current[i]);
+						}
+						else if (verdicts[i] == entry_stale)
+						{
+							auto q = create_query(entries[i].location, waveform_query::bulk_urgency, waveform_query::forced_query);
+							get_waveform(q);
+							++stale_count;
+						}
+					}
+					console::formatter() << "Waveform cache: " << stale_count << " of " << entries.size() << " waveforms were out of date and have been enqueued for rescanning.";
+				};
+				threaded_process::g_run_modeless(threaded_process_callback_lambda::create(run),
+					threaded_process::flag_show_progress | threaded_process::flag_show_abort | threaded_process::flag_show_delayed,
+					core_api::get_main_window(), "Checking waveforms for changes");
+			});
+		}
+	}
+
+	void cache_impl::export_waveforms(char const* path)
+	{
+		if (store)
+		{
+			pfc::string8 target = path;
+			defer_action([this, target]{
+				auto run = [this, target](threaded_process_status& status, abort_callback& abort_cb)
+				{
+					archive::export_store(*store, target, status, abort_cb);
+				};
+				threaded_process::g_run_modeless(threaded_process_callback_lambda::create(run),
+					threaded_process::flag_show_progress | threaded_process::flag_show_abort | threaded_process::flag_show_delayed,
+					core_api::get_main_window(), "Exporting waveforms");
+			});
+		}
+	}
+
+	void cache_impl::import_waveforms(char const* path)
+	{
+		if (store)
+		{
+			pfc::string8 source = path, spec;
+			g_import_remaps.get(spec);
+			auto remaps = archive::parse_remaps(spec);
+			defer_action([this, source, remaps]{
+				auto run = [this, source, remaps](threaded_process_status& status, abort_callback& abort_cb)
+				{
+					archive::import_store(*store, source, remaps, status, abort_cb);
+				};
+				threaded_process::g_run_modeless(threaded_process_callback_lambda::create(run),
+					threaded_process::flag_show_progress | threaded_process::flag_show_abort | threaded_process::flag_show_delayed,
+					core_api::get_main_window(), "Importing waveforms");
+			});
+		}
+	}
+
+	Json::Value cache_impl::queue_statistics()
+	{
+		std::lock_guard<std::mutex> lk(worker_mutex);
+		Json::Value out(Json::objectValue);
+		out["needed"] = (Json::UInt64)requests_by_urgency[waveform_query::needed_urgency].size();
+		out["desired"] = (Json::UInt64)requests_by_urgency[waveform_query::desired_urgency].size();
+		out["bulk"] = (Json::UInt64)requests_by_urgency[waveform_query::bulk_urgency].size();
+		out["in_progress"] = (Json::UInt64)jobs_in_progress.load();
+		return out;
+	}
+
+	void cache_impl::report_statistics()
+	{
+		pfc::string8 json_path = core_api::get_profile_path();
+		json_path << "\\wavecache-stats.json";
+		defer_action([this, json_path]{
+			auto run = [this, json_path](threaded_process_status&, abort_callback&)
+			{
+				Json::Value report(Json::objectValue);
+				report["cache"] = stats.to_json();
+				report["queues"] = queue_statistics();
+				{
+					// Counting rows scans whole tables, so puts wait for it.
+					std::lock_guard<std::mutex> lk(cache_mutex);
+					if (store)
+					{
+						store_statistics s;
+						store->get_statistics(s);
+						report["store"] = s.to_json();
+					}
+				}
+				print_statistics(report);
+
+				std::string text = Json::StyledWriter().write(report);
+				if (util::replace_file_contents(util::file_location_to_wide_path(json_path), text.data(), text.size()))
+					console::formatter() << "Waveform cache statistics written to " << json_path;
+				else
+					console::formatter() << "Waveform cache statistics could not be written to " << json_path;
+			};
+			threaded_process::g_run_modeless(threaded_process_callback_lambda::create(run),
+				threaded_process::flag_show_delayed, core_api::get_main_window(), "Collecting waveform cache statistics");
+		});
+	}
+
 	void cache_impl::defer_action(std::function<void()> fun)
 	{
 		// TODO(zao): Run maintenance task off-thread. Do these in cache_main?
 		fun();
 	}
 
+	bool cache_impl::is_idle()
+	{
+		std::unique_lock<std::mutex> lk(worker_mutex);
+		return jobs_in_progress == 0 &&
+			recheck_queue.empty() &&
+			requests_by_urgency[0].empty() &&
+			requests_by_urgency[1].empty() &&
+			requests_by_urgency[2].empty();
+	}
+
+	// Brings an older store up to date, then frees database pages in small steps whenever
+	// no scans are queued or running, reporting each finished run to the console.
+	void cache_impl::compactor_main()
+	{
+		auto const idle_pause = std::chrono::seconds(30);
+		auto const step_pause = std::chrono::milliseconds(250);
+		t_uint64 const step_bytes = 1 << 20;
+
+		::SetThreadName(-1, "wave-compactor");
+		store->upgrade(flush_callback);
+		t_uint64 reclaimed = 0;
+		double spent_ms = 0.0;
+		std::chrono::milliseconds pause = idle_pause;
+		while (1) {
+			{
+				std::unique_lock<std::mutex> lk(run_state.mutex);
+				if (run_state.compactor_bump.wait_for(lk, pause, []{ return (bool)run_state.should_shutdown; })) {
+					break;
+				}
+			}
+			pause = idle_pause;
+			if (!g_background_compaction.get() || !is_idle()) {
+				continue;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			t_uint64 freed = store->compact_step(step_bytes);
+			spent_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (freed) {
+				reclaimed += freed;
+				pause = step_pause;
+			}
+			else if (reclaimed) {
+				console::formatter() << "Waveform cache: reclaimed " << reclaimed << " bytes from the database in "
+					<< pfc::format_float(spent_ms, 0, 0) << " ms of background compaction.";
+				reclaimed = 0;
+				spent_ms = 0.0;
+			}
+			else {
+				spent_ms = 0.0;
+			}
+		}
+	}
+
 	bool cache_impl::is_location_forbidden(playable_location const& loc)
 	{
 		return is_of_forbidden_protocol(loc);
@@ -279,11 +617,10 @@ namespace wave
 
 	bool cache_impl::has_waveform(playable_location const& loc)
 	{
-		if (store)
-		{
-			return store->has(loc);
-		}
-		return false;
+		if (store && store->has(loc))
+			return true;
+		abort_callback_dummy abort_cb;
+		return sidecars && g_read_sidecars.get() && sidecars->has(loc, abort_cb);
 	}
 
 	void cache_impl::remove_waveform(playable_location const& loc)
@@ -327,6 +664,7 @@ namespace wave
 			std::unique_lock<std::mutex> lk(cache_mutex);
 			run_state.should_shutdown = true;
 			run_state.bump.notify_one();
+			run_state.compactor_bump.notify_one();
 		}
 		run_state.thread->join();
 		delete run_state.thread;
@@ -347,17 +685,23 @@ namespace wave
 				jobs[0].is_valid() ||
 				jobs[1].is_valid() ||
 				jobs[2].is_valid() ||
+				recheck_queue.size() ||
 				requests_by_urgency[0].size() ||
 				requests_by_urgency[1].size() ||
 				requests_by_urgency[2].size();
 		};
 		while (1) {
+			service_ptr_t<waveform_query> recheck_request;
 			{
 				std::unique_lock<std::mutex> lk(worker_mutex);
 				worker_bump.wait(lk, is_ready);
 				if (should_workers_terminate) {
 					break;
 				}
+				if (recheck_queue.size()) {
+					recheck_request = recheck_queue.front();
+					recheck_queue.pop_front();
+				}
 				for (size_t i = 0; i < 3; ++i) {
 					if (jobs[i].is_valid()) {
 						break;
@@ -365,10 +709,14 @@ namespace wave
 					if (requests_by_urgency[i].size()) {
 						jobs[i] = requests_by_urgency[i].front();
 						requests_by_urgency[i].pop_front();
+						++jobs_in_progress;
 						break;
 					}
 				}
 			}
+			if (recheck_request.is_valid()) {
+				recheck(recheck_request);
+			}
 			for (size_t i = 0; i < 3; ++i) {
 				bool done = true;
 				auto& q = jobs[i];
@@ -376,7 +724,7 @@ namespace wave
 				if (q.is_valid()) {
 					float progress = 1.0f;
 					ref_ptr<waveform> wf;
-					auto res = process_file(q, s);
+					auto res = process_file(q, s, wf);
 					bool should_refresh = true;
 
 					switch (res) {
@@ -395,7 +743,8 @@ namespace wave
 						wf = render_waveform(s.get());
 					} break;
 					case process_result::elided: {
-						store->get(wf, q->get_location());
+						if (!wf.is_valid())
+							store->get(wf, q->get_location());
 					} break;
 					case process_result::aborted: {
 						std::unique_lock<std::mutex> lk(run_state.mutex);
@@ -406,12 +755,13 @@ namespace wave
 					}
 
 					if (should_refresh) {
-						q->set_waveform(wf, progress);
+						q->set_waveform(hold_waveform(wf, done ? g_compact_finished_waveforms : g_compact_scanning_waveforms), progress);
 					}
 
 					if (done) {
 						q.release();
 						s.reset();
+						--jobs_in_progress;
 					}
 				}
 			}
@@ -439,6 +789,7 @@ namespace wave
 			std::thread* t = new std::thread(with_idle_priority(std::bind(&cache_impl::worker_main, this, i, n)));
 			worker_threads.push_back(t);
 		}
+		std::thread* compactor = store ? new std::thread(with_idle_priority(std::bind(&cache_impl::compactor_main, this))) : nullptr;
 
 		OutputDebugStringA("Cache ready.\n");
 		{
@@ -470,6 +821,10 @@ namespace wave
 			t->join();
 			delete t;
 		}
+		if (compactor) {
+			compactor->join();
+			delete compactor;
+		}
 
 		auto make_bulk_job = [](service_ptr_t<waveform_query> const& q) -> job {
 			job j = {};
@@ -492,6 +847,8 @@ namespace wave
 		}
 		store->put_jobs(flush_jobs);
 		store.reset();
+		if (sidecars)
+			sidecars->shutdown();
 	}
 
 	struct cache_init_stage : init_stage_callback
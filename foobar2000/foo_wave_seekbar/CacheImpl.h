@@ -8,6 +8,7 @@
 #include "Cache.h"
 #include "waveform_sdk/Waveform.h"
 #include "Job.h"
+#include "Statistics.h"
 #include <list>
 #include <stack>
 #include <intrin.h>
@@ -33,6 +34,7 @@ namespace wave
 	}
 
 	struct backing_store;
+	struct sidecar_store;
 
 	bool is_of_forbidden_protocol(playable_location const& loc);
 
@@ -65,6 +67,10 @@ namespace wave
 		void remove_dead_waveforms() override;
 		void compact_storage() override;
 		void rescan_waveforms() override;
+		void rescan_changed_waveforms() override;
+		void export_waveforms(char const* path) override;
+		void import_waveforms(char const* path) override;
+		void report_statistics() override;
 
 		bool has_waveform(playable_location const& loc) override;
 		void remove_waveform(playable_location const& loc) override;
@@ -82,14 +88,27 @@ namespace wave
 	private:
 		void cache_main();
 		void worker_main(size_t i, size_t n);
+		void enqueue_request(service_ptr_t<waveform_query> request);
+		void recheck(service_ptr_t<waveform_query> request);
+		void compactor_main();
+		bool is_idle();
+		Json::Value queue_statistics();
 		void open_store();
 		void load_data();
-		process_result::type process_file(service_ptr_t<waveform_query> q, std::shared_ptr<process_state>& state);
+		// found is set when an elided request was answered from elsewhere than the store.
+		process_result::type process_file(service_ptr_t<waveform_query> q, std::shared_ptr<process_state>& state, ref_ptr<waveform>& found);
 		float render_progress(process_state* state);
 		ref_ptr<waveform> render_waveform(process_state* state);
 		bool is_refresh_due(process_state* state);
+		bool is_stale(playable_location const& loc, abort_callback& abort_cb);
+		bool relink_by_content(playable_location const& loc, char const* content_key, t_filestats const& file_stats, abort_callback& abort_cb);
+		bool lacks_content_key(playable_location const& loc);
+		void backfill_content_key(playable_location const& loc, abort_callback& abort_cb);
+		bool get_sidecar_waveform(playable_location const& loc, ref_ptr<waveform>& out, abort_callback& abort_cb);
+		void put_sidecar_waveform(playable_location const& loc, ref_ptr<waveform> const& wf, t_filestats const& stats);
 
 		std::atomic<bool> should_workers_terminate;
+		std::atomic<long> jobs_in_progress;
 		std::mutex worker_mutex;
 		std::condition_variable worker_bump;
 
@@ -108,6 +127,8 @@ namespace wave
 		abort_callback_impl flush_callback;
 		std::deque<service_ptr_t<waveform_query> > job_flush_queue;
 		std::shared_ptr<backing_store> store;
+		std::shared_ptr<sidecar_store> sidecars;
+		cache_statistics stats;
 	};
 
 	struct cache_initquit : initquit
@@ -118,4 +139,7 @@ namespace wave
 
 	bool try_determine_song_parameters(service_ptr_t<input_decoder>& decoder, t_uint32 subsong,
 		t_int64& sample_rate, t_int64& sample_count, abort_callback& abort_cb);
+
+	bool try_get_file_stats(char const* path, t_filestats& out, abort_callback& abort_cb);
+	bool file_stats_differ(t_filestats const& stored, t_filestats const& current);
 }
@@ -0,0 +1,61 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PchSeekbar.h"
+#include "ContentKey.h"
+
+namespace wave
+{
+	static t_filesize const content_key_span = 256 * 1024;
+
+	static void hash_range(service_ptr_t<file>& f, hasher_md5& hasher, hasher_md5_state& state,
+		t_filesize offset, t_filesize size, abort_callback& abort_cb)
+	{
+		std::vector<char> buf(64 * 1024);
+		f->seek(offset, abort_cb);
+		while (size > 0)
+		{
+			t_size n = (t_size)(std::min)(size, (t_filesize)buf.size());
+			f->read_object(buf.data(), n, abort_cb);
+			hasher.process(state, buf.data(), n);
+			size -= n;
+		}
+	}
+
+	bool compute_content_key(char const* path, pfc::string8& out, abort_callback& abort_cb)
+	{
+		try
+		{
+			service_ptr_t<file> f;
+			filesystem::g_open_read(f, path, abort_cb);
+			if (!f->can_seek())
+				return false;
+
+			t_filesize size = f->get_size_ex(abort_cb);
+			static_api_ptr_t<hasher_md5> hasher;
+			hasher_md5_state state;
+			hasher->initialize(state);
+
+			if (size <= 2 * content_key_span)
+			{
+				hash_range(f, *hasher, state, 0, size, abort_cb);
+			}
+			else
+			{
+				hash_range(f, *hasher, state, 0, content_key_span, abort_cb);
+				hash_range(f, *hasher, state, size - content_key_span, content_key_span, abort_cb);
+			}
+
+			out = pfc::format_uint(size);
+			out += ":";
+			out += hasher->get_result(state).asString();
+			return true;
+		}
+		catch (exception_io&)
+		{
+		}
+		return false;
+	}
+}
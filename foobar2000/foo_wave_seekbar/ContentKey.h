@@ -0,0 +1,13 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+namespace wave
+{
+	// Identifies the contents of a file regardless of where it lives, as the
+	// file size and an MD5 of its first and last few hundred kilobytes.
+	bool compute_content_key(char const* path, pfc::string8& out, abort_callback& abort_cb);
+}
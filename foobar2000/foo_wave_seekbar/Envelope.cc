@@ -0,0 +1,414 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Envelope.h"
+#include "Pack.h"
+#include "Signature.h"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+namespace pack
+{
+	namespace
+	{
+		char const magic[4] = { 'W', 'S', 'e', '1' };
+
+		unsigned const field_count = 3;
+		unsigned const literal_count = 16, token_count = literal_count + 12; // bit lengths 5 through 16
+		uint32_t const scale_bits = 12, scale = 1 << scale_bits;
+		uint32_t const rans_low = 1 << 23;
+
+		template <typename T>
+		void write_pod(std::vector<char>& out, T const& t)
+		{
+			char const* p = (char const*)&t;
+			out.insert(out.end(), p, p + sizeof(T));
+		}
+
+		template <typename T>
+		T read_pod(char const* p)
+		{
+			T t;
+			std::memcpy(&t, p, sizeof(T));
+			return t;
+		}
+
+		unsigned bit_length(uint32_t v)
+		{
+			unsigned n = 0;
+			while (v)
+			{
+				++n;
+				v >>= 1;
+			}
+			return n;
+		}
+
+		// Quantized values as they are stored, minimum and maximum signed, rms unsigned.
+		struct field_reader
+		{
+			field_reader(char const* p, unsigned bits) : p(p), bits(bits) {}
+
+			int32_t get(unsigned field, size_t i) const
+			{
+				if (bits == 8)
+					return field == 2 ? (int32_t)(uint8_t)p[i] : (int32_t)(int8_t)p[i];
+				uint16_t u = read_pod<uint16_t>(p + i*2);
+				return field == 2 ? (int32_t)u : (int32_t)(int16_t)u;
+			}
+
+			char const* p;
+			unsigned bits;
+		};
+
+		// The three predictions for bucket i, given the values of bucket i-1 and the
+		// minimum of bucket i (and its maximum, for the rms). The weights were picked
+		// on music, where the envelope widens and narrows about as much on both sides.
+		struct predictor
+		{
+			predictor() : min(0), max(0), rms(0) {}
+
+			int32_t predict(unsigned field, int32_t cur_min, int32_t cur_max) const
+			{
+				switch (field)
+				{
+				case 0: return min;
+				case 1: return max - (cur_min - min) / 2;
+				default: return rms + ((cur_max - cur_min) - (max - min)) / 4;
+				}
+			}
+
+			int32_t min, max, rms;
+		};
+
+		struct bit_writer
+		{
+			bit_writer(detail::scratch_buffer& out) : out(out), acc(0), n(0) {}
+
+			void put(uint32_t v, unsigned count)
+			{
+				acc |= (uint64_t)v << n;
+				n += count;
+				while (n >= 8)
+				{
+					out.push_back((char)(acc & 0xFF));
+					acc >>= 8;
+					n -= 8;
+				}
+			}
+
+			void flush()
+			{
+				if (n)
+					out.push_back((char)(acc & 0xFF));
+				acc = 0;
+				n = 0;
+			}
+
+			detail::scratch_buffer& out;
+			uint64_t acc;
+			unsigned n;
+		};
+
+		struct bit_reader
+		{
+			bit_reader(unsigned char const* p, unsigned char const* end) : p(p), end(end), acc(0), n(0) {}
+
+			bool get(unsigned count, uint32_t& v)
+			{
+				while (n < count)
+				{
+					if (p == end)
+						return false;
+					acc |= (uint64_t)*p++ << n;
+					n += 8;
+				}
+				v = (uint32_t)(acc & ((1ull << count) - 1));
+				acc >>= count;
+				n -= count;
+				return true;
+			}
+
+			unsigned char const* p;
+			unsigned char const* end;
+			uint64_t acc;
+			unsigned n;
+		};
+
+		void to_token(uint32_t z, unsigned& token, uint32_t& extra, unsigned& extra_bits)
+		{
+			if (z < literal_count)
+			{
+				token = z;
+				extra_bits = 0;
+				extra = 0;
+				return;
+			}
+			unsigned k = bit_length(z);
+			token = literal_count + (k - 5);
+			extra_bits = k - 1;
+			extra = z & ((1u << extra_bits) - 1);
+		}
+
+		struct frequency_table
+		{
+			uint16_t freq[token_count];
+			uint16_t start[token_count];
+		};
+
+		// Scales counts to sum to the rANS scale, keeping every token that occurs codable.
+		void normalize(uint32_t const* counts, uint32_t total, frequency_table& t)
+		{
+			uint32_t sum = 0;
+			unsigned largest = 0;
+			for (unsigned s = 0; s < token_count; ++s)
+			{
+				uint32_t f = counts[s] ? (std::max)(1u, (uint32_t)((uint64_t)counts[s] * scale / total)) : 0;
+				t.freq[s] = (uint16_t)f;
+				sum += f;
+				if (t.freq[s] > t.freq[largest])
+					largest = s;
+			}
+			// The largest token has at least scale / token_count, far more than rounding is off by.
+			t.freq[largest] = (uint16_t)(t.freq[largest] + scale - sum);
+		}
+
+		bool finish_table(frequency_table& t)
+		{
+			uint32_t sum = 0;
+			for (unsigned s = 0; s < token_count; ++s)
+			{
+				t.start[s] = (uint16_t)sum;
+				sum += t.freq[s];
+			}
+			return sum == scale;
+		}
+
+		uint32_t zigzag(int32_t v, unsigned bits)
+		{
+			uint32_t const mask = (1u << bits) - 1;
+			int32_t const sign_bit = 1 << (bits - 1);
+			int32_t s = (int32_t)((uint32_t)v & mask);
+			if (s & sign_bit)
+				s -= 1 << bits;
+			return s < 0 ? (uint32_t)(-s * 2 - 1) : (uint32_t)(s * 2);
+		}
+
+		int32_t unzigzag(uint32_t z)
+		{
+			return (z & 1) ? -(int32_t)((z + 1) / 2) : (int32_t)(z / 2);
+		}
+	}
+
+	bool envelope_pack(void const* src, size_t cb, std::vector<char>& out)
+	{
+		using wave::signature::layout;
+		layout l;
+		if (!wave::signature::parse_layout(src, cb, l))
+			return false;
+
+		char const* p = (char const*)src;
+		size_t const n = l.bucket_count, sample_size = l.bits / 8;
+		size_t const symbol_count = 3 * l.channel_count * n;
+
+		// First pass: the tokens in decoding order and the extra bits beside them.
+		std::vector<uint8_t, detail::tracked_allocator<uint8_t>> tokens(symbol_count);
+		detail::scratch_buffer extra_stream;
+		uint32_t counts[field_count][token_count] = {};
+		{
+			bit_writer bits(extra_stream);
+			size_t k = 0;
+			for (unsigned c = 0; c < l.channel_count; ++c)
+			{
+				field_reader fields[field_count] = {
+					field_reader(p + l.data_offset + 0*l.field_size + c*n*sample_size, l.bits),
+					field_reader(p + l.data_offset + 1*l.field_size + c*n*sample_size, l.bits),
+					field_reader(p + l.data_offset + 2*l.field_size + c*n*sample_size, l.bits),
+				};
+				predictor prev;
+				for (size_t i = 0; i < n; ++i)
+				{
+					int32_t v[field_count] = { fields[0].get(0, i), fields[1].get(1, i), fields[2].get(2, i) };
+					for (unsigned f = 0; f < field_count; ++f)
+					{
+						uint32_t z = zigzag(v[f] - prev.predict(f, v[0], v[1]), l.bits);
+						unsigned token, extra_bits;
+						uint32_t extra;
+						to_token(z, token, extra, extra_bits);
+						tokens[k++] = (uint8_t)token;
+						++counts[f][token];
+						bits.put(extra, extra_bits);
+					}
+					prev.min = v[0];
+					prev.max = v[1];
+					prev.rms = v[2];
+				}
+			}
+			bits.flush();
+		}
+
+		frequency_table tables[field_count];
+		for (unsigned f = 0; f < field_count; ++f)
+		{
+			normalize(counts[f], (uint32_t)(symbol_count / field_count), tables[f]);
+			if (!finish_table(tables[f]))
+				return false;
+		}
+
+		// rANS encodes back to front, so the decoder reads the tokens in order.
+		std::vector<unsigned char, detail::tracked_allocator<unsigned char>> rans(symbol_count * 2 + 8);
+		unsigned char* const rans_end = rans.data() + rans.size();
+		unsigned char* q = rans_end;
+		uint32_t x = rans_low;
+		for (size_t k = symbol_count; k-- > 0;)
+		{
+			auto const& t = tables[k % field_count];
+			uint32_t const freq = t.freq[tokens[k]];
+			uint32_t const x_max = ((rans_low >> scale_bits) << 8) * freq;
+			while (x >= x_max)
+			{
+				*--q = (unsigned char)(x & 0xFF);
+				x >>= 8;
+			}
+			x = ((x / freq) << scale_bits) + (x % freq) + t.start[tokens[k]];
+		}
+		q -= 4;
+		std::memcpy(q, &x, 4);
+
+		out.clear();
+		out.insert(out.end(), magic, magic + 4);
+		write_pod(out, (uint32_t)cb);
+		out.insert(out.end(), p, p + l.data_offset);
+		for (unsigned f = 0; f < field_count; ++f)
+			for (unsigned s = 0; s < token_count; ++s)
+				write_pod(out, tables[f].freq[s]);
+		write_pod(out, (uint32_t)(rans_end - q));
+		out.insert(out.end(), (char const*)q, (char const*)rans_end);
+		out.insert(out.end(), extra_stream.begin(), extra_stream.end());
+		return true;
+	}
+
+	size_t envelope_unpacked_size(void const* src, size_t cb)
+	{
+		char const* p = (char const*)src;
+		if (cb < 8 || !std::equal(magic, magic + 4, p))
+			return 0;
+		uint32_t const blob_size = read_pod<uint32_t>(p + 4);
+		return blob_size < (1 << 24) ? blob_size : 0;
+	}
+
+	bool envelope_unpack(void const* src, size_t cb, std::vector<char>& out)
+	{
+		out.resize(envelope_unpacked_size(src, cb));
+		return !out.empty() && envelope_unpack_into(src, cb, out.data(), out.size());
+	}
+
+	bool envelope_unpack_into(void const* src, size_t cb, void* dst, size_t dst_cb)
+	{
+		char const* p = (char const*)src;
+		char const* const end = p + cb;
+		size_t const blob_size = envelope_unpacked_size(src, cb);
+		if (blob_size == 0 || blob_size != dst_cb)
+			return false;
+		p += 8;
+		if ((size_t)(end - p) < 16)
+			return false;
+		char* const out = (char*)dst;
+
+		// The verbatim header says how large the rest is.
+		unsigned const channel_count = (uint8_t)p[6];
+		size_t const header_size = 16 + channel_count * sizeof(float);
+		if ((size_t)(end - p) < header_size)
+			return false;
+		if (blob_size < header_size)
+			return false;
+		std::memcpy(out, p, header_size);
+		wave::signature::layout l;
+		if (!wave::signature::parse_layout(out, blob_size, l) || l.data_offset != header_size)
+			return false;
+		p += header_size;
+
+		frequency_table tables[field_count];
+		uint8_t lookup[field_count][scale];
+		if ((size_t)(end - p) < field_count * token_count * 2 + 4)
+			return false;
+		for (unsigned f = 0; f < field_count; ++f)
+		{
+			for (unsigned s = 0; s < token_count; ++s, p += 2)
+				tables[f].freq[s] = read_pod<uint16_t>(p);
+			if (!finish_table(tables[f]))
+				return false;
+			for (unsigned s = 0; s < token_count; ++s)
+				std::fill_n(lookup[f] + tables[f].start[s], tables[f].freq[s], (uint8_t)s);
+		}
+
+		uint32_t const rans_size = read_pod<uint32_t>(p);
+		p += 4;
+		if (rans_size < 4 || rans_size > (size_t)(end - p))
+			return false;
+		unsigned char const* r = (unsigned char const*)p;
+		unsigned char const* const rans_end = r + rans_size;
+		bit_reader bits(rans_end, (unsigned char const*)end);
+
+		uint32_t x;
+		std::memcpy(&x, r, 4);
+		r += 4;
+
+		size_t const n = l.bucket_count, sample_size = l.bits / 8;
+		uint32_t const mask = (1u << l.bits) - 1;
+		size_t k = 0;
+		for (unsigned c = 0; c < l.channel_count; ++c)
+		{
+			char* dst[field_count];
+			for (unsigned f = 0; f < field_count; ++f)
+				dst[f] = out + l.data_offset + f*l.field_size + c*n*sample_size;
+			predictor prev;
+			for (size_t i = 0; i < n; ++i)
+			{
+				int32_t v[field_count] = {};
+				for (unsigned f = 0; f < field_count; ++f, ++k)
+				{
+					auto const& t = tables[f];
+					uint32_t const slot = x & (scale - 1);
+					unsigned const token = lookup[f][slot];
+					x = t.freq[token] * (x >> scale_bits) + slot - t.start[token];
+					while (x < rans_low)
+					{
+						if (r == rans_end)
+							return false;
+						x = (x << 8) | *r++;
+					}
+
+					uint32_t z = token;
+					if (token >= literal_count)
+					{
+						unsigned const extra_bits = token - literal_count + 4;
+						uint32_t extra;
+						if (!bits.get(extra_bits, extra))
+							return false;
+						z = (1u << extra_bits) | extra;
+					}
+					uint32_t raw = (uint32_t)(prev.predict(f, v[0], v[1]) + unzigzag(z)) & mask;
+					if (l.bits == 8)
+					{
+						dst[f][i] = (char)raw;
+						v[f] = f == 2 ? (int32_t)(uint8_t)raw : (int32_t)(int8_t)raw;
+					}
+					else
+					{
+						uint16_t u = (uint16_t)raw;
+						std::memcpy(dst[f] + i*2, &u, 2);
+						v[f] = f == 2 ? (int32_t)u : (int32_t)(int16_t)u;
+					}
+				}
+				prev.min = v[0];
+				prev.max = v[1];
+				prev.rms = v[2];
+			}
+		}
+		return k == 3 * l.channel_count * n && r == rans_end;
+	}
+}
@@ -0,0 +1,35 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+namespace pack
+{
+	/* Envelope stream, a lossless packing of signature v2 blobs, little-endian:
+	 *   4 bytes magic "WSe1"
+	 *   4 bytes size of the signature blob
+	 *   signature header and peaks, verbatim
+	 *   3 x 28 u16 token frequencies, for minimum, maximum and rms, summing to 4096 each
+	 *   4 bytes rANS stream size, rANS stream
+	 *   extra bits of the large tokens, LSB first
+	 *
+	 * Each bucket is predicted from the one before it in the same channel: the
+	 * minimum as it was, the maximum mirroring half the change of the minimum and
+	 * the rms following a quarter of the change of the width. The residuals are
+	 * zigzagged into tokens, small ones literal and large ones as a bit length
+	 * with the bits beside them, and the tokens are rANS-coded with a table per
+	 * field.
+	 */
+	bool envelope_pack(void const* src, size_t cb, std::vector<char>& out);
+	bool envelope_unpack(void const* src, size_t cb, std::vector<char>& out);
+
+	// Size of the signature blob in an envelope stream, 0 if it is not one.
+	size_t envelope_unpacked_size(void const* src, size_t cb);
+
+	// Decodes into a buffer of exactly envelope_unpacked_size bytes.
+	bool envelope_unpack_into(void const* src, size_t cb, void* dst, size_t dst_cb);
+}
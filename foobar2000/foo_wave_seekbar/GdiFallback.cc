@@ -7,6 +7,7 @@
 #include "GdiFallback.h"
 #include "Helpers.h"
 #include "frontend_sdk/FrontendHelpers.h"
+#include "waveform_sdk/Lod.h"
 
 namespace wave
 {
@@ -229,9 +230,12 @@ namespace wave
 			release_objects();
 			create_objects();
 		}
-		if (s & (state_data | state_size | state_orientation | state_color | state_channel_order | state_downmix_display | state_flip_display)) {
+		if (s & (state_size | state_orientation | state_color | state_channel_order | state_downmix_display | state_flip_display)) {
 			cached_rects_valid = false;
-			update_data();
+			update_data(false);
+		}
+		else if (s & state_data) {
+			update_data(true);
 		}
 		if (s & state_position) {
 			update_positions();
@@ -266,39 +270,27 @@ namespace wave
 		brush_background.reset();
 	}
 
-	struct float4
-	{
-		float4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
-		float4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
-		float x, y, z, w;
-	};
-
-	float4* saturate(float4* in)
-	{
-		in->x = (std::max)(0.0f, (std::min)(1.0f, in->x));
-		in->y = (std::max)(0.0f, (std::min)(1.0f, in->y));
-		in->z = (std::max)(0.0f, (std::min)(1.0f, in->z));
-		in->w = (std::max)(0.0f, (std::min)(1.0f, in->w));
-		return in;
-	}
+	// One thread until BenchGdiRasterizer shows, on machines with more cores, that a full
+	// 7.1 frame at 3840x400 renders faster on several. It takes about 6 ms on one.
+	static size_t const render_threads = 1;
 
-	float4* lerp(float4* out, float4 const* a, float4 const* b, float f)
+	static void set_color(float (&out)[4], color c)
 	{
-		float const omf = 1.0f - f;
-		out->x = omf * a->x + f * b->x;
-		out->y = omf * a->y + f * b->y;
-		out->z = omf * a->z + f * b->z;
-		out->w = omf * a->w + f * b->w;
-		return out;
+		out[0] = c.r; out[1] = c.g; out[2] = c.b; out[3] = c.a;
 	}
 
-	void gdi_fallback_frontend::update_data()
+	void gdi_fallback_frontend::update_data(bool only_data)
 	{
 		auto bitmap_size = callback.get_size();
-		{
+		bool const keep_bitmaps = only_data && unshaded_image &&
+			unshaded_image->width == (unsigned)bitmap_size.cx && unshaded_image->height == (unsigned)bitmap_size.cy;
+		if (!keep_bitmaps) {
 			CClientDC win_dc(wnd);
 			wave_dc.reset(new mem_dc(win_dc, bitmap_size));
 			shaded_wave_dc.reset(new mem_dc(win_dc, bitmap_size));
+			unshaded_image.reset();
+			shaded_image.reset();
+			rendered_columns.clear();
 		}
 
 		bool vertical = callback.get_orientation() == config::orientation_vertical;
@@ -310,121 +302,126 @@ namespace wave
 			CRect all(0, 0, bitmap_size.cx, bitmap_size.cy);
 			wave_dc->FillSolidRect(all, color_to_xbgr(bg));
 			shaded_wave_dc->FillSolidRect(all, color_to_xbgr(bg));
+			unshaded_image.reset();
+			shaded_image.reset();
+			rendered_columns.clear();
+			wnd.Invalidate(FALSE);
+			return;
 		}
-		else {
-			if (callback.get_downmix_display() != config::downmix_none) {
-				switch (callback.get_downmix_display())
-				{
-				case config::downmix_mono:   if (w->get_channel_count() > 1) w = downmix_waveform(w, 1); break;
-				case config::downmix_stereo: if (w->get_channel_count() > 2) w = downmix_waveform(w, 2); break;
-				}
+
+		if (callback.get_downmix_display() != config::downmix_none) {
+			switch (callback.get_downmix_display())
+			{
+			case config::downmix_mono:   if (w->get_channel_count() > 1) w = downmix_waveform(w, 1); break;
+			case config::downmix_stereo: if (w->get_channel_count() > 2) w = downmix_waveform(w, 2); break;
 			}
+		}
 
-			pfc::list_t<channel_info> infos;
-			callback.get_channel_infos(list_array_sink<channel_info>(infos));
+		pfc::list_t<channel_info> infos;
+		callback.get_channel_infos(list_array_sink<channel_info>(infos));
 
-			auto channel_numbers = expand_flags(w->get_channel_map());
-			pfc::list_t<int> channel_indices;
-			infos.enumerate([&channel_indices, channel_numbers](channel_info const& info)
+		auto channel_numbers = expand_flags(w->get_channel_map());
+		pfc::list_t<int> channel_indices;
+		infos.enumerate([&channel_indices, channel_numbers](channel_info const& info)
+		{
+			if (info.enabled)
 			{
-				if (info.enabled)
+				auto I = std::find(channel_numbers.begin(), channel_numbers.end(), info.channel);
+				decltype(I) first = channel_numbers.begin();
+				if (I != channel_numbers.end())
 				{
-					auto I = std::find(channel_numbers.begin(), channel_numbers.end(), info.channel);
-					decltype(I) first = channel_numbers.begin();
-					if (I != channel_numbers.end())
-					{
-						channel_indices.add_item(std::distance(first, I));
-					}
+					channel_indices.add_item(std::distance(first, I));
 				}
-			});
+			}
+		});
+
+		raster::shade_colors colors;
+		set_color(colors.background, callback.get_color(config::color_background));
+		set_color(colors.foreground, callback.get_color(config::color_foreground));
+		set_color(colors.highlight, callback.get_color(config::color_highlight));
+
+		// One column per pixel along the major axis, so narrow bars keep every peak.
+		std::vector<envelope_columns> columns(channel_indices.get_count());
+		std::vector<raster::lane> lanes;
+		int quad_index = 0;
+		auto index_count = channel_indices.get_count();
+		channel_indices.enumerate([&, index_count](int index)
+		{
+			size_t channel_width = bitmap_size.cx, channel_x_offset = 0;
+			size_t channel_height = bitmap_size.cy, channel_y_offset = 0;
+			if (vertical) {
+				channel_x_offset = channel_width * quad_index / index_count;
+				channel_width = channel_width * (quad_index+1) / index_count - channel_x_offset;
+			}
+			else {
+				channel_y_offset = channel_height * quad_index / index_count;
+				channel_height = channel_height * (quad_index+1) / index_count - channel_y_offset;
+			}
+			auto& env = columns[quad_index];
+			get_columns(w, index, vertical ? channel_height : channel_width, env);
+
+			raster::lane lane = {
+				(unsigned)channel_x_offset, (unsigned)channel_y_offset, (unsigned)channel_width, (unsigned)channel_height,
+				vertical, flip, env.minimum.data(), env.maximum.data(), env.minimum.size() };
+			lanes.push_back(lane);
+			++quad_index;
+		});
+
+		// While a track is scanned each update is a new waveform with more buckets filled in, so
+		// only the columns that differ from the drawn ones are rendered again. The lanes of a
+		// bitmap all run its full length, so their columns line up.
+		CRect dirty(0, 0, bitmap_size.cx, bitmap_size.cy);
+		bool const same_shape = unshaded_image && !lanes.empty() && rendered_columns.size() == columns.size() &&
+			rendered_columns.front().minimum.size() == columns.front().minimum.size();
+		if (same_shape) {
+			std::vector<raster::lane> drawn = lanes;
+			for (size_t i = 0; i < drawn.size(); ++i) {
+				drawn[i].minimum = rendered_columns[i].minimum.data();
+				drawn[i].maximum = rendered_columns[i].maximum.data();
+			}
+			size_t first, last;
+			raster::find_dirty_buckets(drawn, lanes, first, last);
+			rendered_columns.swap(columns);
+
+			std::vector<raster::tile> tiles;
+			for (auto I = lanes.begin(); I != lanes.end(); ++I)
+				tiles.push_back(raster::bucket_tile(*I, first, last));
+			auto const& t = tiles.front();
+			if (t.first == t.last)
+				return;
+			if (vertical) {
+				dirty.top = t.first;
+				dirty.bottom = t.last;
+			}
+			else {
+				dirty.left = t.first;
+				dirty.right = t.last;
+			}
+			raster::render_tiles(*unshaded_image, *shaded_image, tiles, colors, render_threads);
+		}
+		else {
+			unshaded_image.reset(new raster::image(bitmap_size.cx, bitmap_size.cy));
+			shaded_image.reset(new raster::image(bitmap_size.cx, bitmap_size.cy));
+			raster::render_lanes(*unshaded_image, *shaded_image, lanes, colors, render_threads);
+			rendered_columns.swap(columns);
+		}
 
-			int quad_index = 0;
-			auto index_count = channel_indices.get_count();
-			channel_indices.enumerate([&, index_count](int index)
-			{
-				size_t channel_width = bitmap_size.cx, channel_x_offset = 0;
-				size_t channel_height = bitmap_size.cy, channel_y_offset = 0;
-				if (vertical) {
-					channel_x_offset = channel_width * quad_index / index_count;
-					channel_width = channel_width * (quad_index+1) / index_count - channel_x_offset;
-				}
-				else {
-					channel_y_offset = channel_height * quad_index / index_count;
-					channel_height = channel_height * (quad_index+1) / index_count - channel_y_offset;
-				}
-				pfc::list_t<float> avg_min, avg_max, avg_rms;
-				w->get_field("minimum", index, list_array_sink<float>(avg_min));
-				w->get_field("maximum", index, list_array_sink<float>(avg_max));
-				w->get_field("rms", index, list_array_sink<float>(avg_rms));
-
-				color bg = callback.get_color(config::color_background);
-				color txt = callback.get_color(config::color_foreground);
-				color hi = callback.get_color(config::color_highlight);
-				float4 backgroundColor(bg.r, bg.g, bg.b, bg.a);
-				float4 textColor(txt.r, txt.g, txt.b, txt.a);
-				float4 hilightColor(hi.r, hi.g, hi.b, hi.a);
-
-				size_t major_extent = (size_t)(vertical ? bitmap_size.cy : bitmap_size.cx);
-				std::vector<float4> samples(major_extent);
-				for (size_t x = 0; x < major_extent; ++x) {
-					size_t ix = (x * 2048ul / major_extent);
-					samples[x] = float4(avg_min[ix], avg_max[ix], avg_rms[ix], 1);
-				}
-				BITMAPINFO bmi = {};
-				{
-					auto& h = bmi.bmiHeader;
-					h.biSize = sizeof(h);
-					h.biWidth = channel_width;
-					h.biHeight = 1;
-					h.biPlanes = 1;
-					h.biBitCount = 32;
-					h.biCompression = BI_RGB;
-				}
-				std::vector<DWORD> unshaded_row(channel_width);
-				std::vector<DWORD> shaded_row(channel_width);
-				for (size_t target_y = 0; target_y < channel_height; ++target_y) {
-					for (size_t target_x = 0; target_x < channel_width; ++target_x) {
-						size_t tc_x;
-						float tc_y;
-						if (vertical) {
-							tc_x = flip ? (channel_height - target_y - 1) : target_y;
-							tc_y = 1.0f - 2.0f * target_x / (float)(channel_width-1);
-						}
-						else {
-							tc_x = flip ? (channel_width - target_x - 1) : target_x;
-							tc_y = 1.0f - 2.0f * target_y / (float)(channel_height-1);
-						}
-						float4 c;
-						auto sample = samples[tc_x];
-						float below = tc_y - sample.x;
-						float above = tc_y - sample.y;
-						float factor = (std::min)(fabs(below), fabs(above));
-						bool outside = (below < 0 || above > 0);
-						bool inside_rms = fabs(tc_y) <= sample.z;
-
-						if (outside)
-							c = backgroundColor;
-						else
-							lerp(&c, &backgroundColor, &textColor, 7.0f * factor);
-						
-						saturate(&c);
-						float4 shaded;
-						lerp(&shaded, &hilightColor, &c, 0.75f);
-						color cc(c.x, c.y, c.z, c.w);
-						color ac(shaded.x, shaded.y, shaded.z, 1.0f);
-
-						unshaded_row[target_x] = color_to_xrgb(cc);
-						shaded_row[target_x] = color_to_xrgb(ac);
-					}
-					wave_dc->SetDIBitsToDevice(channel_x_offset, target_y + channel_y_offset, unshaded_row.size(), 1, 0, 0, 0, 1,
-						unshaded_row.data(), &bmi, DIB_RGB_COLORS);
-					shaded_wave_dc->SetDIBitsToDevice(channel_x_offset, target_y + channel_y_offset, shaded_row.size(), 1, 0, 0, 0, 1,
-						shaded_row.data(), &bmi, DIB_RGB_COLORS);
-				}
-				++quad_index;
-			});
+		// One blit per bitmap. A negative height makes the DIB top-down like the image.
+		BITMAPINFO bmi = {};
+		{
+			auto& h = bmi.bmiHeader;
+			h.biSize = sizeof(h);
+			h.biWidth = bitmap_size.cx;
+			h.biHeight = -bitmap_size.cy;
+			h.biPlanes = 1;
+			h.biBitCount = 32;
+			h.biCompression = BI_RGB;
 		}
-		wnd.Invalidate(FALSE);
+		wave_dc->SetDIBitsToDevice(dirty.left, dirty.top, dirty.Width(), dirty.Height(), dirty.left, dirty.top, 0, bitmap_size.cy,
+			unshaded_image->pixels.data(), &bmi, DIB_RGB_COLORS);
+		shaded_wave_dc->SetDIBitsToDevice(dirty.left, dirty.top, dirty.Width(), dirty.Height(), dirty.left, dirty.top, 0, bitmap_size.cy,
+			shaded_image->pixels.data(), &bmi, DIB_RGB_COLORS);
+		wnd.InvalidateRect(dirty, FALSE);
 	}
 
 	void gdi_fallback_frontend::update_positions()
@@ -5,6 +5,8 @@
 
 #pragma once
 #include "frontend_sdk/VisualFrontend.h"
+#include "GdiRasterizer.h"
+#include "waveform_sdk/Lod.h"
 #include "waveform_sdk/Optional.h"
 
 namespace wave
@@ -45,7 +47,7 @@ namespace wave
 	private:
 		void create_objects();
 		void release_objects();
-		void update_data();
+		void update_data(bool only_data);
 		void update_positions();
 
 		CPoint orientate(CPoint);
@@ -56,6 +58,8 @@ namespace wave
 		wave::optional<CRect> last_seek_rect;
 
 		std::unique_ptr<mem_dc> wave_dc, shaded_wave_dc;
+		std::unique_ptr<raster::image> unshaded_image, shaded_image;
+		std::vector<envelope_columns> rendered_columns; // those in the bitmaps, to find what an update changes
 		std::unique_ptr<CPen> pen_foreground, pen_highlight, pen_selection;
 		std::unique_ptr<CBrush> brush_background;
 
@@ -0,0 +1,214 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "GdiRasterizer.h"
+#include "util/Parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace wave
+{
+	namespace raster
+	{
+		// Both paths do the arithmetic of the old per-pixel shading in the same order, so the
+		// vector and the scalar pixels agree to the bit. std::min and std::max pick their first
+		// argument on NaN, which is what the operand order of minps and maxps gives too.
+		uint32_t shade_one(float y, float lo, float hi, shade_colors const& colors, uint32_t& shaded)
+		{
+			float const below = y - lo;
+			float const above = y - hi;
+			float const factor = (std::min)(std::fabs(below), std::fabs(above));
+			bool const outside = below < 0 || above > 0;
+			float const f = 7.0f * factor, omf = 1.0f - f;
+
+			float c[4], s[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				float v = outside ? colors.background[k] : omf * colors.background[k] + f * colors.foreground[k];
+				c[k] = (std::max)(0.0f, (std::min)(1.0f, v));
+				s[k] = 0.25f * colors.highlight[k] + 0.75f * c[k];
+			}
+			shaded = (uint32_t)(uint8_t)(s[2] * 255) | (uint32_t)(uint8_t)(s[1] * 255) << 8 | (uint32_t)(uint8_t)(s[0] * 255) << 16;
+			return (uint32_t)(uint8_t)(c[3] * c[2] * 255) | (uint32_t)(uint8_t)(c[3] * c[1] * 255) << 8 | (uint32_t)(uint8_t)(c[3] * c[0] * 255) << 16;
+		}
+
+		struct shader4
+		{
+			explicit shader4(shade_colors const& colors)
+			{
+				for (int k = 0; k < 4; ++k)
+				{
+					background[k] = _mm_set1_ps(colors.background[k]);
+					foreground[k] = _mm_set1_ps(colors.foreground[k]);
+					highlight[k] = _mm_mul_ps(_mm_set1_ps(0.25f), _mm_set1_ps(colors.highlight[k]));
+				}
+			}
+
+			static __m128i pack(__m128 r, __m128 g, __m128 b)
+			{
+				__m128 const scale = _mm_set1_ps(255.0f);
+				__m128i out = _mm_cvttps_epi32(_mm_mul_ps(b, scale));
+				out = _mm_or_si128(out, _mm_slli_epi32(_mm_cvttps_epi32(_mm_mul_ps(g, scale)), 8));
+				return _mm_or_si128(out, _mm_slli_epi32(_mm_cvttps_epi32(_mm_mul_ps(r, scale)), 16));
+			}
+
+			void operator () (__m128 y, __m128 lo, __m128 hi, uint32_t* unshaded_out, uint32_t* shaded_out) const
+			{
+				__m128 const zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+				__m128 const sign = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+				__m128 const below = _mm_sub_ps(y, lo);
+				__m128 const above = _mm_sub_ps(y, hi);
+				__m128 const factor = _mm_min_ps(_mm_and_ps(above, sign), _mm_and_ps(below, sign));
+				__m128 const outside = _mm_or_ps(_mm_cmplt_ps(below, zero), _mm_cmpgt_ps(above, zero));
+				__m128 const f = _mm_mul_ps(_mm_set1_ps(7.0f), factor);
+				__m128 const omf = _mm_sub_ps(one, f);
+
+				__m128 c[4], s[4];
+				for (int k = 0; k < 4; ++k)
+				{
+					__m128 v = _mm_add_ps(_mm_mul_ps(omf, background[k]), _mm_mul_ps(f, foreground[k]));
+					v = _mm_or_ps(_mm_and_ps(outside, background[k]), _mm_andnot_ps(outside, v));
+					c[k] = _mm_max_ps(_mm_min_ps(v, one), zero);
+					s[k] = _mm_add_ps(highlight[k], _mm_mul_ps(_mm_set1_ps(0.75f), c[k]));
+				}
+				_mm_storeu_si128((__m128i*)shaded_out, pack(s[0], s[1], s[2]));
+				_mm_storeu_si128((__m128i*)unshaded_out, pack(_mm_mul_ps(c[3], c[0]), _mm_mul_ps(c[3], c[1]), _mm_mul_ps(c[3], c[2])));
+			}
+
+			__m128 background[4], foreground[4], highlight[4]; // highlight premultiplied by its weight
+		};
+
+		void render_tile(image& unshaded, image& shaded, tile const& t, shade_colors const& colors)
+		{
+			lane const& l = *t.l;
+			unsigned const major = l.vertical ? l.height : l.width;
+			unsigned const minor = l.vertical ? l.width : l.height;
+			if (t.first >= t.last || !minor || !l.bucket_count)
+				return;
+
+			// The envelope per pixel of the tile along the major axis and the height per pixel across it.
+			unsigned const extent = t.last - t.first;
+			std::vector<float> lo(extent), hi(extent), ys(minor);
+			for (unsigned i = 0; i < extent; ++i)
+			{
+				size_t const src = l.flip ? major - (t.first + i) - 1 : t.first + i;
+				size_t const ix = src * l.bucket_count / major;
+				lo[i] = l.minimum[ix];
+				hi[i] = l.maximum[ix];
+			}
+			for (size_t j = 0; j < minor; ++j)
+				ys[j] = 1.0f - 2.0f * j / (float)(minor - 1);
+
+			shader4 const shade(colors);
+			if (l.vertical)
+			{
+				unsigned const vector_width = l.width & ~3u;
+				for (unsigned i = 0; i < extent; ++i)
+				{
+					uint32_t* out = unshaded.row(l.y + t.first + i) + l.x;
+					uint32_t* out_shaded = shaded.row(l.y + t.first + i) + l.x;
+					__m128 const row_lo = _mm_set1_ps(lo[i]), row_hi = _mm_set1_ps(hi[i]);
+					unsigned x = 0;
+					for (; x < vector_width; x += 4)
+						shade(_mm_loadu_ps(&ys[x]), row_lo, row_hi, out + x, out_shaded + x);
+					for (; x < l.width; ++x)
+						out[x] = shade_one(ys[x], lo[i], hi[i], colors, out_shaded[x]);
+				}
+			}
+			else
+			{
+				unsigned const vector_extent = extent & ~3u;
+				for (unsigned row = 0; row < l.height; ++row)
+				{
+					uint32_t* out = unshaded.row(l.y + row) + l.x + t.first;
+					uint32_t* out_shaded = shaded.row(l.y + row) + l.x + t.first;
+					__m128 const row_y = _mm_set1_ps(ys[row]);
+					unsigned i = 0;
+					for (; i < vector_extent; i += 4)
+						shade(row_y, _mm_loadu_ps(&lo[i]), _mm_loadu_ps(&hi[i]), out + i, out_shaded + i);
+					for (; i < extent; ++i)
+						out[i] = shade_one(ys[row], lo[i], hi[i], colors, out_shaded[i]);
+				}
+			}
+		}
+
+		void render_lane(image& unshaded, image& shaded, lane const& l, shade_colors const& colors)
+		{
+			tile const whole = { &l, 0, l.vertical ? l.height : l.width };
+			render_tile(unshaded, shaded, whole, colors);
+		}
+
+		std::vector<tile> make_tiles(std::vector<lane> const& lanes, unsigned tile_extent)
+		{
+			std::vector<tile> out;
+			for (auto I = lanes.begin(); I != lanes.end(); ++I)
+			{
+				unsigned const major = I->vertical ? I->height : I->width;
+				for (unsigned first = 0; first < major; first += tile_extent)
+				{
+					tile t = { &*I, first, (std::min)(major, first + tile_extent) };
+					out.push_back(t);
+				}
+			}
+			return out;
+		}
+
+		void find_dirty_buckets(std::vector<lane> const& drawn, std::vector<lane> const& lanes, size_t& first, size_t& last)
+		{
+			first = (size_t)-1;
+			last = 0;
+			for (size_t i = 0; i < lanes.size(); ++i)
+			{
+				float const* const drawn_fields[] = { drawn[i].minimum, drawn[i].maximum };
+				float const* const fields[] = { lanes[i].minimum, lanes[i].maximum };
+				for (int f = 0; f < 2; ++f)
+				{
+					float const* x = drawn_fields[f];
+					float const* y = fields[f];
+					size_t lo = 0, hi = lanes[i].bucket_count;
+					while (lo < hi && x[lo] == y[lo]) ++lo;
+					while (hi > lo && x[hi-1] == y[hi-1]) --hi;
+					if (lo < hi)
+					{
+						first = (std::min)(first, lo);
+						last = (std::max)(last, hi);
+					}
+				}
+			}
+			if (first >= last)
+				first = last = 0;
+		}
+
+		tile bucket_tile(lane const& l, size_t first_bucket, size_t last_bucket)
+		{
+			// Pixel p shows bucket p * bucket_count / major, counted from the far end when flipped.
+			size_t const major = l.vertical ? l.height : l.width;
+			size_t const n = l.bucket_count;
+			tile t = { &l, 0, 0 };
+			if (!n || first_bucket >= last_bucket)
+				return t;
+			unsigned const first = (unsigned)(std::min)(major, (first_bucket * major + n - 1) / n);
+			unsigned const last = (unsigned)(std::min)(major, (last_bucket * major + n - 1) / n);
+			t.first = l.flip ? (unsigned)major - last : first;
+			t.last = l.flip ? (unsigned)major - first : last;
+			return t;
+		}
+
+		void render_tiles(image& unshaded, image& shaded, std::vector<tile> const& tiles, shade_colors const& colors, size_t thread_count)
+		{
+			util::parallel_for(0, tiles.size(), thread_count, [&](size_t i)
+			{
+				render_tile(unshaded, shaded, tiles[i], colors);
+			});
+		}
+
+		void render_lanes(image& unshaded, image& shaded, std::vector<lane> const& lanes, shade_colors const& colors, size_t thread_count)
+		{
+			// 256 pixels keep the tiles of a horizontal lane on whole cache lines of a row.
+			render_tiles(unshaded, shaded, make_tiles(lanes, 256), colors, thread_count);
+		}
+	}
+}
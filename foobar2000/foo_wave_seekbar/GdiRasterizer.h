@@ -0,0 +1,77 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace wave
+{
+	namespace raster
+	{
+		// 32-bit 0x00RRGGBB pixels, rows from the top down, as a top-down BI_RGB DIB wants them.
+		struct image
+		{
+			image(unsigned width, unsigned height)
+				: width(width), height(height), pixels((size_t)width * height)
+			{}
+
+			uint32_t* row(unsigned y) { return pixels.data() + (size_t)y * width; }
+
+			unsigned width, height;
+			std::vector<uint32_t> pixels;
+		};
+
+		// Straight alpha in [0, 1], r, g, b, a.
+		struct shade_colors
+		{
+			float background[4], foreground[4], highlight[4];
+		};
+
+		// One channel, filling a rectangle of the image. Buckets are picked per pixel
+		// along the major axis, which runs down the lane if it is vertical.
+		struct lane
+		{
+			unsigned x, y, width, height;
+			bool vertical, flip;
+			float const* minimum;
+			float const* maximum;
+			size_t bucket_count;
+		};
+
+		// The pixels [first, last) along the major axis of a lane. The tiles of an image
+		// cover pixels of their own, so they are rendered straight into it from any thread.
+		struct tile
+		{
+			lane const* l;
+			unsigned first, last;
+		};
+
+		// One pixel at height y in [-1, 1] of a bucket spanning [lo, hi]. Returns the unshaded
+		// pixel and stores the shaded one; render_tile gives the same pixels four at a time.
+		uint32_t shade_one(float y, float lo, float hi, shade_colors const& colors, uint32_t& shaded);
+
+		// Renders the lane into both images, the shaded one blended towards the highlight
+		// colour for the played part. Four pixels at a time with SSE2, the same pixels as
+		// the per-pixel shading the GDI frontend had.
+		void render_lane(image& unshaded, image& shaded, lane const& l, shade_colors const& colors);
+		void render_tile(image& unshaded, image& shaded, tile const& t, shade_colors const& colors);
+
+		// Cuts every lane into tiles of tile_extent pixels along its major axis.
+		std::vector<tile> make_tiles(std::vector<lane> const& lanes, unsigned tile_extent);
+
+		// The buckets [first, last) where the envelopes of lanes differ from those of drawn, lane by
+		// lane, first == last if none do. Both sets have the same number of lanes and of buckets.
+		void find_dirty_buckets(std::vector<lane> const& drawn, std::vector<lane> const& lanes, size_t& first, size_t& last);
+
+		// The pixels of a lane that show the buckets [first_bucket, last_bucket), empty if none do.
+		tile bucket_tile(lane const& l, size_t first_bucket, size_t last_bucket);
+
+		// Renders the tiles on up to thread_count threads, the calling one included.
+		void render_tiles(image& unshaded, image& shaded, std::vector<tile> const& tiles, shade_colors const& colors, size_t thread_count);
+		void render_lanes(image& unshaded, image& shaded, std::vector<lane> const& lanes, shade_colors const& colors, size_t thread_count);
+	}
+}
@@ -13,7 +13,7 @@ static GUID const guid_cache_group =
 
 struct cache_commands : mainmenu_commands
 {
-	virtual t_uint32 get_command_count() { return 3; }
+	virtual t_uint32 get_command_count() { return 7; }
 	virtual GUID get_command(t_uint32 index)
 	{
 		// {C001F96F-62D2-4248-A50A-E26846D7CCEC}
@@ -28,7 +28,23 @@ struct cache_commands : mainmenu_commands
 		static const GUID rescan_guid = 
 		{ 0x89b0f429, 0xc749, 0x4027, { 0xbe, 0xed, 0xd9, 0xbe, 0x7, 0xfc, 0x67, 0xc5 } };
 
-		GUID const* guids[] = { &purge_guid, &compact_guid, &rescan_guid };
+		// {7D2E94B1-3C5A-4F08-B6D7-1A9E0C4F2B63}
+		static const GUID rescan_changed_guid = 
+		{ 0x7d2e94b1, 0x3c5a, 0x4f08, { 0xb6, 0xd7, 0x1a, 0x9e, 0xc, 0x4f, 0x2b, 0x63 } };
+
+		// {9A41C7E2-5B08-4D3F-86E1-C27F4B9D0A35}
+		static const GUID export_guid = 
+		{ 0x9a41c7e2, 0x5b08, 0x4d3f, { 0x86, 0xe1, 0xc2, 0x7f, 0x4b, 0x9d, 0xa, 0x35 } };
+
+		// {F2D86B19-0E7C-4A52-B3F4-6D18A5C9E207}
+		static const GUID import_guid = 
+		{ 0xf2d86b19, 0xe7c, 0x4a52, { 0xb3, 0xf4, 0x6d, 0x18, 0xa5, 0xc9, 0xe2, 0x7 } };
+
+		// {6B1E3D94-C8F2-4A07-9D5B-E3A4716C0F28}
+		static const GUID statistics_guid = 
+		{ 0x6b1e3d94, 0xc8f2, 0x4a07, { 0x9d, 0x5b, 0xe3, 0xa4, 0x71, 0x6c, 0xf, 0x28 } };
+
+		GUID const* guids[] = { &purge_guid, &compact_guid, &rescan_guid, &rescan_changed_guid, &export_guid, &import_guid, &statistics_guid };
 		return *guids[index];
 	}
 	virtual void get_name(t_uint32 index, pfc::string_base& out)
@@ -38,6 +54,10 @@ struct cache_commands : mainmenu_commands
 			case 0: out = "Remove Dead Waveforms"; break;
 			case 1: out = "Compact Waveform Database"; break;
 			case 2: out = "Rescan All Waveforms"; break;
+			case 3: out = "Rescan Changed Waveforms"; break;
+			case 4: out = "Export Waveforms..."; break;
+			case 5: out = "Import Waveforms..."; break;
+			case 6: out = "Show Waveform Cache Statistics"; break;
 		}
 	}
 	virtual bool get_description(t_uint32 index, pfc::string_base& out)
@@ -47,6 +67,10 @@ struct cache_commands : mainmenu_commands
 			case 0: out = "Removes dead waveforms from the Waveform Cache database."; break;
 			case 1: out = "Compacts the waveform database, may take a while."; break;
 			case 2: out = "Enqueue all waveforms in the database for signature extraction."; break;
+			case 3: out = "Enqueue waveforms of tracks whose size or modification time changed since they were scanned."; break;
+			case 4: out = "Writes all waveforms to a portable archive for use on other machines."; break;
+			case 5: out = "Adds the waveforms of an archive that are not already stored, replacing path prefixes as configured in Advanced Preferences."; break;
+			case 6: out = "Reports cache size, compression, hit rates, scan throughput, failures and queue depths to the console and to wavecache-stats.json in the profile directory."; break;
 		}
 		return true;
 	}
@@ -71,6 +95,30 @@ struct cache_commands : mainmenu_commands
 				c->rescan_waveforms();
 				break;
 			}
+			case 3:
+			{
+				c->rescan_changed_waveforms();
+				break;
+			}
+			case 4:
+			{
+				pfc::string8 path;
+				if (uGetOpenFileName(core_api::get_main_window(), "Waveform archives (*.wsa)|*.wsa", 0, "wsa", "Export Waveforms", nullptr, path, TRUE))
+					c->export_waveforms(path);
+				break;
+			}
+			case 5:
+			{
+				pfc::string8 path;
+				if (uGetOpenFileName(core_api::get_main_window(), "Waveform archives (*.wsa)|*.wsa", 0, "wsa", "Import Waveforms", nullptr, path, FALSE))
+					c->import_waveforms(path);
+				break;
+			}
+			case 6:
+			{
+				c->report_statistics();
+				break;
+			}
 		}
 	}
 };
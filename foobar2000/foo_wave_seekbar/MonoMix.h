@@ -0,0 +1,33 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <algorithm>
+#include <stddef.h>
+
+namespace wave
+{
+	// Mixes frames of interleaved samples down to one channel with a weight per input
+	// channel and folds the mix into the running minimum, maximum and sum of squares of
+	// a bucket, so that a mono waveform is reduced from the mix rather than mixed from
+	// the reductions of its channels.
+	template <typename T>
+	void accumulate_mixed(T const* data, size_t frames, T const* weights, unsigned channel_count, T& minimum, T& maximum, T& sum_of_squares)
+	{
+		T min = minimum, max = maximum, sum = sum_of_squares;
+		for (size_t i = 0; i < frames; ++i, data += channel_count)
+		{
+			T sample = 0;
+			for (unsigned c = 0; c < channel_count; ++c)
+				sample += weights[c] * data[c];
+			min = (std::min)(min, sample);
+			max = (std::max)(max, sample);
+			sum += sample * sample;
+		}
+		minimum = min;
+		maximum = max;
+		sum_of_squares = sum;
+	}
+}
@@ -6,4 +6,78 @@
 #pragma once
 #include "PchSeekbar.h"
 
-#include "Pack.h"
\ No newline at end of file
+#include "Pack.h"
+
+namespace pack
+{
+	namespace detail
+	{
+		alloc_counters counters;
+
+		pool<encoder> encoders;
+		pool<decoder> decoders;
+		pool<deflater> deflaters;
+		pool<inflater> inflaters;
+
+		std::atomic<bool> use_pools(true);
+
+		// A coder holds a handful of blocks at most, any more go back to the system.
+		static size_t const max_spare_blocks = 8;
+
+		struct arena::block
+		{
+			size_t size;
+			size_t reserved; // keeps the payload 16-byte aligned on x64
+		};
+
+		arena::arena()
+		{
+			Alloc = &alloc_func;
+			Free = &free_func;
+		}
+
+		arena::~arena()
+		{
+			for (auto I = spare.begin(); I != spare.end(); ++I)
+			{
+				note_free((*I)->size);
+				free(*I);
+			}
+		}
+
+		void* arena::get(size_t cb)
+		{
+			for (auto I = spare.begin(); I != spare.end(); ++I)
+			{
+				if ((*I)->size == cb)
+				{
+					block* b = *I;
+					spare.erase(I);
+					++counters.reuses;
+					return b + 1;
+				}
+			}
+			block* b = (block*)malloc(sizeof(block) + cb);
+			if (!b)
+				return nullptr;
+			b->size = cb;
+			++counters.allocations;
+			note_alloc(cb);
+			return b + 1;
+		}
+
+		void arena::put(void* addr)
+		{
+			if (!addr)
+				return;
+			block* b = (block*)addr - 1;
+			if (spare.size() < max_spare_blocks)
+				spare.push_back(b);
+			else
+			{
+				note_free(b->size);
+				free(b);
+			}
+		}
+	}
+}
@@ -5,51 +5,383 @@
 
 #pragma once
 #include "zlib/zlib.h"
+#include "lzma/Lzma2Enc.h"
+#include "lzma/Lzma2Dec.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
 
 namespace pack
 {
+	namespace detail
+	{
+		// Allocations that went to the system and the bytes held by coders and codec
+		// scratch buffers, for the codec benchmark.
+		struct alloc_counters
+		{
+			std::atomic<size_t> allocations, reuses;
+			std::atomic<size_t> bytes, peak_bytes;
+		};
+
+		extern alloc_counters counters;
+
+		inline void note_alloc(size_t cb)
+		{
+			size_t const now = counters.bytes += cb;
+			size_t peak = counters.peak_bytes;
+			while (now > peak && !counters.peak_bytes.compare_exchange_weak(peak, now))
+				;
+		}
+
+		inline void note_free(size_t cb)
+		{
+			counters.bytes -= cb;
+		}
+
+		// For the scratch buffers of the codecs, counted like the arenas.
+		template <typename T>
+		struct tracked_allocator
+		{
+			typedef T value_type;
+			typedef T* pointer;
+			typedef T const* const_pointer;
+			typedef T& reference;
+			typedef T const& const_reference;
+			typedef size_t size_type;
+			typedef ptrdiff_t difference_type;
+
+			template <typename U>
+			struct rebind { typedef tracked_allocator<U> other; };
+
+			tracked_allocator() {}
+			template <typename U>
+			tracked_allocator(tracked_allocator<U> const&) {}
+
+			T* allocate(size_t n)
+			{
+				T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+				note_alloc(n * sizeof(T));
+				return p;
+			}
+
+			void deallocate(T* p, size_t n)
+			{
+				note_free(n * sizeof(T));
+				::operator delete(p);
+			}
+
+			size_t max_size() const { return (size_t)-1 / sizeof(T); }
+			void construct(T* p, T const& t) { new ((void*)p) T(t); }
+			void destroy(T* p) { p->~T(); }
+
+			template <typename U>
+			bool operator == (tracked_allocator<U> const&) const { return true; }
+			template <typename U>
+			bool operator != (tracked_allocator<U> const&) const { return false; }
+		};
+
+		typedef std::vector<char, tracked_allocator<char>> scratch_buffer;
+
+		// Coders ask for the same few block sizes every time they are set up, so freed
+		// blocks are kept for the next request of the same size. Each coder owns one.
+		struct arena : ISzAlloc
+		{
+			arena();
+			~arena();
+
+			void* get(size_t cb);
+			void put(void* addr);
+
+		private:
+			struct block;
+			std::vector<block*> spare;
+
+			arena(arena const&);
+			arena& operator = (arena const&);
+		};
+
+		inline void* alloc_func(void* p, size_t cb)
+		{
+			return static_cast<arena*>((ISzAlloc*)p)->get(cb);
+		}
+
+		inline void free_func(void* p, void* addr)
+		{
+			static_cast<arena*>((ISzAlloc*)p)->put(addr);
+		}
+
+		inline voidpf z_alloc_func(voidpf p, uInt items, uInt size)
+		{
+			return ((arena*)p)->get((size_t)items * size);
+		}
+
+		inline void z_free_func(voidpf p, voidpf addr)
+		{
+			((arena*)p)->put(addr);
+		}
+
+		// Coders are set up once and reset between uses, see lease below.
+		struct encoder
+		{
+			encoder()
+			{
+				p = Lzma2Enc_Create(&mem, &mem);
+				Lzma2EncProps_Init(&props2);
+				auto& props = props2.lzmaProps;
+				props.level = 1;
+				props.fb = 128;
+				props.algo = 1;
+				props.numThreads = 1;
+				props.writeEndMark = 1;
+				Lzma2Enc_SetProps(p, &props2);
+			}
+
+			~encoder()
+			{
+				Lzma2Enc_Destroy(p);
+			}
+
+			// Lzma2Enc_Encode prepares the match finder anew on every call, reusing its buffers.
+			void reset() {}
+
+			arena mem;
+			CLzma2EncHandle p;
+			CLzma2EncProps props2;
+
+		private:
+			encoder(encoder const&);
+			encoder& operator = (encoder const&);
+		};
+
+		struct decoder
+		{
+			decoder()
+			{
+				CLzma2Dec _ = {}; dec = _;
+				Lzma2Dec_Construct(&dec);
+			}
+
+			~decoder()
+			{
+				Lzma2Dec_Free(&dec, &mem);
+			}
+
+			void reset() {}
+
+			// Decodes a whole stream with the caller's buffer as the dictionary, so the output
+			// is written once, where it belongs. Only the probability tables are kept between
+			// calls, and only while the properties are unchanged.
+			bool decode(Byte prop, void const* src, size_t cb, void* dst, size_t dst_cb)
+			{
+				if (Lzma2Dec_AllocateProbs(&dec, prop, &mem) != SZ_OK)
+					return false;
+				dec.decoder.dic = (Byte*)dst;
+				dec.decoder.dicBufSize = dst_cb;
+				Lzma2Dec_Init(&dec);
+
+				SizeT in_cb = cb;
+				ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+				SRes res = Lzma2Dec_DecodeToDic(&dec, dst_cb, (Byte const*)src, &in_cb, LZMA_FINISH_END, &status);
+				size_t const written = dec.decoder.dicPos;
+				dec.decoder.dic = nullptr;
+				dec.decoder.dicBufSize = 0;
+				return res == SZ_OK && status == LZMA_STATUS_FINISHED_WITH_MARK && written == dst_cb;
+			}
+
+			arena mem;
+			CLzma2Dec dec;
+
+		private:
+			decoder(decoder const&);
+			decoder& operator = (decoder const&);
+		};
+
+		struct deflater
+		{
+			deflater()
+			{
+				z_stream _ = {}; zs = _;
+				zs.zalloc = &z_alloc_func;
+				zs.zfree = &z_free_func;
+				zs.opaque = &mem;
+				ok = deflateInit(&zs, Z_DEFAULT_COMPRESSION) == Z_OK;
+			}
+
+			~deflater()
+			{
+				if (ok)
+					deflateEnd(&zs);
+			}
+
+			void reset()
+			{
+				if (ok)
+					deflateReset(&zs);
+			}
+
+			arena mem;
+			z_stream zs;
+			bool ok;
+
+		private:
+			deflater(deflater const&);
+			deflater& operator = (deflater const&);
+		};
+
+		struct inflater
+		{
+			inflater()
+			{
+				z_stream _ = {}; zs = _;
+				zs.zalloc = &z_alloc_func;
+				zs.zfree = &z_free_func;
+				zs.opaque = &mem;
+				ok = inflateInit(&zs) == Z_OK;
+			}
+
+			~inflater()
+			{
+				if (ok)
+					inflateEnd(&zs);
+			}
+
+			void reset()
+			{
+				if (ok)
+					inflateReset(&zs);
+			}
+
+			arena mem;
+			z_stream zs;
+			bool ok;
+
+		private:
+			inflater(inflater const&);
+			inflater& operator = (inflater const&);
+		};
+
+		// Idle coders, shared by all threads.
+		template <typename T>
+		struct pool
+		{
+			~pool()
+			{
+				for (auto I = spare.begin(); I != spare.end(); ++I)
+					delete *I;
+			}
+
+			T* acquire()
+			{
+				{
+					std::lock_guard<std::mutex> lk(mutex);
+					if (!spare.empty())
+					{
+						T* t = spare.back();
+						spare.pop_back();
+						return t;
+					}
+				}
+				return new T;
+			}
+
+			void release(T* t)
+			{
+				t->reset();
+				std::lock_guard<std::mutex> lk(mutex);
+				spare.push_back(t);
+			}
+
+		private:
+			std::mutex mutex;
+			std::vector<T*> spare;
+		};
+
+		extern pool<encoder> encoders;
+		extern pool<decoder> decoders;
+		extern pool<deflater> deflaters;
+		extern pool<inflater> inflaters;
+
+		// Only the codec benchmark turns this off, to measure coders made for every call.
+		extern std::atomic<bool> use_pools;
+
+		// A coder for the duration of one call. It goes back to the pool only if the call
+		// commits the lease once the coder has succeeded; coders left in an unknown state by
+		// an error or an exception are not handed out again.
+		template <typename T>
+		struct lease
+		{
+			explicit lease(pool<T>& from)
+				: from(use_pools ? &from : nullptr), t(use_pools ? from.acquire() : new T), committed(false)
+			{}
+
+			~lease()
+			{
+				if (from && committed)
+					from->release(t);
+				else
+					delete t;
+			}
+
+			T* operator -> () const { return t; }
+
+			bool commit(bool ok = true)
+			{
+				committed = ok;
+				return ok;
+			}
+
+		private:
+			pool<T>* from;
+			T* t;
+			bool committed;
+
+			lease(lease const&);
+			lease& operator = (lease const&);
+		};
+	}
+
 	template <typename Iterator>
 	bool z_pack(void const* src, size_t cb, Iterator I)
-	{	
-		z_stream zs = {};
-		zs.zalloc = Z_NULL;
-		zs.zfree = Z_NULL;
-		zs.opaque = NULL;
-
-		deflateInit(&zs, Z_DEFAULT_COMPRESSION);
-		
+	{
+		detail::lease<detail::deflater> def(detail::deflaters);
+		if (!def->ok)
+			return false;
+		z_stream& zs = def->zs;
+
 		zs.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(src));
 		zs.avail_in = cb;
-		
-		std::vector<char> out_buf(deflateBound(&zs, cb));
+
+		detail::scratch_buffer out_buf(deflateBound(&zs, cb));
 		zs.next_out = reinterpret_cast<Bytef*>(&out_buf[0]);
 		zs.avail_out = out_buf.size();
 
-		deflate(&zs, Z_FINISH);
-		deflateEnd(&zs);
+		if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+			return false;
 
 		std::copy_n(out_buf.begin(), zs.total_out, I);
-		return true;
+		return def.commit();
 	}
 
 	template <typename Iterator>
 	bool z_unpack(void const* src, size_t cb, Iterator I)
 	{
-		z_stream zs = {};
-		zs.zalloc = Z_NULL;
-		zs.zfree = Z_NULL;
-		zs.opaque = NULL;
+		detail::lease<detail::inflater> inf(detail::inflaters);
+		if (!inf->ok)
+			return false;
+		z_stream& zs = inf->zs;
 
 		zs.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(src));
 		zs.avail_in = cb;
 
-		inflateInit(&zs);
-
 		size_t const OUT_CB = 1024;
 		char buf[OUT_CB];
 		zs.next_out = reinterpret_cast<Bytef*>(buf);
 		zs.avail_out = OUT_CB;
-		
+
 		while (1)
 		{
 			int res = inflate(&zs, Z_NO_FLUSH);
@@ -64,28 +396,29 @@ namespace pack
 			if (res == Z_STREAM_END)
 				break;
 		}
-		inflateEnd(&zs);
-		return true;
+		return inf.commit();
 	}
-}
 
-#include "lzma/Lzma2Enc.h"
-#include "lzma/Lzma2Dec.h"
+	// Inflates into a buffer of exactly the unpacked size, which the stream does not record.
+	inline bool z_unpack_into(void const* src, size_t cb, void* dst, size_t dst_cb)
+	{
+		detail::lease<detail::inflater> inf(detail::inflaters);
+		if (!inf->ok)
+			return false;
+		z_stream& zs = inf->zs;
+
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(src));
+		zs.avail_in = cb;
+		zs.next_out = reinterpret_cast<Bytef*>(dst);
+		zs.avail_out = dst_cb;
+		return inf.commit(inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == dst_cb);
+	}
+}
 
 namespace pack
 {
 	namespace detail
 	{
-		inline void* alloc_func(void* p, size_t cb)
-		{
-			return malloc(cb);
-		}
-
-		inline void free_func(void* p, void* addr)
-		{
-			free(addr);
-		}
-
 		struct source : ISeqInStream
 		{
 			source(void const* src, size_t cb)
@@ -99,7 +432,7 @@ namespace pack
 				auto self = (source*)p;
 				auto dst = (uint8_t*)buf;
 
-				size_t n = (std::min)(2048u, (std::min)(*size, self->cb));
+				size_t n = (std::min)((size_t)2048, (std::min)(*size, self->cb));
 				std::memcpy(dst, self->src, n);
 
 				self->cb -= n;
@@ -143,67 +476,6 @@ namespace pack
 		{
 			return sink<Iterator>(I);
 		}
-
-		struct allocs
-		{
-			allocs()
-			{
-				mem_fns.Alloc = &detail::alloc_func;
-				mem_fns.Free = &detail::free_func;
-			}
-
-			ISzAlloc mem_fns;
-		};
-
-		struct encoder : allocs
-		{
-			encoder()
-			{
-				p = Lzma2Enc_Create(&mem_fns, &mem_fns);
-				Lzma2EncProps_Init(&props2);
-				auto& props = props2.lzmaProps;
-				props.level = 1;
-				props.fb = 128;
-				props.algo = 1;
-				props.numThreads = 1;
-				props.writeEndMark = 1;
-				Lzma2Enc_SetProps(p, &props2);
-			}
-
-			~encoder()
-			{
-				Lzma2Enc_Destroy(p);
-			}
-
-			CLzma2EncHandle p;
-			CLzma2EncProps props2;
-
-		private:
-			encoder(encoder const&);
-			encoder& operator = (encoder const&);
-		};
-
-		struct decoder : allocs
-		{
-			decoder(Byte prop)
-			{
-				CLzma2Dec _ = {}; dec = _;
-				Lzma2Dec_Construct(&dec);
-				Lzma2Dec_Allocate(&dec, prop, &mem_fns);
-				Lzma2Dec_Init(&dec);
-			}
-
-			~decoder()
-			{
-				Lzma2Dec_Free(&dec, &mem_fns);
-			}
-
-			CLzma2Dec dec;
-
-		private:
-			decoder(decoder const&);
-			decoder& operator = (decoder const&);
-		};
 	}
 
 	/* LZMA stream:
@@ -215,9 +487,9 @@ namespace pack
 	template <typename Iterator>
 	bool lzma_pack(void const* src, size_t cb, Iterator I)
 	{
-		detail::encoder enc;
+		detail::lease<detail::encoder> enc(detail::encoders);
 
-		auto& h = enc.p;
+		auto& h = enc->p;
 
 		auto os = detail::make_sink(I);
 		auto is = detail::make_source(src, cb);
@@ -227,38 +499,36 @@ namespace pack
 		uint32_t cb_i = cb;
 		os.Write(&os, &cb_i, 4);
 		auto res = Lzma2Enc_Encode(h, &os, &is, NULL);
-		return res == SZ_OK;
+		return enc.commit(res == SZ_OK);
 	}
 
-	template <typename Iterator>
-	bool lzma_unpack(void const* src, size_t cb, Iterator I)
+	// Size of the data in an LZMA stream, 0 if it cannot be unpacked.
+	inline size_t lzma_unpacked_size(void const* src, size_t cb)
 	{
-		auto os = detail::make_sink(I);
-		auto is = detail::make_source(src, cb);
+		if (cb < 5)
+			return 0;
+		uint32_t cb_i;
+		std::memcpy(&cb_i, (char const*)src + 1, 4);
+		return cb_i < (1 << 20) ? cb_i : 0;
+	}
 
-		Byte b;
-		size_t sz = 1;
-		is.Read(&is, &b, &sz);
-		if (sz != 1)
+	// Decodes into a buffer of exactly lzma_unpacked_size bytes.
+	inline bool lzma_unpack_into(void const* src, size_t cb, void* dst, size_t dst_cb)
+	{
+		size_t const size = lzma_unpacked_size(src, cb);
+		if (size == 0 || size != dst_cb)
 			return false;
+		detail::lease<detail::decoder> dec(detail::decoders);
+		return dec.commit(dec->decode(*(Byte const*)src, (Byte const*)src + 5, cb - 5, dst, dst_cb));
+	}
 
-		uint32_t cb_i;
-		sz = 4;
-		is.Read(&is, &cb_i, &sz);
-		if (sz != 4 || cb_i >= (1 << 20)) // needs more clever setup for streaming
+	template <typename Iterator>
+	bool lzma_unpack(void const* src, size_t cb, Iterator I)
+	{
+		detail::scratch_buffer buf(lzma_unpacked_size(src, cb));
+		if (buf.empty() || !lzma_unpack_into(src, cb, buf.data(), buf.size()))
 			return false;
-
-		std::vector<uint8_t> buf(cb_i);
-
-		detail::decoder dec(b);
-		ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
-		cb -= 5;
-		SRes res = Lzma2Dec_DecodeToBuf(&dec.dec, &buf[0], &cb_i, (Byte const*)src + 5, &cb, LZMA_FINISH_END, &status);
-		if (res == SZ_OK && status == LZMA_STATUS_FINISHED_WITH_MARK)
-		{
-			os.Write(&os, &buf[0], cb_i);
-			return true;
-		}
-		return false;
+		std::copy(buf.begin(), buf.end(), I);
+		return true;
 	}
 }
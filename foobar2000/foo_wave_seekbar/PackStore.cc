@@ -0,0 +1,803 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PchSeekbar.h"
+#include "PackStore.h"
+#include "CacheImpl.h"
+#include "Signature.h"
+#include "util/Filesystem.h"
+#include "zlib/zlib.h"
+
+namespace wave
+{
+	namespace
+	{
+		char const pack_magic[4] = { 'W', 'S', 'P', 'K' };
+		char const record_magic[4] = { 'W', 'S', 'R', 'C' };
+		char const index_magic[4] = { 'W', 'S', 'P', 'I' };
+		t_uint32 const pack_version = 1, index_version = 1;
+
+		size_t const pack_header_size = 32, record_header_size = 48, index_header_size = 64, slot_size = 32;
+		size_t const pack_growth = 8 << 20, initial_slot_count = 4096;
+
+		// Slot offsets, records never live at offset zero.
+		t_uint64 const empty_slot = 0, erased_slot = ~0ULL;
+
+		enum record_kind
+		{
+			record_waveform = 1,
+			record_removal = 2,
+			record_stamp = 3,
+		};
+
+		// Index header fields.
+		enum
+		{
+			index_clean = 8,
+			index_slot_count = 16,
+			index_entry_count = 24,
+			index_used_count = 32,
+			index_pack_size = 40,
+			index_dead_bytes = 48,
+		};
+
+		template <typename T>
+		T read_pod(char const* p)
+		{
+			T t;
+			memcpy(&t, p, sizeof(T));
+			return t;
+		}
+
+		template <typename T>
+		void write_pod(char* p, T const& t)
+		{
+			memcpy(p, &t, sizeof(T));
+		}
+
+		size_t align8(size_t n)
+		{
+			return (n + 7) & ~(size_t)7;
+		}
+
+		t_uint64 hash_key(char const* location, t_uint32 subsong)
+		{
+			t_uint64 h = 14695981039346656037ULL;
+			for (unsigned char const* p = (unsigned char const*)location; *p; ++p)
+			{
+				h ^= *p;
+				h *= 1099511628211ULL;
+			}
+			for (int i = 0; i < 4; ++i)
+			{
+				h ^= (subsong >> (8*i)) & 0xFF;
+				h *= 1099511628211ULL;
+			}
+			return h;
+		}
+
+		t_uint64 index_field(util::mapped_file const& index, size_t field)
+		{
+			return read_pod<t_uint64>(index.data() + field);
+		}
+
+		void set_index_field(util::mapped_file& index, size_t field, t_uint64 value)
+		{
+			write_pod(index.writable_data() + field, value);
+		}
+
+		void add_index_field(util::mapped_file& index, size_t field, t_int64 delta)
+		{
+			set_index_field(index, field, index_field(index, field) + delta);
+		}
+
+		// Checksums everything but the magic and the checksum itself.
+		t_uint32 record_checksum(char const* p, size_t payload_size)
+		{
+			uLong crc = crc32(0, (Bytef const*)p + 4, 36);
+			return (t_uint32)crc32(crc, (Bytef const*)p + record_header_size, (uInt)payload_size);
+		}
+
+		void seal_record(char* p)
+		{
+			size_t payload_size = read_pod<t_uint32>(p + 32) + 1 + read_pod<t_uint32>(p + 36);
+			write_pod(p + 40, record_checksum(p, payload_size));
+		}
+	}
+
+	struct pack_store::record
+	{
+		t_uint32 kind, subsong;
+		t_filestats stats;
+		char const* location;
+		size_t location_length;
+		char const* data;
+		size_t data_size;
+		size_t size;
+	};
+
+	struct pack_store::slot
+	{
+		t_uint64 hash, offset, size, timestamp;
+	};
+
+	pack_store::pack_store(pfc::string const& pack_filename)
+		: committed(0), index_dirty(false)
+	{
+		pack_path = pfc::stringcvt::string_wide_from_utf8(pack_filename.get_ptr()).get_ptr();
+		index_path = pack_path + L"-index";
+		jobs_path = pack_path + L"-jobs";
+
+		if (!pack.open(pack_path, util::mapped_file::read_write))
+		{
+			console::formatter() << "Waveform pack: could not open " << pack_filename.get_ptr();
+			return;
+		}
+		if (!open_pack())
+		{
+			console::formatter() << "Waveform pack: " << pack_filename.get_ptr() << " is damaged, it has been set aside and a new pack started.";
+			pack.close();
+			DeleteFileW(index_path.c_str());
+			MoveFileExW(pack_path.c_str(), (pack_path + L".damaged").c_str(), MOVEFILE_REPLACE_EXISTING);
+			if (!pack.open(pack_path, util::mapped_file::read_write) || !open_pack())
+			{
+				pack.close();
+				return;
+			}
+		}
+		if (!open_index() && !rebuild_index(true))
+		{
+			console::formatter() << "Waveform pack: could not create the index for " << pack_filename.get_ptr();
+			pack.close();
+		}
+	}
+
+	pack_store::~pack_store()
+	{
+		close_cleanly();
+	}
+
+	bool pack_store::open_pack()
+	{
+		if (pack.size() == 0)
+		{
+			if (!pack.resize(pack_growth))
+				return false;
+			char* p = pack.writable_data();
+			memcpy(p, pack_magic, 4);
+			write_pod(p + 4, pack_version);
+			committed = pack_header_size;
+			write_pod(p + 8, (t_uint64)committed);
+			return true;
+		}
+
+		char const* p = pack.data();
+		if (pack.size() < pack_header_size || memcmp(p, pack_magic, 4) || read_pod<t_uint32>(p + 4) != pack_version)
+			return false;
+		t_uint64 size = read_pod<t_uint64>(p + 8);
+		if (size < pack_header_size || size > pack.size())
+			return false;
+		committed = (size_t)size;
+		return true;
+	}
+
+	bool pack_store::read_record(util::mapped_file const& source, size_t offset, size_t limit, bool verify, record& out) const
+	{
+		if (offset < pack_header_size || offset % 8 || offset > limit || limit - offset < record_header_size || limit > source.size())
+			return false;
+
+		char const* p = source.data() + offset;
+		if (memcmp(p, record_magic, 4))
+			return false;
+
+		out.size = read_pod<t_uint32>(p + 4);
+		out.kind = read_pod<t_uint32>(p + 8);
+		out.subsong = read_pod<t_uint32>(p + 12);
+		out.stats.m_size = read_pod<t_uint64>(p + 16);
+		out.stats.m_timestamp = read_pod<t_uint64>(p + 24);
+		out.location_length = read_pod<t_uint32>(p + 32);
+		out.data_size = read_pod<t_uint32>(p + 36);
+
+		if (out.size < record_header_size || out.size % 8 || out.size > limit - offset)
+			return false;
+		size_t const room = out.size - record_header_size;
+		if (out.location_length >= room || out.data_size > room - out.location_length - 1)
+			return false;
+
+		out.location = p + record_header_size;
+		out.data = out.location + out.location_length + 1;
+		if (out.location[out.location_length] != '\0')
+			return false;
+		if (verify && record_checksum(p, out.location_length + 1 + out.data_size) != read_pod<t_uint32>(p + 40))
+			return false;
+		return true;
+	}
+
+	bool pack_store::reserve_pack(size_t size)
+	{
+		if (size <= pack.size())
+			return true;
+		return pack.resize((size + pack_growth - 1) / pack_growth * pack_growth);
+	}
+
+	void pack_store::commit_pack(size_t size)
+	{
+		committed = size;
+		write_pod(pack.writable_data() + 8, (t_uint64)committed);
+	}
+
+	size_t pack_store::append_record(t_uint32 kind, char const* location, t_uint32 subsong, t_filestats const& stats, void const* data, size_t data_size)
+	{
+		size_t const location_length = strlen(location);
+		size_t const payload_size = location_length + 1 + data_size;
+		size_t const size = align8(record_header_size + payload_size);
+		if (size > 0xFFFFFFFFU || !reserve_pack(committed + size))
+			return 0;
+
+		size_t const offset = committed;
+		char* p = pack.writable_data() + offset;
+		memset(p, 0, size);
+		memcpy(p, record_magic, 4);
+		write_pod(p + 4, (t_uint32)size);
+		write_pod(p + 8, kind);
+		write_pod(p + 12, subsong);
+		write_pod(p + 16, (t_uint64)stats.m_size);
+		write_pod(p + 24, (t_uint64)stats.m_timestamp);
+		write_pod(p + 32, (t_uint32)location_length);
+		write_pod(p + 36, (t_uint32)data_size);
+		memcpy(p + record_header_size, location, location_length + 1);
+		if (data_size)
+			memcpy(p + record_header_size + location_length + 1, data, data_size);
+		seal_record(p);
+
+		// The committed size moves past the record only once it is complete.
+		commit_pack(offset + size);
+		return offset;
+	}
+
+	bool pack_store::open_index()
+	{
+		if (!index.open(index_path, util::mapped_file::read_write))
+			return false;
+
+		char const* p = index.data();
+		if (!p || index.size() < index_header_size || memcmp(p, index_magic, 4) || read_pod<t_uint32>(p + 4) != index_version)
+			return false;
+		t_uint64 slot_count = index_field(index, index_slot_count);
+		if (slot_count == 0 || (slot_count & (slot_count - 1)) || slot_count > (index.size() - index_header_size) / slot_size)
+			return false;
+		return read_pod<t_uint32>(p + index_clean) == 1 && index_field(index, index_pack_size) == committed;
+	}
+
+	bool pack_store::create_index(size_t slot_count)
+	{
+		if (!index.is_open() && !index.open(index_path, util::mapped_file::read_write))
+			return false;
+		if (!index.resize(index_header_size + slot_count * slot_size))
+			return false;
+
+		char* p = index.writable_data();
+		memset(p, 0, index.size());
+		memcpy(p, index_magic, 4);
+		write_pod(p + 4, index_version);
+		set_index_field(index, index_slot_count, slot_count);
+		index_dirty = true;
+		return index.flush();
+	}
+
+	bool pack_store::rebuild_index(bool verify)
+	{
+		if (!create_index(initial_slot_count))
+			return false;
+
+		size_t offset = pack_header_size;
+		record r;
+		while (offset < committed && read_record(pack, offset, committed, verify, r))
+		{
+			switch (r.kind)
+			{
+			case record_waveform:
+				insert_slot(r.location, r.subsong, offset, r.stats);
+				break;
+			case record_removal:
+				erase_slot(r.location, r.subsong);
+				add_index_field(index, index_dead_bytes, r.size);
+				break;
+			case record_stamp:
+				if (slot* s = find_slot(r.location, r.subsong, hash_key(r.location, r.subsong), nullptr))
+				{
+					s->size = r.stats.m_size;
+					s->timestamp = r.stats.m_timestamp;
+				}
+				add_index_field(index, index_dead_bytes, r.size);
+				break;
+			default:
+				add_index_field(index, index_dead_bytes, r.size);
+				break;
+			}
+			offset += r.size;
+		}
+
+		if (offset != committed)
+		{
+			console::formatter() << "Waveform pack: dropped " << (t_uint64)(committed - offset) << " bytes of damaged records at the end of the pack.";
+			commit_pack(offset);
+		}
+		return true;
+	}
+
+	pack_store::slot* pack_store::find_slot(char const* location, t_uint32 subsong, t_uint64 hash, slot** insert_at)
+	{
+		t_uint64 const n = index_field(index, index_slot_count);
+		slot* slots = (slot*)(index.writable_data() + index_header_size);
+		size_t const location_length = strlen(location);
+		slot* first_free = nullptr;
+		for (t_uint64 i = hash & (n - 1), probes = 0; probes < n; i = (i + 1) & (n - 1), ++probes)
+		{
+			slot& s = slots[i];
+			if (s.offset == empty_slot)
+			{
+				first_free = first_free ? first_free : &s;
+				break;
+			}
+			if (s.offset == erased_slot)
+			{
+				first_free = first_free ? first_free : &s;
+				continue;
+			}
+			record r;
+			if (s.hash == hash && read_record(pack, (size_t)s.offset, committed, false, r) &&
+				r.subsong == subsong && r.location_length == location_length && !memcmp(r.location, location, location_length))
+			{
+				return &s;
+			}
+		}
+		if (insert_at)
+			*insert_at = first_free;
+		return nullptr;
+	}
+
+	bool pack_store::insert_slot(char const* location, t_uint32 subsong, size_t offset, t_filestats const& stats)
+	{
+		t_uint64 const n = index_field(index, index_slot_count);
+		if ((index_field(index, index_used_count) + 1) * 5 > n * 3)
+		{
+			// Live entries are rehashed into a fresh table, dropping erased slots.
+			std::vector<slot> live;
+			slot const* slots = (slot const*)(index.data() + index_header_size);
+			for (t_uint64 i = 0; i < n; ++i)
+			{
+				if (slots[i].offset != empty_slot && slots[i].offset != erased_slot)
+					live.push_back(slots[i]);
+			}
+			t_uint64 dead_bytes = index_field(index, index_dead_bytes);
+			size_t new_count = (size_t)n;
+			while ((live.size() + 1) * 5 > new_count * 2)
+				new_count *= 2;
+			if (!create_index(new_count))
+				return false;
+
+			slot* fresh = (slot*)(index.writable_data() + index_header_size);
+			for (auto I = live.begin(); I != live.end(); ++I)
+			{
+				t_uint64 i = I->hash & (new_count - 1);
+				while (fresh[i].offset != empty_slot)
+					i = (i + 1) & (new_count - 1);
+				fresh[i] = *I;
+			}
+			set_index_field(index, index_entry_count, live.size());
+			set_index_field(index, index_used_count, live.size());
+			set_index_field(index, index_dead_bytes, dead_bytes);
+		}
+
+		t_uint64 const hash = hash_key(location, subsong);
+		slot* at = nullptr;
+		if (slot* existing = find_slot(location, subsong, hash, &at))
+		{
+			add_index_field(index, index_dead_bytes, read_pod<t_uint32>(pack.data() + existing->offset + 4));
+			existing->offset = offset;
+			existing->size = stats.m_size;
+			existing->timestamp = stats.m_timestamp;
+			return true;
+		}
+		if (!at)
+			return false;
+
+		if (at->offset == empty_slot)
+			add_index_field(index, index_used_count, 1);
+		add_index_field(index, index_entry_count, 1);
+		at->hash = hash;
+		at->offset = offset;
+		at->size = stats.m_size;
+		at->timestamp = stats.m_timestamp;
+		return true;
+	}
+
+	void pack_store::erase_slot(char const* location, t_uint32 subsong)
+	{
+		if (slot* s = find_slot(location, subsong, hash_key(location, subsong), nullptr))
+		{
+			add_index_field(index, index_dead_bytes, read_pod<t_uint32>(pack.data() + s->offset + 4));
+			add_index_field(index, index_entry_count, -1);
+			s->offset = erased_slot;
+		}
+	}
+
+	void pack_store::mark_index_dirty()
+	{
+		if (index_dirty)
+			return;
+		// Flushed right away, so a crash past this point finds the index marked dirty.
+		write_pod(index.writable_data() + index_clean, (t_uint32)0);
+		index.flush();
+		index_dirty = true;
+	}
+
+	void pack_store::close_cleanly()
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		close_pack_locked();
+		index.close();
+	}
+
+	void pack_store::close_pack_locked()
+	{
+		if (!pack.is_open())
+			return;
+		// Pack, then index, then the clean mark, so any torn state leaves the index dirty.
+		bool flushed = pack.resize(committed) && pack.flush();
+		pack.close();
+		if (!flushed || !index.data())
+			return;
+		set_index_field(index, index_pack_size, committed);
+		if (!index.flush())
+			return;
+		write_pod(index.writable_data() + index_clean, (t_uint32)1);
+		index.flush();
+		index_dirty = false;
+	}
+
+	bool pack_store::has(playable_location const& file)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return false;
+		return !!find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr);
+	}
+
+	void pack_store::remove(playable_location const& file)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return;
+		if (!find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr))
+			return;
+		mark_index_dirty();
+		size_t offset = append_record(record_removal, file.get_path(), file.get_subsong(), filestats_invalid, nullptr, 0);
+		if (offset)
+		{
+			erase_slot(file.get_path(), file.get_subsong());
+			add_index_field(index, index_dead_bytes, read_pod<t_uint32>(pack.data() + offset + 4));
+		}
+	}
+
+	void pack_store::remove_all(std::vector<playable_location_impl> const& files)
+	{
+		for (auto I = files.begin(); I != files.end(); ++I)
+			remove(*I);
+	}
+
+	bool pack_store::get(ref_ptr<waveform>& out, playable_location const& file)
+	{
+		out.reset();
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return false;
+		slot* s = find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr);
+		record r;
+		if (!s || !read_record(pack, (size_t)s->offset, committed, false, r))
+			return false;
+		// Dequantized straight off the mapping into the channels, the record is never copied.
+		out = signature_to_waveform(r.data, r.data_size);
+		return out.is_valid();
+	}
+
+	void pack_store::put(ref_ptr<waveform> const& in, playable_location const& file)
+	{
+		std::vector<encoded_waveform> all(1);
+		all[0].location = file;
+		all[0].channel_map = in->get_channel_map();
+		signature::planar_data planar;
+		waveform_to_planar(in, planar);
+		signature::encode(planar, preferred_quantization(), all[0].signature);
+		put_all(all);
+	}
+
+	void pack_store::has_all(std::vector<playable_location_impl> const& files, std::vector<bool>& out)
+	{
+		out.assign(files.size(), false);
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return;
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			auto const& file = files[i];
+			out[i] = !!find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr);
+		}
+	}
+
+	void pack_store::put_all(std::vector<encoded_waveform> const& in)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return;
+		mark_index_dirty();
+
+		for (auto I = in.begin(); I != in.end(); ++I)
+		{
+			auto const& file = I->location;
+			// The stamp of an earlier waveform stays until the caller records a new one.
+			t_filestats stats = filestats_invalid;
+			if (slot* s = find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr))
+			{
+				stats.m_size = s->size;
+				stats.m_timestamp = s->timestamp;
+			}
+			size_t offset = append_record(record_waveform, file.get_path(), file.get_subsong(), stats, I->signature.data(), I->signature.size());
+			if (!offset || !insert_slot(file.get_path(), file.get_subsong(), offset, stats))
+				console::formatter() << "Waveform pack: could not store waveform for " << file;
+		}
+	}
+
+	void pack_store::set_file_stats(playable_location const& file, t_filestats const& stats)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return;
+		if (!find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr))
+			return;
+		mark_index_dirty();
+		size_t offset = append_record(record_stamp, file.get_path(), file.get_subsong(), stats, nullptr, 0);
+		if (!offset)
+			return;
+		add_index_field(index, index_dead_bytes, read_pod<t_uint32>(pack.data() + offset + 4));
+		if (slot* s = find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr))
+		{
+			s->size = stats.m_size;
+			s->timestamp = stats.m_timestamp;
+		}
+	}
+
+	bool pack_store::get_file_stats(playable_location const& file, t_filestats& out)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return false;
+		slot* s = find_slot(file.get_path(), file.get_subsong(), hash_key(file.get_path(), file.get_subsong()), nullptr);
+		if (!s || (s->size == filesize_invalid && s->timestamp == filetimestamp_invalid))
+			return false;
+		out.m_size = s->size;
+		out.m_timestamp = s->timestamp;
+		return true;
+	}
+
+	void pack_store::get_all(pfc::list_t<playable_location_impl>& out)
+	{
+		std::vector<stamped_location> entries;
+		get_all_stamped(entries);
+		out.remove_all();
+		for (auto I = entries.begin(); I != entries.end(); ++I)
+			out.add_item(I->location);
+	}
+
+	void pack_store::get_all_stamped(std::vector<stamped_location>& out)
+	{
+		out.clear();
+		{
+			std::lock_guard<std::mutex> lk(mutex);
+			if (!pack.data() || !index.data())
+				return;
+			t_uint64 const n = index_field(index, index_slot_count);
+			slot const* slots = (slot const*)(index.data() + index_header_size);
+			for (t_uint64 i = 0; i < n; ++i)
+			{
+				record r;
+				if (slots[i].offset == empty_slot || slots[i].offset == erased_slot ||
+					!read_record(pack, (size_t)slots[i].offset, committed, false, r))
+				{
+					continue;
+				}
+				stamped_location entry;
+				entry.location = playable_location_impl(r.location, r.subsong);
+				entry.stats.m_size = slots[i].size;
+				entry.stats.m_timestamp = slots[i].timestamp;
+				entry.has_content_key = false;
+				out.push_back(entry);
+			}
+		}
+		std::sort(out.begin(), out.end(), [](stamped_location const& a, stamped_location const& b)
+		{
+			return LocationLessThan(a.location, b.location);
+		});
+	}
+
+	void pack_store::get_statistics(store_statistics& out)
+	{
+		out.backend = "pack";
+		store_statistics::entry waveforms = { "waveforms", 0, 0 };
+		store_statistics::entry blobs = { "signature v2, uncompressed", 0, 0 };
+		std::lock_guard<std::mutex> lk(mutex);
+		if (!pack.data() || !index.data())
+			return;
+		t_uint64 const n = index_field(index, index_slot_count);
+		slot const* slots = (slot const*)(index.data() + index_header_size);
+		for (t_uint64 i = 0; i < n; ++i)
+		{
+			record r;
+			if (slots[i].offset == empty_slot || slots[i].offset == erased_slot ||
+				!read_record(pack, (size_t)slots[i].offset, committed, false, r))
+			{
+				continue;
+			}
+			++waveforms.count;
+			waveforms.bytes += r.size;
+			++blobs.count;
+			blobs.bytes += r.data_size;
+		}
+		out.tables.push_back(waveforms);
+		out.encodings.push_back(blobs);
+		out.file_bytes = committed;
+		out.free_bytes = index_field(index, index_dead_bytes);
+	}
+
+	void pack_store::compact()
+	{
+		struct live_entry
+		{
+			size_t offset;
+			t_filestats stats;
+		};
+		std::vector<live_entry> live;
+		size_t snapshot;
+		{
+			std::lock_guard<std::mutex> lk(mutex);
+			if (!pack.data() || !index.data())
+				return;
+			snapshot = committed;
+			t_uint64 const n = index_field(index, index_slot_count);
+			slot const* slots = (slot const*)(index.data() + index_header_size);
+			for (t_uint64 i = 0; i < n; ++i)
+			{
+				if (slots[i].offset == empty_slot || slots[i].offset == erased_slot)
+					continue;
+				live_entry e;
+				e.offset = (size_t)slots[i].offset;
+				e.stats.m_size = slots[i].size;
+				e.stats.m_timestamp = slots[i].timestamp;
+				live.push_back(e);
+			}
+		}
+		std::sort(live.begin(), live.end(), [](live_entry const& a, live_entry const& b) { return a.offset < b.offset; });
+
+		// Committed records never change, so the bulk of the copy runs unlocked from a mapping
+		// of our own while the store keeps serving requests.
+		std::wstring temp_path = pack_path + L".compact";
+		util::mapped_file source, target;
+		DeleteFileW(temp_path.c_str());
+		if (!source.open(pack_path) || !target.open(temp_path, util::mapped_file::read_write))
+		{
+			console::info("Waveform pack: could not open files for compaction.");
+			return;
+		}
+
+		size_t size = pack_header_size;
+		std::vector<live_entry> copied;
+		for (auto I = live.begin(); I != live.end(); ++I)
+		{
+			record r;
+			if (read_record(source, I->offset, snapshot, true, r) && r.kind == record_waveform)
+			{
+				size += r.size;
+				copied.push_back(*I);
+			}
+		}
+		if (!target.resize(size + pack_growth))
+		{
+			console::info("Waveform pack: could not grow the compacted pack.");
+			return;
+		}
+
+		char* out = target.writable_data();
+		memcpy(out, pack_magic, 4);
+		write_pod(out + 4, pack_version);
+		size_t written = pack_header_size;
+		for (auto I = copied.begin(); I != copied.end(); ++I)
+		{
+			t_uint32 record_size = read_pod<t_uint32>(source.data() + I->offset + 4);
+			char* p = out + written;
+			memcpy(p, source.data() + I->offset, record_size);
+			// Stamps recorded after the waveform are folded into the record itself.
+			write_pod(p + 16, (t_uint64)I->stats.m_size);
+			write_pod(p + 24, (t_uint64)I->stats.m_timestamp);
+			seal_record(p);
+			written += record_size;
+		}
+		source.close();
+
+		size_t before;
+		bool replaced;
+		{
+			std::lock_guard<std::mutex> lk(mutex);
+			before = committed;
+			size_t tail = committed - snapshot;
+			if (written + tail > target.size() && !target.resize(written + tail))
+			{
+				console::info("Waveform pack: could not grow the compacted pack.");
+				return;
+			}
+			// Whatever was appended meanwhile is carried over as-is and replayed by the rebuild.
+			memcpy(target.writable_data() + written, pack.data() + snapshot, tail);
+			written += tail;
+			write_pod(target.writable_data() + 8, (t_uint64)written);
+			target.resize(written);
+			target.flush();
+			target.close();
+
+			close_pack_locked();
+			replaced = !!MoveFileExW(temp_path.c_str(), pack_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+			if (!replaced)
+				DeleteFileW(temp_path.c_str());
+			if (!pack.open(pack_path, util::mapped_file::read_write) || !open_pack() || !rebuild_index(false))
+			{
+				console::info("Waveform pack: could not reopen the pack after compaction.");
+				pack.close();
+				return;
+			}
+		}
+		if (!replaced)
+		{
+			console::info("Waveform pack: could not replace the pack with its compacted copy.");
+			return;
+		}
+		console::formatter() << "Waveform pack: compacted from " << (t_uint64)before << " to " << (t_uint64)committed << " bytes.";
+	}
+
+	void pack_store::get_jobs(std::deque<job>& out)
+	{
+		out.clear();
+		util::mapped_file jobs;
+		if (!jobs.open(jobs_path))
+			return;
+
+		// One job per line: user flag, subsong, location.
+		char const* p = jobs.data();
+		char const* end = p + jobs.size();
+		while (p < end)
+		{
+			char const* eol = std::find(p, end, '\n');
+			pfc::string8 line(p, eol - p);
+			p = eol + 1;
+
+			char const* first_tab = strchr(line, '\t');
+			char const* second_tab = first_tab ? strchr(first_tab + 1, '\t') : nullptr;
+			if (!second_tab)
+				continue;
+			bool user = line[0] == '1';
+			t_uint32 subsong = (t_uint32)pfc::atoui_ex(first_tab + 1, second_tab - first_tab - 1);
+			out.push_back(make_job(playable_location_impl(second_tab + 1, subsong), user));
+		}
+	}
+
+	void pack_store::put_jobs(std::deque<job> const& jobs)
+	{
+		pfc::string8 text;
+		for (auto I = jobs.begin(); I != jobs.end(); ++I)
+			text << (I->user ? "1" : "0") << "\t" << I->loc.get_subsong() << "\t" << I->loc.get_path() << "\n";
+		if (jobs.empty())
+			DeleteFileW(jobs_path.c_str());
+		else
+			util::replace_file_contents(jobs_path, text.get_ptr(), text.length());
+	}
+}
@@ -0,0 +1,90 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "BackingStore.h"
+#include "util/MappedFile.h"
+#include <mutex>
+
+namespace wave
+{
+	/* Append-only pack of waveform records, little-endian:
+	 *   32 bytes header: magic "WSPK", u32 version, u64 committed size, 16 bytes reserved
+	 *   records, each 8-aligned:
+	 *     u32 magic "WSRC", u32 record size, u32 kind, u32 subsong,
+	 *     u64 track size, u64 track timestamp,
+	 *     u32 location length, u32 data size, u32 crc32, u32 reserved,
+	 *     location (UTF-8), data (signature v2 blob, uncompressed)
+	 *
+	 * Records are never modified once committed. Removals and stamp updates
+	 * are appended as records of their own, so replaying the pack in order
+	 * recreates the index.
+	 *
+	 * The index file beside it is an open-addressing hash table of
+	 *   u64 hash, u64 record offset, u64 track size, u64 track timestamp
+	 * slots after a 64 byte header. It is only trusted if it was closed cleanly
+	 * and covers the whole committed pack, otherwise it is rebuilt.
+	 */
+	struct pack_store : backing_store
+	{
+		explicit pack_store(pfc::string const& pack_filename);
+		~pack_store();
+
+		bool has(playable_location const& file) override;
+		void remove(playable_location const& file) override;
+		bool get(ref_ptr<waveform>& out, playable_location const& file) override;
+		void put(ref_ptr<waveform> const& in, playable_location const& file) override;
+		void has_all(std::vector<playable_location_impl> const& files, std::vector<bool>& out) override;
+		void put_all(std::vector<encoded_waveform> const& in) override;
+		void set_file_stats(playable_location const& file, t_filestats const& stats) override;
+		bool get_file_stats(playable_location const& file, t_filestats& out) override;
+		void remove_all(std::vector<playable_location_impl> const& files) override;
+		void compact() override;
+
+		// The pack is only ever compacted whole, which already runs alongside readers.
+		t_uint64 compact_step(t_uint64) override { return 0; }
+		void upgrade(abort_callback&) override {}
+
+		// Content keys are not recorded, so moved tracks are rescanned rather than relinked.
+		void set_content_key(playable_location const&, char const*) override {}
+		bool has_content_key(playable_location const&) override { return false; }
+		bool keeps_content_keys() override { return false; }
+		bool find_content(char const*, t_uint32, pfc::string8&) override { return false; }
+		bool relink(playable_location const&, char const*, bool) override { return false; }
+
+		void get_jobs(std::deque<job>&) override;
+		void put_jobs(std::deque<job> const&) override;
+
+		void get_all(pfc::list_t<playable_location_impl>&) override;
+		void get_all_stamped(std::vector<stamped_location>&) override;
+		void get_statistics(store_statistics& out) override;
+
+	private:
+		struct record;
+		struct slot;
+
+		bool open_pack();
+		bool read_record(util::mapped_file const& source, size_t offset, size_t limit, bool verify, record& out) const;
+		size_t append_record(t_uint32 kind, char const* location, t_uint32 subsong, t_filestats const& stats, void const* data, size_t data_size);
+		bool reserve_pack(size_t size);
+		void commit_pack(size_t size);
+
+		bool open_index();
+		bool rebuild_index(bool verify);
+		bool create_index(size_t slot_count);
+		slot* find_slot(char const* location, t_uint32 subsong, t_uint64 hash, slot** insert_at);
+		bool insert_slot(char const* location, t_uint32 subsong, size_t offset, t_filestats const& stats);
+		void erase_slot(char const* location, t_uint32 subsong);
+		void mark_index_dirty();
+		void close_cleanly();
+		void close_pack_locked();
+
+		std::mutex mutex;
+		std::wstring pack_path, index_path, jobs_path;
+		util::mapped_file pack, index;
+		size_t committed;
+		bool index_dirty;
+	};
+}
@@ -4,6 +4,7 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
+#if defined(_WIN32)
 #pragma warning(disable: 4005)
 #define D3D_DEBUG_INFO
 
@@ -37,3 +38,17 @@ using std::max;
 #undef SelectBitmap
 #undef SelectBrush
 #undef SelectPen
+#else
+// Elsewhere only the store code builds, against the stand-in SDK of tests/shim.
+#include <algorithm>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "foobar2000.h"
+
+#include "sqlite3.h"
+#endif
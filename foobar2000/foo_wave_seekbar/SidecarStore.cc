@@ -0,0 +1,408 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PchSeekbar.h"
+#include "SidecarStore.h"
+#include "BackingStore.h"
+#include "CacheImpl.h"
+#include "Signature.h"
+#include "Helpers.h"
+#include "util/Filesystem.h"
+
+namespace wave
+{
+	namespace sidecar
+	{
+		static char const magic[4] = { 'W', 'S', 'S', 'C' };
+		static size_t const header_size = 16, index_entry_size = 40;
+
+		// Directories seen are remembered, including those without a sidecar.
+		static size_t const max_cached_directories = 256;
+
+		template <typename T>
+		static T read_pod(char const* p)
+		{
+			T t;
+			memcpy(&t, p, sizeof(T));
+			return t;
+		}
+
+		template <typename T>
+		static void write_pod(std::vector<char>& out, T const& t)
+		{
+			char const* p = (char const*)&t;
+			out.insert(out.end(), p, p + sizeof(T));
+		}
+
+		static int compare_key(char const* a, size_t a_length, t_uint32 a_subsong, char const* b, size_t b_length, t_uint32 b_subsong)
+		{
+			int cmp = stricmp_utf8_ex(a, a_length, b, b_length);
+			if (cmp == 0)
+				return a_subsong < b_subsong ? -1 : (a_subsong > b_subsong ? 1 : 0);
+			return cmp;
+		}
+
+		struct index_entry
+		{
+			t_uint32 name_offset, name_length, subsong, data_offset, data_size;
+			t_uint64 size, timestamp;
+		};
+
+		static index_entry read_index_entry(char const* base, size_t i)
+		{
+			char const* p = base + header_size + i*index_entry_size;
+			index_entry e;
+			e.name_offset = read_pod<t_uint32>(p + 0);
+			e.name_length = read_pod<t_uint32>(p + 4);
+			e.subsong = read_pod<t_uint32>(p + 8);
+			e.data_offset = read_pod<t_uint32>(p + 12);
+			e.data_size = read_pod<t_uint32>(p + 16);
+			e.size = read_pod<t_uint64>(p + 24);
+			e.timestamp = read_pod<t_uint64>(p + 32);
+			return e;
+		}
+
+		bool view::open(std::wstring const& path)
+		{
+			count = 0;
+			if (!file.open(path))
+				return false;
+
+			char const* p = file.data();
+			size_t const cb = file.size();
+			if (cb < header_size || !std::equal(magic, magic + 4, p) || read_pod<t_uint32>(p + 4) != format_version)
+			{
+				file.close();
+				return false;
+			}
+
+			size_t const n = read_pod<t_uint32>(p + 8);
+			if (n > (cb - header_size) / index_entry_size)
+			{
+				file.close();
+				return false;
+			}
+
+			// Other machines write sidecars too, so every offset is checked once here.
+			for (size_t i = 0; i < n; ++i)
+			{
+				index_entry e = read_index_entry(p, i);
+				bool name_ok = e.name_offset < cb && e.name_length < cb - e.name_offset && p[e.name_offset + e.name_length] == '\0';
+				bool data_ok = e.data_offset <= cb && e.data_size <= cb - e.data_offset;
+				if (!name_ok || !data_ok)
+				{
+					file.close();
+					return false;
+				}
+			}
+			count = n;
+			return true;
+		}
+
+		bool view::find(char const* name, t_uint32 subsong, t_filestats& stats, void const*& data, size_t& size) const
+		{
+			char const* p = file.data();
+			size_t const name_length = strlen(name);
+			size_t lo = 0, hi = count;
+			while (lo < hi)
+			{
+				size_t mid = lo + (hi - lo) / 2;
+				index_entry e = read_index_entry(p, mid);
+				int cmp = compare_key(p + e.name_offset, e.name_length, e.subsong, name, name_length, subsong);
+				if (cmp == 0)
+				{
+					stats.m_size = e.size;
+					stats.m_timestamp = e.timestamp;
+					data = p + e.data_offset;
+					size = e.data_size;
+					return true;
+				}
+				if (cmp < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return false;
+		}
+
+		void view::get_entry(size_t i, entry& out) const
+		{
+			char const* p = file.data();
+			index_entry e = read_index_entry(p, i);
+			out.name.set_string(p + e.name_offset, e.name_length);
+			out.subsong = e.subsong;
+			out.stats.m_size = e.size;
+			out.stats.m_timestamp = e.timestamp;
+			out.data.assign(p + e.data_offset, p + e.data_offset + e.data_size);
+		}
+
+		bool write(std::wstring const& path, std::vector<entry> entries)
+		{
+			std::sort(entries.begin(), entries.end(), [](entry const& a, entry const& b)
+			{
+				return compare_key(a.name, a.name.length(), a.subsong, b.name, b.name.length(), b.subsong) < 0;
+			});
+
+			size_t names_size = 0;
+			for (auto I = entries.begin(); I != entries.end(); ++I)
+				names_size += I->name.length() + 1;
+
+			size_t const names_offset = header_size + entries.size() * index_entry_size;
+			size_t data_offset = (names_offset + names_size + 7) & ~(size_t)7;
+
+			std::vector<char> out;
+			out.insert(out.end(), magic, magic + 4);
+			write_pod(out, (t_uint32)format_version);
+			write_pod(out, (t_uint32)entries.size());
+			write_pod(out, (t_uint32)0);
+
+			size_t name_offset = names_offset, blob_offset = data_offset;
+			for (auto I = entries.begin(); I != entries.end(); ++I)
+			{
+				write_pod(out, (t_uint32)name_offset);
+				write_pod(out, (t_uint32)I->name.length());
+				write_pod(out, (t_uint32)I->subsong);
+				write_pod(out, (t_uint32)blob_offset);
+				write_pod(out, (t_uint32)I->data.size());
+				write_pod(out, (t_uint32)0);
+				write_pod(out, (t_uint64)I->stats.m_size);
+				write_pod(out, (t_uint64)I->stats.m_timestamp);
+				name_offset += I->name.length() + 1;
+				blob_offset = (blob_offset + I->data.size() + 7) & ~(size_t)7;
+			}
+			for (auto I = entries.begin(); I != entries.end(); ++I)
+				out.insert(out.end(), I->name.get_ptr(), I->name.get_ptr() + I->name.length() + 1);
+			for (auto I = entries.begin(); I != entries.end(); ++I)
+			{
+				out.resize((out.size() + 7) & ~(size_t)7);
+				out.insert(out.end(), I->data.begin(), I->data.end());
+			}
+			return util::replace_file_contents(path, out.data(), out.size());
+		}
+
+		bool split_location(char const* path, pfc::string8& directory, pfc::string8& name)
+		{
+			if (!util::starts_with(path, "file://"))
+				return false;
+			char const* separator = (std::max)(strrchr(path, '\\'), strrchr(path, '/'));
+			if (!separator || !separator[1])
+				return false;
+			directory.set_string(path, separator - path);
+			name = separator + 1;
+			return true;
+		}
+
+		std::wstring path_for_directory(char const* directory)
+		{
+			pfc::string8 path = directory;
+			path << "\\" << file_name;
+			return util::file_location_to_wide_path(path);
+		}
+	}
+
+	std::shared_ptr<sidecar::view> sidecar_store::open_directory(pfc::string8 const& directory)
+	{
+		auto I = directories.find(directory.get_ptr());
+		if (I != directories.end())
+			return I->second;
+
+		if (directories.size() >= sidecar::max_cached_directories)
+			directories.clear();
+
+		std::shared_ptr<sidecar::view> v(new sidecar::view);
+		if (!v->open(sidecar::path_for_directory(directory)))
+			v.reset();
+		directories[directory.get_ptr()] = v;
+		return v;
+	}
+
+	bool sidecar_store::find(playable_location const& file, abort_callback& abort_cb, void const*& data, size_t& size)
+	{
+		pfc::string8 directory, name;
+		if (!sidecar::split_location(file.get_path(), directory, name))
+			return false;
+
+		auto v = open_directory(directory);
+		t_filestats stored, current;
+		if (!v || !v->find(name, file.get_subsong(), stored, data, size))
+			return false;
+
+		// A sidecar copied along with a retagged track must not shadow the new audio.
+		if (try_get_file_stats(file.get_path(), current, abort_cb) && file_stats_differ(stored, current))
+			return false;
+		return true;
+	}
+
+	bool sidecar_store::has(playable_location const& file, abort_callback& abort_cb)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		void const* data;
+		size_t size;
+		return find(file, abort_cb, data, size);
+	}
+
+	bool sidecar_store::get(ref_ptr<waveform>& out, playable_location const& file, abort_callback& abort_cb)
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		void const* data;
+		size_t size;
+		if (!find(file, abort_cb, data, size))
+			return false;
+		out = signature_to_waveform(data, size);
+		return out.is_valid();
+	}
+
+	sidecar_store::sidecar_store()
+		: should_stop(false)
+	{
+		writer = std::thread(std::bind(&sidecar_store::writer_main, this));
+	}
+
+	sidecar_store::~sidecar_store()
+	{
+		shutdown();
+	}
+
+	void sidecar_store::shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lk(pending_mutex);
+			should_stop = true;
+			pending_bump.notify_one();
+		}
+		if (writer.joinable())
+			writer.join();
+	}
+
+	bool sidecar_store::put(ref_ptr<waveform> const& in, playable_location const& file, t_filestats const& stats)
+	{
+		sidecar::entry e;
+		pfc::string8 directory;
+		if (!sidecar::split_location(file.get_path(), directory, e.name))
+			return false;
+		e.subsong = file.get_subsong();
+		e.stats = stats;
+		{
+			signature::planar_data planar;
+			waveform_to_planar(in, planar);
+			signature::encode(planar, preferred_quantization(), e.data);
+		}
+
+		std::lock_guard<std::mutex> lk(pending_mutex);
+		if (should_stop)
+			return write_directory(directory.get_ptr(), std::vector<sidecar::entry>(1, e));
+		auto& d = pending[directory.get_ptr()];
+		d.entries.push_back(e);
+		d.last_put = std::chrono::steady_clock::now();
+		pending_bump.notify_one();
+		return true;
+	}
+
+	void sidecar_store::writer_main()
+	{
+		// A directory is written once it has been quiet this long or has this many tracks waiting.
+		auto const settle_time = std::chrono::seconds(10);
+		size_t const max_pending_entries = 64;
+
+		::SetThreadName(-1, "wave-sidecar-writer");
+		std::unique_lock<std::mutex> lk(pending_mutex);
+		while (1) {
+			auto const now = std::chrono::steady_clock::now();
+			auto next_due = now + settle_time;
+			std::vector<std::pair<std::string, std::vector<sidecar::entry>>> due;
+			for (auto I = pending.begin(); I != pending.end();) {
+				auto const ready = I->second.last_put + settle_time;
+				if (should_stop || ready <= now || I->second.entries.size() >= max_pending_entries) {
+					due.push_back(std::make_pair(I->first, std::move(I->second.entries)));
+					I = pending.erase(I);
+				}
+				else {
+					next_due = (std::min)(next_due, ready);
+					++I;
+				}
+			}
+
+			if (!due.empty()) {
+				lk.unlock();
+				for (auto I = due.begin(); I != due.end(); ++I) {
+					if (!write_directory(I->first, I->second))
+						console::formatter() << "Wave cache: could not write sidecar file in " << I->first.c_str();
+				}
+				lk.lock();
+				continue;
+			}
+			if (should_stop)
+				break;
+			if (pending.empty())
+				pending_bump.wait(lk);
+			else
+				pending_bump.wait_until(lk, next_due);
+		}
+	}
+
+	// Holds a lock file beside the sidecar for as long as it is read and rewritten, so that
+	// machines writing to the same share add to it in turn instead of dropping each other's tracks.
+	struct directory_lock
+	{
+		explicit directory_lock(std::wstring const& sidecar_path)
+			: handle(INVALID_HANDLE_VALUE)
+		{
+			std::wstring path = sidecar_path + L".lock";
+			for (int attempt = 0; attempt < 100; ++attempt)
+			{
+				handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+				if (handle != INVALID_HANDLE_VALUE || GetLastError() != ERROR_SHARING_VIOLATION)
+					break;
+				Sleep(50);
+			}
+		}
+
+		~directory_lock()
+		{
+			if (handle != INVALID_HANDLE_VALUE)
+				CloseHandle(handle);
+		}
+
+		bool is_held() const { return handle != INVALID_HANDLE_VALUE; }
+
+	private:
+		HANDLE handle;
+		directory_lock(directory_lock const&);
+		directory_lock& operator = (directory_lock const&);
+	};
+
+	bool sidecar_store::write_directory(std::string const& directory, std::vector<sidecar::entry> const& added)
+	{
+		std::wstring path = sidecar::path_for_directory(directory.c_str());
+		directory_lock lock(path);
+		if (!lock.is_held())
+			return false;
+
+		// Our own mapping would keep the old file from being replaced.
+		std::lock_guard<std::mutex> lk(mutex);
+		directories.erase(directory);
+
+		std::vector<sidecar::entry> entries;
+		{
+			sidecar::view existing;
+			if (existing.open(path))
+			{
+				entries.resize(existing.get_count());
+				for (size_t i = 0; i < entries.size(); ++i)
+					existing.get_entry(i, entries[i]);
+			}
+		}
+		// Later puts of a track replace earlier ones.
+		for (auto A = added.begin(); A != added.end(); ++A)
+		{
+			entries.erase(std::remove_if(entries.begin(), entries.end(), [&](sidecar::entry const& x)
+			{
+				return x.subsong == A->subsong && stricmp_utf8(x.name, A->name) == 0;
+			}), entries.end());
+			entries.push_back(*A);
+		}
+		return sidecar::write(path, entries);
+	}
+}
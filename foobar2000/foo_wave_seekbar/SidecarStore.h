@@ -0,0 +1,103 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "util/MappedFile.h"
+#include "waveform_sdk/Waveform.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wave
+{
+	namespace sidecar
+	{
+		/* Sidecar file, one per directory, little-endian:
+		 *   4 bytes magic "WSSC"
+		 *   4 bytes format version
+		 *   4 bytes entry count
+		 *   4 bytes reserved
+		 *   40 bytes per entry, sorted by file name (case-insensitive) and subsong:
+		 *     u32 name offset, u32 name length, u32 subsong,
+		 *     u32 data offset, u32 data size, u32 reserved,
+		 *     u64 track size, u64 track timestamp
+		 *   file names, UTF-8 and NUL-terminated
+		 *   signature v2 blobs, uncompressed so that they decode straight off the mapping
+		 */
+		char const* const file_name = "foo_wave_seekbar.wsc";
+		unsigned const format_version = 1;
+
+		struct entry
+		{
+			pfc::string8 name;
+			t_uint32 subsong;
+			t_filestats stats;
+			std::vector<char> data;
+		};
+
+		// Mapped sidecar file, validated on open.
+		struct view
+		{
+			view() : count(0) {}
+
+			bool open(std::wstring const& path);
+			bool find(char const* name, t_uint32 subsong, t_filestats& stats, void const*& data, size_t& size) const;
+			size_t get_count() const { return count; }
+			void get_entry(size_t i, entry& out) const;
+
+		private:
+			util::mapped_file file;
+			size_t count;
+		};
+
+		bool write(std::wstring const& path, std::vector<entry> entries);
+
+		// Splits a file:// location into its directory and file name.
+		bool split_location(char const* path, pfc::string8& directory, pfc::string8& name);
+		std::wstring path_for_directory(char const* directory);
+	}
+
+	// Writes are queued and made by a thread of the store's own, a directory at a time once
+	// no track in it has been put for a while, so that scanning a directory rewrites its
+	// sidecar once rather than once per track.
+	struct sidecar_store
+	{
+		sidecar_store();
+		~sidecar_store();
+
+		bool get(ref_ptr<waveform>& out, playable_location const& file, abort_callback& abort_cb);
+		bool has(playable_location const& file, abort_callback& abort_cb);
+		bool put(ref_ptr<waveform> const& in, playable_location const& file, t_filestats const& stats);
+
+		// Writes everything queued and stops the writer.
+		void shutdown();
+
+	private:
+		struct pending_directory
+		{
+			std::vector<sidecar::entry> entries;
+			std::chrono::steady_clock::time_point last_put;
+		};
+
+		bool find(playable_location const& file, abort_callback& abort_cb, void const*& data, size_t& size);
+		std::shared_ptr<sidecar::view> open_directory(pfc::string8 const& directory);
+		void writer_main();
+		bool write_directory(std::string const& directory, std::vector<sidecar::entry> const& added);
+
+		std::mutex mutex;
+		std::map<std::string, std::shared_ptr<sidecar::view>> directories;
+
+		std::mutex pending_mutex;
+		std::condition_variable pending_bump;
+		std::map<std::string, pending_directory> pending;
+		bool should_stop;
+		std::thread writer;
+	};
+}
@@ -0,0 +1,195 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Signature.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace wave
+{
+	namespace signature
+	{
+		static char const magic[4] = { 'W', 'S', 'v', '2' };
+		static size_t const fixed_header_size = 16;
+
+		template <typename T>
+		static void write_pod(std::vector<char>& out, T const& t)
+		{
+			char const* p = (char const*)&t;
+			out.insert(out.end(), p, p + sizeof(T));
+		}
+
+		template <typename T>
+		static T read_pod(char const* p)
+		{
+			T t;
+			std::memcpy(&t, p, sizeof(T));
+			return t;
+		}
+
+		static float finite_or_zero(float f)
+		{
+			return std::isfinite(f) ? f : 0.0f;
+		}
+
+		template <typename T>
+		static void quantize(std::vector<char>& out, float const* src, unsigned bucket_count, float peak, float low)
+		{
+			float const scale = peak > 0.0f ? 1.0f / peak : 0.0f;
+			float const range = (float)(std::numeric_limits<T>::max)();
+			for (unsigned i = 0; i < bucket_count; ++i)
+			{
+				float f = (std::max)(low, (std::min)(1.0f, finite_or_zero(src[i]) * scale));
+				write_pod(out, (T)std::floor(f * range + 0.5f));
+			}
+		}
+
+		template <typename T>
+		static void dequantize(float* dst, char const* src, unsigned bucket_count, float peak)
+		{
+			float const scale = peak / (float)(std::numeric_limits<T>::max)();
+			for (unsigned i = 0; i < bucket_count; ++i)
+			{
+				dst[i] = read_pod<T>(src + i*sizeof(T)) * scale;
+			}
+		}
+
+		void encode(planar_data const& in, quantization q, std::vector<char>& out)
+		{
+			unsigned const n = in.bucket_count;
+			out.clear();
+			out.insert(out.end(), magic, magic + 4);
+			out.push_back((char)format_version);
+			out.push_back((char)q);
+			out.push_back((char)in.channel_count);
+			out.push_back(0);
+			write_pod(out, (uint32_t)n);
+			write_pod(out, (uint32_t)in.channel_map);
+
+			std::vector<float> peaks(in.channel_count);
+			for (unsigned c = 0; c < in.channel_count; ++c)
+			{
+				float peak = 0.0f;
+				for (unsigned i = c*n; i < (c+1)*n; ++i)
+				{
+					peak = (std::max)(peak, std::fabs(finite_or_zero(in.minimum[i])));
+					peak = (std::max)(peak, std::fabs(finite_or_zero(in.maximum[i])));
+					peak = (std::max)(peak, finite_or_zero(in.rms[i]));
+				}
+				peaks[c] = peak;
+				write_pod(out, peak);
+			}
+
+			std::vector<float> const* fields[] = { &in.minimum, &in.maximum, &in.rms };
+			for (int f = 0; f < 3; ++f)
+			{
+				float const low = (f == 2) ? 0.0f : -1.0f;
+				for (unsigned c = 0; c < in.channel_count; ++c)
+				{
+					float const* src = fields[f]->data() + c*n;
+					if (q == quantization_8bit)
+					{
+						if (f == 2)
+							quantize<uint8_t>(out, src, n, peaks[c], low);
+						else
+							quantize<int8_t>(out, src, n, peaks[c], low);
+					}
+					else
+					{
+						if (f == 2)
+							quantize<uint16_t>(out, src, n, peaks[c], low);
+						else
+							quantize<int16_t>(out, src, n, peaks[c], low);
+					}
+				}
+			}
+		}
+
+		bool parse_layout(void const* src, size_t cb, layout& out)
+		{
+			char const* p = (char const*)src;
+			if (cb < fixed_header_size || !std::equal(magic, magic + 4, p))
+				return false;
+
+			unsigned version = (uint8_t)p[4];
+			unsigned bits = (uint8_t)p[5];
+			unsigned channel_count = (uint8_t)p[6];
+			uint32_t bucket_count = read_pod<uint32_t>(p + 8);
+			uint32_t channel_map = read_pod<uint32_t>(p + 12);
+
+			if (version != format_version || (bits != 8 && bits != 16))
+				return false;
+			if (channel_count == 0 || channel_count > 18 || bucket_count == 0 || bucket_count > (1 << 16))
+				return false;
+
+			out.bits = bits;
+			out.channel_count = channel_count;
+			out.bucket_count = bucket_count;
+			out.channel_map = channel_map;
+			out.field_size = (size_t)channel_count * bucket_count * (bits / 8);
+			out.peaks_offset = fixed_header_size;
+			out.data_offset = out.peaks_offset + channel_count * sizeof(float);
+			return cb == out.data_offset + 3 * out.field_size;
+		}
+
+		bool decode_into(void const* src, size_t cb, float* const* channels)
+		{
+			char const* p = (char const*)src;
+			layout l;
+			if (!parse_layout(src, cb, l))
+				return false;
+
+			unsigned const bits = l.bits, channel_count = l.channel_count, bucket_count = l.bucket_count;
+			size_t const sample_size = bits / 8;
+			for (int f = 0; f < 3; ++f)
+			{
+				for (unsigned c = 0; c < channel_count; ++c)
+				{
+					float peak = read_pod<float>(p + l.peaks_offset + c*sizeof(float));
+					char const* in = p + l.data_offset + f*l.field_size + c*bucket_count*sample_size;
+					float* dst = channels[f*channel_count + c];
+					if (bits == 8)
+					{
+						if (f == 2)
+							dequantize<uint8_t>(dst, in, bucket_count, peak);
+						else
+							dequantize<int8_t>(dst, in, bucket_count, peak);
+					}
+					else
+					{
+						if (f == 2)
+							dequantize<uint16_t>(dst, in, bucket_count, peak);
+						else
+							dequantize<int16_t>(dst, in, bucket_count, peak);
+					}
+				}
+			}
+			return true;
+		}
+
+		bool decode(void const* src, size_t cb, planar_data& out)
+		{
+			layout l;
+			if (!parse_layout(src, cb, l))
+				return false;
+
+			out.channel_count = l.channel_count;
+			out.bucket_count = l.bucket_count;
+			out.channel_map = l.channel_map;
+
+			std::vector<float*> channels;
+			std::vector<float>* fields[] = { &out.minimum, &out.maximum, &out.rms };
+			for (int f = 0; f < 3; ++f)
+			{
+				fields[f]->resize(l.channel_count * l.bucket_count);
+				for (unsigned c = 0; c < l.channel_count; ++c)
+					channels.push_back(fields[f]->data() + c*l.bucket_count);
+			}
+			return decode_into(src, cb, channels.data());
+		}
+	}
+}
@@ -0,0 +1,62 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace wave
+{
+	namespace signature
+	{
+		/* Signature v2 blob, little-endian:
+		 *   4 bytes magic "WSv2"
+		 *   1 byte  format version
+		 *   1 byte  quantization bits (8 or 16)
+		 *   1 byte  channel count
+		 *   1 byte  reserved
+		 *   4 bytes bucket count
+		 *   4 bytes channel map
+		 *   4 bytes float peak, per channel
+		 *   quantized minimum, maximum and rms fields, each channel-major
+		 *
+		 * Minimum and maximum are stored as signed fractions of the channel peak,
+		 * rms as an unsigned fraction of it.
+		 */
+		enum quantization
+		{
+			quantization_8bit = 8,
+			quantization_16bit = 16,
+		};
+
+		unsigned const format_version = 2;
+
+		// One run of bucket_count values per channel in each field.
+		struct planar_data
+		{
+			planar_data() : channel_count(0), bucket_count(0), channel_map(0) {}
+
+			unsigned channel_count, bucket_count, channel_map;
+			std::vector<float> minimum, maximum, rms;
+		};
+
+		// Where the parts of a blob are, for code that works on the quantized values directly.
+		struct layout
+		{
+			unsigned bits, channel_count, bucket_count, channel_map;
+			size_t peaks_offset, data_offset, field_size;
+		};
+
+		bool parse_layout(void const* src, size_t cb, layout& out);
+
+		void encode(planar_data const& in, quantization q, std::vector<char>& out);
+		bool decode(void const* src, size_t cb, planar_data& out);
+
+		// Dequantizes straight into the caller's buffers, 3 x channel_count of them holding
+		// bucket_count floats each: the minimum of every channel, then the maximum, then the rms.
+		bool decode_into(void const* src, size_t cb, float* const* channels);
+	}
+}
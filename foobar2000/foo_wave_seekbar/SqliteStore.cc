@@ -0,0 +1,935 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PchSeekbar.h"
+#include "SqliteStore.h"
+#include "waveform_sdk/WaveformImpl.h"
+#include "Envelope.h"
+#include "Pack.h"
+#include "Signature.h"
+#include "waveform_sdk/Optional.h"
+#include "util/Parallel.h"
+#include <chrono>
+#include <set>
+#include <thread>
+
+namespace wave
+{
+	// A location is kept as its directory, separator included, and the name within it.
+	// Each directory path is held once and rows refer to it by key, which keeps the
+	// unique index over file rows small.
+	static char const* const file_columns =
+		"fid INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+		"did INTEGER NOT NULL REFERENCES directory(did),"
+		"name TEXT NOT NULL,"
+		"subsong INTEGER NOT NULL,"
+		"content_key TEXT,"
+		"size INTEGER,"
+		"mtime INTEGER,"
+		"UNIQUE (did, name, subsong)";
+
+	static char const* split_location(char const* location, std::string& directory)
+	{
+		char const* separator = (std::max)(strrchr(location, '\\'), strrchr(location, '/'));
+		char const* name = separator ? separator + 1 : location;
+		directory.assign(location, name);
+		return name;
+	}
+
+	// The condition that bind_location fills in, on columns named with prefix.
+	static std::string location_condition(bool legacy, char const* prefix)
+	{
+		std::string p = prefix;
+		if (legacy)
+			return p + "location = ? || ? AND " + p + "subsong = ?";
+		return p + "did = ? AND " + p + "name = ? AND " + p + "subsong = ?";
+	}
+
+	sqlite_store::sqlite_store(pfc::string const& cache_filename)
+	{
+		{
+			sqlite3* p = 0;
+			sqlite3_open(cache_filename.get_ptr(), &p);
+			backing_db.reset(p, &sqlite3_close);
+		}
+
+		sqlite3_exec(
+			backing_db.get(),
+			"PRAGMA foreign_keys = ON",
+			0, 0, 0);
+
+		// Applies to new databases at once and to existing ones after their next full VACUUM,
+		// which compact runs. From then on compact_step frees pages a few at a time.
+		sqlite3_exec(
+			backing_db.get(),
+			"PRAGMA auto_vacuum = INCREMENTAL",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"CREATE TABLE IF NOT EXISTS directory ("
+			"did INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+			"path TEXT NOT NULL UNIQUE)",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			(std::string("CREATE TABLE IF NOT EXISTS file (") + file_columns + ")").c_str(),
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"CREATE TABLE IF NOT EXISTS wave ("
+			"fid INTEGER PRIMARY KEY NOT NULL,"
+			"min BLOB,"
+			"max BLOB,"
+			"rms BLOB,"
+			"FOREIGN KEY (fid) REFERENCES file(fid))",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"CREATE TABLE IF NOT EXISTS job ("
+			"jid INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+			"location TEXT NOT NULL,"
+			"subsong INTEGER NOT NULL,"
+			"user_submitted INTEGER,"
+			"UNIQUE (location, subsong))",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE wave ADD channels INT",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE wave ADD compression INT",
+			0, 0, 0);
+
+		// Format 2 rows keep all fields in one signature blob in "data", see Signature.h.
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE wave ADD format INT",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE wave ADD data BLOB",
+			0, 0, 0);
+
+		// Columns added to file tables from before the directory table, ahead of their migration.
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE file ADD content_key TEXT",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE file ADD size INTEGER",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"ALTER TABLE file ADD mtime INTEGER",
+			0, 0, 0);
+
+		// Moving the rows over can take a while on a large library, so it is left to upgrade.
+		legacy_locations = !!prepare_statement("SELECT location FROM file LIMIT 0");
+		migration_over = !legacy_locations;
+
+		create_file_trigger_and_index();
+	}
+
+	void sqlite_store::create_file_trigger_and_index()
+	{
+		sqlite3_exec(
+			backing_db.get(),
+			"DROP TRIGGER resonance_cascade",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"CREATE TRIGGER resonance_cascade BEFORE DELETE ON file BEGIN DELETE FROM wave WHERE wave.fid = OLD.fid; END",
+			0, 0, 0);
+
+		sqlite3_exec(
+			backing_db.get(),
+			"CREATE INDEX IF NOT EXISTS file_content_key ON file (content_key, subsong)",
+			0, 0, 0);
+	}
+
+	void sqlite_store::upgrade(abort_callback& abort_cb)
+	{
+		std::lock_guard<std::mutex> lk(write_mutex);
+		if (!migration_over)
+			migrate_locations(abort_cb);
+		migration_over = true;
+		migration_done.notify_all();
+	}
+
+	// Takes write_mutex once the file table is in its final layout, or failed to get there.
+	std::unique_lock<std::mutex> sqlite_store::lock_writes()
+	{
+		std::unique_lock<std::mutex> lk(write_mutex);
+		migration_done.wait(lk, [this]{ return migration_over; });
+		return lk;
+	}
+
+	// Called with write_mutex held. Reads carry on against the old table meanwhile, as it
+	// stays in place until the transaction drops it.
+	void sqlite_store::migrate_locations(abort_callback& abort_cb)
+	{
+		// The file table is rebuilt as the SQLite documentation prescribes for schema changes.
+		// Every fid is kept, so the wave rows stay attached.
+		auto start = std::chrono::steady_clock::now();
+		t_int64 before = query_pragma("page_count") * query_pragma("page_size");
+		size_t count = 0;
+		sqlite3_exec(backing_db.get(), "PRAGMA foreign_keys = OFF", 0, 0, 0);
+		sqlite3_exec(backing_db.get(), "BEGIN", 0, 0, 0);
+		bool ok = SQLITE_OK == sqlite3_exec(backing_db.get(),
+			(std::string("CREATE TABLE file_by_directory (") + file_columns + ")").c_str(), 0, 0, 0);
+		if (ok)
+		{
+			std::lock_guard<std::mutex> lk(directory_mutex);
+			auto select = prepare_statement(
+				"SELECT fid, location, subsong, content_key, size, mtime FROM file");
+			auto insert = prepare_statement(
+				"INSERT INTO file_by_directory (fid, did, name, subsong, content_key, size, mtime) "
+				"VALUES (?, ?, ?, ?, ?, ?, ?)");
+			std::string directory;
+			while (ok && !abort_cb.is_aborting() && SQLITE_ROW == sqlite3_step(select.get()))
+			{
+				char const* location = (char const*)sqlite3_column_text(select.get(), 1);
+				char const* name = split_location(location, directory);
+				sqlite3_int64 did = find_directory_locked(directory, true);
+				sqlite3_bind_value(insert.get(), 1, sqlite3_column_value(select.get(), 0));
+				sqlite3_bind_int64(insert.get(), 2, did);
+				sqlite3_bind_text(insert.get(), 3, name, -1, SQLITE_STATIC);
+				for (int col = 2; col < 6; ++col)
+					sqlite3_bind_value(insert.get(), col + 2, sqlite3_column_value(select.get(), col));
+				ok = did && SQLITE_DONE == sqlite3_step(insert.get());
+				sqlite3_reset(insert.get());
+				++count;
+			}
+		}
+		bool aborted = abort_cb.is_aborting();
+		ok = ok && !aborted &&
+			SQLITE_OK == sqlite3_exec(backing_db.get(), "DROP TABLE file", 0, 0, 0) &&
+			SQLITE_OK == sqlite3_exec(backing_db.get(), "ALTER TABLE file_by_directory RENAME TO file", 0, 0, 0);
+		if (ok)
+			create_file_trigger_and_index();
+		ok = end_transaction(ok);
+		sqlite3_exec(backing_db.get(), "PRAGMA foreign_keys = ON", 0, 0, 0);
+
+		if (!ok)
+		{
+			// The directory keys handed out were rolled back along with everything else.
+			std::lock_guard<std::mutex> lk(directory_mutex);
+			directory_ids.clear();
+			if (aborted)
+				console::info("Waveform cache: moving the database to the directory table was interrupted, it resumes on the next start.");
+			else
+				console::info("Waveform cache: could not move the database to the directory table, it stays as it was.");
+			return;
+		}
+		legacy_locations = false;
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		t_int64 after = query_pragma("page_count") * query_pragma("page_size");
+		console::formatter() << "Waveform cache: moved " << count << " locations to the directory table in "
+			<< pfc::format_float(ms, 0, 0) << " ms, the database went from " << before << " to " << after
+			<< " bytes and shrinks further on compaction.";
+	}
+
+	sqlite3_int64 sqlite_store::find_directory_locked(std::string const& path, bool create)
+	{
+		auto I = directory_ids.find(path);
+		if (I != directory_ids.end())
+			return I->second;
+
+		if (create)
+		{
+			auto insert = prepare_statement("INSERT OR IGNORE INTO directory (path) VALUES (?)");
+			sqlite3_bind_text(insert.get(), 1, path.c_str(), (int)path.size(), SQLITE_STATIC);
+			sqlite3_step(insert.get());
+		}
+		auto select = prepare_statement("SELECT did FROM directory WHERE path = ?");
+		sqlite3_bind_text(select.get(), 1, path.c_str(), (int)path.size(), SQLITE_STATIC);
+		if (SQLITE_ROW != sqlite3_step(select.get()))
+			return 0;
+		sqlite3_int64 did = sqlite3_column_int64(select.get(), 0);
+		directory_ids[path] = did;
+		return did;
+	}
+
+	bool sqlite_store::resolve_locked(playable_location const& file, bool create, stored_location& out)
+	{
+		out.legacy = false;
+		out.name = split_location(file.get_path(), out.directory);
+		out.subsong = file.get_subsong();
+		out.did = find_directory_locked(out.directory, create);
+		return out.did != 0;
+	}
+
+	bool sqlite_store::resolve(playable_location const& file, stored_location& out)
+	{
+		if (legacy_locations)
+		{
+			out.legacy = true;
+			out.did = 0;
+			out.name = split_location(file.get_path(), out.directory);
+			out.subsong = file.get_subsong();
+			return true;
+		}
+		std::lock_guard<std::mutex> lk(directory_mutex);
+		return resolve_locked(file, false, out);
+	}
+
+	void sqlite_store::bind_location(sqlite3_stmt* stmt, int first, stored_location const& loc)
+	{
+		if (loc.legacy)
+			sqlite3_bind_text(stmt, first, loc.directory.c_str(), (int)loc.directory.size(), SQLITE_STATIC);
+		else
+			sqlite3_bind_int64(stmt, first, loc.did);
+		sqlite3_bind_text(stmt, first + 1, loc.name, -1, SQLITE_STATIC);
+		sqlite3_bind_int(stmt, first + 2, loc.subsong);
+	}
+
+	// Commits the open transaction if ok, otherwise or if that fails rolls it back.
+	bool sqlite_store::end_transaction(bool ok)
+	{
+		if (ok && SQLITE_OK == sqlite3_exec(backing_db.get(), "COMMIT", 0, 0, 0))
+			return true;
+		sqlite3_exec(backing_db.get(), "ROLLBACK", 0, 0, 0);
+		return false;
+	}
+
+	sqlite_store::~sqlite_store()
+	{
+	}
+
+	bool sqlite_store::has(playable_location const& file)
+	{
+		stored_location loc;
+		if (!resolve(file, loc))
+			return false;
+
+		auto stmt = prepare_statement(
+			"SELECT 1 "
+			"FROM file as f, wave AS w "
+			"WHERE " + location_condition(loc.legacy, "f.") + " AND f.fid = w.fid");
+
+		bind_location(stmt.get(), 1, loc);
+
+		if (SQLITE_ROW == sqlite3_step(stmt.get())) {
+			return true;
+		}
+		return false;
+	}
+
+	void sqlite_store::remove(playable_location const& file)
+	{
+		auto lk = lock_writes();
+		stored_location loc;
+		if (!resolve(file, loc))
+			return;
+
+		auto stmt = prepare_statement(
+			"DELETE FROM file WHERE " + location_condition(loc.legacy, ""));
+		bind_location(stmt.get(), 1, loc);
+		sqlite3_step(stmt.get());
+	}
+
+	bool sqlite_store::get(ref_ptr<waveform>& out, playable_location const& file)
+	{
+		out.reset();
+		stored_location loc;
+		if (!resolve(file, loc))
+			return false;
+
+		wave::optional<int> compression;
+		wave::optional<int> format;
+		{
+			auto stmt = prepare_statement(
+				"SELECT w.min, w.max, w.rms, w.channels, w.compression, w.format, w.data "
+				"FROM file AS f NATURAL JOIN wave AS w "
+				"WHERE " + location_condition(loc.legacy, "f."));
+
+			bind_location(stmt.get(), 1, loc);
+
+			if (SQLITE_ROW != sqlite3_step(stmt.get())) {
+				return false;
+			}
+		
+			wave::optional<int> channels;
+
+			if (sqlite3_column_type(stmt.get(), 3) != SQLITE_NULL)
+				channels = sqlite3_column_int(stmt.get(), 3);
+			if (sqlite3_column_type(stmt.get(), 4) != SQLITE_NULL)
+				compression = sqlite3_column_int(stmt.get(), 4);
+			if (sqlite3_column_type(stmt.get(), 5) != SQLITE_NULL)
+				format = sqlite3_column_int(stmt.get(), 5);
+
+			if (compression.valid() && *compression > compression_scheme::envelope)
+				return false;
+
+			if (format.valid() && *format > (int)signature::format_version)
+				return false;
+
+			if (format.valid() && *format == (int)signature::format_version)
+			{
+				void const* data = sqlite3_column_blob(stmt.get(), 6);
+				t_size count = sqlite3_column_bytes(stmt.get(), 6);
+
+				// The blob is decoded once into scratch and dequantized once into the channels.
+				std::vector<char> dst;
+				bool ok = false;
+				if (compression.valid() && *compression == compression_scheme::envelope)
+				{
+					dst.resize(pack::envelope_unpacked_size(data, count));
+					ok = !dst.empty() && pack::envelope_unpack_into(data, count, dst.data(), dst.size());
+				}
+				else if (compression.valid() && *compression == compression_scheme::lzma)
+				{
+					dst.resize(pack::lzma_unpacked_size(data, count));
+					ok = !dst.empty() && pack::lzma_unpack_into(data, count, dst.data(), dst.size());
+				}
+				else if (compression.valid() && *compression == compression_scheme::zlib)
+					ok = pack::z_unpack(data, count, std::back_inserter(dst));
+
+				if (ok)
+					out = signature_to_waveform(dst.data(), dst.size());
+				if (!out.is_valid())
+					remove(file); // it's corrupt, and thus useless
+				return out.is_valid();
+			}
+
+			unsigned channel_count = channels.valid() ? audio_chunk::g_count_channels(*channels) : 1;
+
+			if (compression.valid() && *compression < 0 || channels.valid() && *channels < 0 || channel_count == 0 || channel_count > 18) {
+				remove(file); // corrupt entry
+				return false;
+			}
+
+			ref_ptr<waveform_impl> w(new waveform_impl(channel_count, 2048, channels.valid() ? *channels : audio_chunk::channel_config_mono));
+			auto channels_out = channel_buffers(**w);
+			std::vector<char> scratch;
+			auto clear_and_set = [&stmt, compression, channel_count, &channels_out, &scratch](int f, int col) -> bool
+			{
+				void const* data = sqlite3_column_blob(stmt.get(), col);
+				t_size count = sqlite3_column_bytes(stmt.get(), col);
+				size_t const field_cb = channel_count * 2048 * sizeof(float);
+
+				char const* fs = (char const*)data;
+				if (compression.valid())
+				{
+					scratch.resize(field_cb);
+					bool ok = false;
+					switch (*compression) {
+					case compression_scheme::zlib: ok = pack::z_unpack_into(data, count, scratch.data(), field_cb); break;
+					case compression_scheme::lzma: ok = pack::lzma_unpack_into(data, count, scratch.data(), field_cb); break;
+					default: return false; // unknown compression scheme
+					}
+					if (!ok)
+						return false;
+					fs = scratch.data();
+				}
+				else if (count != field_cb)
+				{
+					return false;
+				}
+
+				for (unsigned c = 0; c < channel_count; ++c)
+				{
+					std::memcpy(channels_out[f*channel_count + c], fs + 2048 * c * sizeof(float), 2048 * sizeof(float));
+				}
+				return true;
+			};
+
+			if (clear_and_set(0, 0) &&
+				clear_and_set(1, 1) &&
+				clear_and_set(2, 2))
+			{
+				out = w;
+			}
+			else
+			{
+				remove(file); // it's corrupt, and thus useless
+			}
+		}
+
+		// Legacy rows are read as they are and stay so until the track is scanned again.
+		return out.is_valid();
+	}
+
+	void sqlite_store::put(ref_ptr<waveform> const& w, playable_location const& file)
+	{
+		std::vector<encoded_waveform> in(1);
+		in[0].location = file;
+		in[0].channel_map = w->get_channel_map();
+		signature::planar_data planar;
+		waveform_to_planar(w, planar);
+		signature::encode(planar, preferred_quantization(), in[0].signature);
+		put_all(in);
+	}
+
+	void sqlite_store::has_all(std::vector<playable_location_impl> const& files, std::vector<bool>& out)
+	{
+		// With integer directory keys every probe is a short index walk, so one statement
+		// serves the whole batch.
+		out.assign(files.size(), false);
+		bool legacy = legacy_locations;
+		auto stmt = prepare_statement(
+			"SELECT 1 "
+			"FROM file as f, wave AS w "
+			"WHERE " + location_condition(legacy, "f.") + " AND f.fid = w.fid");
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			stored_location loc;
+			if (!resolve(files[i], loc) || loc.legacy != legacy)
+				continue;
+			bind_location(stmt.get(), 1, loc);
+			out[i] = SQLITE_ROW == sqlite3_step(stmt.get());
+			sqlite3_reset(stmt.get());
+		}
+	}
+
+	void sqlite_store::put_all(std::vector<encoded_waveform> const& in)
+	{
+		// Packing dominates the cost of a put, so batches are packed on all cores. Blobs the
+		// envelope codec does not understand still go in with LZMA.
+		std::vector<std::vector<char>> packed(in.size());
+		std::vector<int> schemes(in.size(), compression_scheme::envelope);
+		util::parallel_for(0, in.size(), (std::max)(1u, std::thread::hardware_concurrency()), [&](size_t i)
+		{
+			try
+			{
+				auto const& sig = in[i].signature;
+				if (pack::envelope_pack(sig.data(), sig.size(), packed[i]))
+					return;
+				packed[i].clear();
+				schemes[i] = compression_scheme::lzma;
+				if (!pack::lzma_pack(sig.data(), sig.size(), std::back_inserter(packed[i])))
+					packed[i].clear();
+			}
+			catch (std::exception&)
+			{
+				packed[i].clear();
+			}
+		});
+
+		auto file_stmt = prepare_statement(
+			"INSERT OR IGNORE INTO file (did, name, subsong) "
+			"VALUES (?, ?, ?)");
+		auto wave_stmt = prepare_statement(
+			"REPLACE INTO wave (fid, min, max, rms, channels, compression, format, data) "
+			"SELECT f.fid, NULL, NULL, NULL, ?, ?, ?, ? "
+			"FROM file AS f "
+			"WHERE f.did = ? AND f.name = ? AND f.subsong = ?");
+
+		auto write_lk = lock_writes();
+		std::lock_guard<std::mutex> lk(directory_mutex);
+		bool ok = !legacy_locations && SQLITE_OK == sqlite3_exec(backing_db.get(), "BEGIN", 0, 0, 0);
+		for (size_t i = 0; ok && i < in.size(); ++i)
+		{
+			stored_location loc;
+			if (packed[i].empty() || !resolve_locked(in[i].location, true, loc))
+				continue;
+			bind_location(file_stmt.get(), 1, loc);
+			ok = SQLITE_DONE == sqlite3_step(file_stmt.get());
+			sqlite3_reset(file_stmt.get());
+
+			sqlite3_bind_int(wave_stmt.get(), 1, in[i].channel_map);
+			sqlite3_bind_int(wave_stmt.get(), 2, schemes[i]);
+			sqlite3_bind_int(wave_stmt.get(), 3, signature::format_version);
+			sqlite3_bind_blob(wave_stmt.get(), 4, packed[i].data(), packed[i].size(), SQLITE_STATIC);
+			bind_location(wave_stmt.get(), 5, loc);
+			ok = ok && SQLITE_DONE == sqlite3_step(wave_stmt.get());
+			sqlite3_reset(wave_stmt.get());
+		}
+		if (!end_transaction(ok))
+		{
+			// The directory keys handed out may have been rolled back with the rows.
+			directory_ids.clear();
+			console::formatter() << "Waveform cache: could not store " << in.size() << " waveforms.";
+		}
+	}
+
+	void sqlite_store::set_content_key(playable_location const& file, char const* content_key)
+	{
+		auto lk = lock_writes();
+		stored_location loc;
+		if (!resolve(file, loc))
+			return;
+
+		auto stmt = prepare_statement(
+			"UPDATE file SET content_key = ? "
+			"WHERE " + location_condition(loc.legacy, ""));
+		sqlite3_bind_text(stmt.get(), 1, content_key, -1, SQLITE_STATIC);
+		bind_location(stmt.get(), 2, loc);
+		sqlite3_step(stmt.get());
+	}
+
+	bool sqlite_store::has_content_key(playable_location const& file)
+	{
+		stored_location loc;
+		if (!resolve(file, loc))
+			return false;
+
+		auto stmt = prepare_statement(
+			"SELECT 1 FROM file "
+			"WHERE " + location_condition(loc.legacy, "") + " AND content_key IS NOT NULL");
+		bind_location(stmt.get(), 1, loc);
+		return SQLITE_ROW == sqlite3_step(stmt.get());
+	}
+
+	// The first row with a waveform and the content key, false if there is none.
+	static bool find_content_row(sqlite3_stmt* stmt, char const* content_key, t_uint32 subsong, sqlite3_int64& fid, pfc::string8& location)
+	{
+		sqlite3_bind_text(stmt, 1, content_key, -1, SQLITE_STATIC);
+		sqlite3_bind_int(stmt, 2, subsong);
+		if (SQLITE_ROW != sqlite3_step(stmt))
+			return false;
+		fid = sqlite3_column_int64(stmt, 0);
+		location = (char const*)sqlite3_column_text(stmt, 1);
+		return true;
+	}
+
+	static char const* const find_content_query =
+		"SELECT f.fid, d.path || f.name "
+		"FROM file AS f, wave AS w, directory AS d "
+		"WHERE f.content_key = ? AND f.subsong = ? AND f.fid = w.fid AND f.did = d.did "
+		"LIMIT 1";
+
+	static char const* const find_legacy_content_query =
+		"SELECT f.fid, f.location "
+		"FROM file AS f, wave AS w "
+		"WHERE f.content_key = ? AND f.subsong = ? AND f.fid = w.fid "
+		"LIMIT 1";
+
+	bool sqlite_store::find_content(char const* content_key, t_uint32 subsong, pfc::string8& original)
+	{
+		sqlite3_int64 fid;
+		auto stmt = prepare_statement(legacy_locations ? find_legacy_content_query : find_content_query);
+		return find_content_row(stmt.get(), content_key, subsong, fid, original);
+	}
+
+	bool sqlite_store::relink(playable_location const& file, char const* content_key, bool original_exists)
+	{
+		auto write_lk = lock_writes();
+		if (legacy_locations)
+			return false;
+		sqlite3_int64 old_fid;
+		pfc::string8 old_location;
+		if (!find_content_row(prepare_statement(find_content_query).get(), content_key, file.get_subsong(), old_fid, old_location))
+			return false;
+
+		std::lock_guard<std::mutex> lk(directory_mutex);
+		stored_location loc;
+		if (!resolve_locked(file, true, loc))
+			return false;
+
+		bool ok = SQLITE_OK == sqlite3_exec(backing_db.get(), "BEGIN", 0, 0, 0);
+		if (!original_exists)
+		{
+			// A moved file takes its row along.
+			auto stmt = prepare_statement(
+				"DELETE FROM file WHERE did = ? AND name = ? AND subsong = ?");
+			bind_location(stmt.get(), 1, loc);
+			ok = ok && SQLITE_DONE == sqlite3_step(stmt.get());
+
+			stmt = prepare_statement(
+				"UPDATE file SET did = ?, name = ? WHERE fid = ?");
+			sqlite3_bind_int64(stmt.get(), 1, loc.did);
+			sqlite3_bind_text(stmt.get(), 2, loc.name, -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt.get(), 3, old_fid);
+			ok = ok && SQLITE_DONE == sqlite3_step(stmt.get());
+		}
+		else
+		{
+			// A copied file gets a copy of the data.
+			auto stmt = prepare_statement(
+				"INSERT OR IGNORE INTO file (did, name, subsong) "
+				"VALUES (?, ?, ?)");
+			bind_location(stmt.get(), 1, loc);
+			ok = ok && SQLITE_DONE == sqlite3_step(stmt.get());
+
+			stmt = prepare_statement(
+				"REPLACE INTO wave (fid, min, max, rms, channels, compression, format, data) "
+				"SELECT f.fid, w.min, w.max, w.rms, w.channels, w.compression, w.format, w.data "
+				"FROM file AS f, wave AS w "
+				"WHERE f.did = ? AND f.name = ? AND f.subsong = ? AND w.fid = ?");
+			bind_location(stmt.get(), 1, loc);
+			sqlite3_bind_int64(stmt.get(), 4, old_fid);
+			ok = ok && SQLITE_DONE == sqlite3_step(stmt.get());
+
+			stmt = prepare_statement(
+				"UPDATE file SET content_key = ? "
+				"WHERE did = ? AND name = ? AND subsong = ?");
+			sqlite3_bind_text(stmt.get(), 1, content_key, -1, SQLITE_STATIC);
+			bind_location(stmt.get(), 2, loc);
+			ok = ok && SQLITE_DONE == sqlite3_step(stmt.get());
+		}
+		if (!end_transaction(ok))
+		{
+			directory_ids.clear();
+			return false;
+		}
+		return true;
+	}
+
+	void sqlite_store::set_file_stats(playable_location const& file, t_filestats const& stats)
+	{
+		auto lk = lock_writes();
+		stored_location loc;
+		if (!resolve(file, loc))
+			return;
+
+		auto stmt = prepare_statement(
+			"UPDATE file SET size = ?, mtime = ? "
+			"WHERE " + location_condition(loc.legacy, ""));
+		sqlite3_bind_int64(stmt.get(), 1, (sqlite3_int64)stats.m_size);
+		sqlite3_bind_int64(stmt.get(), 2, (sqlite3_int64)stats.m_timestamp);
+		bind_location(stmt.get(), 3, loc);
+		sqlite3_step(stmt.get());
+	}
+
+	bool sqlite_store::get_file_stats(playable_location const& file, t_filestats& out)
+	{
+		stored_location loc;
+		if (!resolve(file, loc))
+			return false;
+
+		auto stmt = prepare_statement(
+			"SELECT size, mtime FROM file "
+			"WHERE " + location_condition(loc.legacy, "") + " AND size IS NOT NULL AND mtime IS NOT NULL");
+		bind_location(stmt.get(), 1, loc);
+		if (SQLITE_ROW != sqlite3_step(stmt.get()))
+			return false;
+		out.m_size = (t_filesize)sqlite3_column_int64(stmt.get(), 0);
+		out.m_timestamp = (t_filetimestamp)sqlite3_column_int64(stmt.get(), 1);
+		return true;
+	}
+
+	void sqlite_store::get_jobs(std::deque<job>& out)
+	{
+		auto stmt = prepare_statement(
+			"SELECT location, subsong, user_submitted FROM job ORDER BY jid");
+
+		out.clear();
+		while (SQLITE_ROW == sqlite3_step(stmt.get()))
+		{
+			char const* loc = (char const*)sqlite3_column_text(stmt.get(), 0);
+			t_uint32 sub = (t_uint32)sqlite3_column_int(stmt.get(), 1);
+			bool user = !!sqlite3_column_int(stmt.get(), 2);
+			out.push_back(make_job(playable_location_impl(loc, sub), user));
+		}
+	}
+
+	void sqlite_store::put_jobs(std::deque<job> const& jobs)
+	{
+		std::lock_guard<std::mutex> lk(write_mutex);
+		bool ok = SQLITE_OK == sqlite3_exec(backing_db.get(), "BEGIN", 0, 0, 0) &&
+			SQLITE_OK == sqlite3_exec(backing_db.get(), "DELETE FROM job", 0, 0, 0);
+		auto stmt = prepare_statement(
+			"INSERT INTO job (location, subsong, user_submitted) "
+			"VALUES (?, ?, ?)");
+
+		for (size_t i = 0; ok && i < jobs.size(); ++i)
+		{
+			auto& j = jobs[i];
+			sqlite3_bind_text(stmt.get(), 1, j.loc.get_path(), -1, SQLITE_STATIC);
+			sqlite3_bind_int(stmt.get(), 2, j.loc.get_subsong());
+			sqlite3_bind_int(stmt.get(), 3, j.user);
+			ok = SQLITE_DONE == sqlite3_step(stmt.get());
+			sqlite3_reset(stmt.get());
+		}
+		if (!end_transaction(ok))
+			console::formatter() << "Waveform cache: could not save the " << jobs.size() << " pending jobs.";
+	}
+
+	void sqlite_store::remove_all(std::vector<playable_location_impl> const& files)
+	{
+		auto lk = lock_writes();
+		bool ok = SQLITE_OK == sqlite3_exec(backing_db.get(), "BEGIN", 0, 0, 0);
+		auto stmt = prepare_statement(
+			"DELETE FROM file WHERE " + location_condition(legacy_locations, ""));
+		for (auto I = files.begin(); ok && I != files.end(); ++I)
+		{
+			stored_location loc;
+			if (!resolve(*I, loc))
+				continue;
+			bind_location(stmt.get(), 1, loc);
+			ok = SQLITE_DONE == sqlite3_step(stmt.get());
+			sqlite3_reset(stmt.get());
+		}
+		if (!end_transaction(ok))
+			console::formatter() << "Waveform cache: could not remove " << files.size() << " waveforms.";
+	}
+
+	void sqlite_store::compact()
+	{
+		auto lk = lock_writes();
+		vacuum_locked();
+	}
+
+	// Rewrites the whole database with write_mutex held and reports how that went, returning
+	// the bytes freed. VACUUM fails while any statement on the connection is running.
+	t_uint64 sqlite_store::vacuum_locked()
+	{
+		auto start = std::chrono::steady_clock::now();
+		t_int64 before = query_pragma("page_count") * query_pragma("page_size");
+		{
+			// Directories are left behind when their last file goes, as puts may be about to use them.
+			std::lock_guard<std::mutex> lk(directory_mutex);
+			sqlite3_exec(backing_db.get(), "DELETE FROM directory WHERE did NOT IN (SELECT did FROM file)", 0, 0, 0);
+			directory_ids.clear();
+		}
+		if (SQLITE_OK != sqlite3_exec(backing_db.get(), "VACUUM", 0, 0, 0))
+		{
+			console::formatter() << "Waveform cache: could not compact the database: " << sqlite3_errmsg(backing_db.get());
+			return 0;
+		}
+		t_int64 after = query_pragma("page_count") * query_pragma("page_size");
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		console::formatter() << "Waveform cache: compacted the database from " << before << " to " << after
+			<< " bytes in " << pfc::format_float(ms, 0, 0) << " ms.";
+		return after < before ? (t_uint64)(before - after) : 0;
+	}
+
+	t_uint64 sqlite_store::compact_step(t_uint64 max_bytes)
+	{
+		enum { auto_vacuum_incremental = 2 };
+		// Databases made before incremental vacuum only switch over with the full VACUUM of
+		// an explicit compaction, which is left to the user as it rewrites the whole file.
+		if (query_pragma("auto_vacuum") != auto_vacuum_incremental)
+			return 0;
+
+		t_int64 page_size = query_pragma("page_size");
+		t_int64 free_before = query_pragma("freelist_count");
+		if (page_size <= 0 || free_before <= 0)
+			return 0;
+
+		t_int64 pages = (std::max)((t_int64)1, (t_int64)max_bytes / page_size);
+		pfc::string8 sql;
+		sql << "PRAGMA incremental_vacuum(" << pages << ")";
+		{
+			auto lk = lock_writes();
+			if (SQLITE_OK != sqlite3_exec(backing_db.get(), sql, 0, 0, 0))
+				return 0;
+		}
+
+		t_int64 free_after = query_pragma("freelist_count");
+		return free_after < free_before ? (t_uint64)((free_before - free_after) * page_size) : 0;
+	}
+
+	void sqlite_store::get_statistics(store_statistics& out)
+	{
+		out.backend = "sqlite";
+		char const* tables[] = { "directory", "file", "wave", "job" };
+		for (auto name : tables)
+		{
+			auto stmt = prepare_statement(std::string("SELECT count(*) FROM ") + name);
+			store_statistics::entry e = { name, 0, 0 };
+			if (SQLITE_ROW == sqlite3_step(stmt.get()))
+				e.count = sqlite3_column_int64(stmt.get(), 0);
+			out.tables.push_back(e);
+		}
+
+		auto stmt = prepare_statement(
+			"SELECT compression, format, count(*), "
+			"total(length(data)) + total(length(min)) + total(length(max)) + total(length(rms)) "
+			"FROM wave GROUP BY compression, format");
+		while (SQLITE_ROW == sqlite3_step(stmt.get()))
+		{
+			pfc::string8 name;
+			if (sqlite3_column_type(stmt.get(), 1) == SQLITE_NULL)
+				name << "float planes";
+			else
+				name << "signature v" << sqlite3_column_int(stmt.get(), 1);
+			name << ", ";
+			if (sqlite3_column_type(stmt.get(), 0) == SQLITE_NULL)
+				name << "uncompressed";
+			else switch (sqlite3_column_int(stmt.get(), 0))
+			{
+			case compression_scheme::zlib: name << "zlib"; break;
+			case compression_scheme::lzma: name << "lzma"; break;
+			case compression_scheme::envelope: name << "envelope"; break;
+			default: name << "scheme " << sqlite3_column_int(stmt.get(), 0); break;
+			}
+			store_statistics::entry e = { name.get_ptr(), (t_uint64)sqlite3_column_int64(stmt.get(), 2),
+				(t_uint64)sqlite3_column_double(stmt.get(), 3) };
+			out.encodings.push_back(e);
+		}
+
+		t_int64 page_size = query_pragma("page_size");
+		out.file_bytes = query_pragma("page_count") * page_size;
+		out.free_bytes = query_pragma("freelist_count") * page_size;
+	}
+
+	void sqlite_store::get_all(pfc::list_t<playable_location_impl>& out)
+	{
+		auto stmt = prepare_statement(legacy_locations ?
+			"SELECT location, subsong FROM file ORDER BY location, subsong" :
+			"SELECT d.path || f.name, f.subsong "
+			"FROM file AS f, directory AS d "
+			"WHERE f.did = d.did "
+			"ORDER BY d.path, f.name, f.subsong");
+
+		out.remove_all();
+		while (SQLITE_ROW == sqlite3_step(stmt.get()))
+		{
+			char const* loc = (char const*)sqlite3_column_text(stmt.get(), 0);
+			t_uint32 sub = (t_uint32)sqlite3_column_int(stmt.get(), 1);
+			out.add_item(playable_location_impl(loc, sub));
+		}
+	}
+
+	void sqlite_store::get_all_stamped(std::vector<stamped_location>& out)
+	{
+		auto stmt = prepare_statement(legacy_locations ?
+			"SELECT location, subsong, size, mtime, content_key IS NOT NULL "
+			"FROM file ORDER BY location, subsong" :
+			"SELECT d.path || f.name, f.subsong, f.size, f.mtime, f.content_key IS NOT NULL "
+			"FROM file AS f, directory AS d "
+			"WHERE f.did = d.did "
+			"ORDER BY d.path, f.name, f.subsong");
+
+		out.clear();
+		while (SQLITE_ROW == sqlite3_step(stmt.get()))
+		{
+			stamped_location entry;
+			char const* loc = (char const*)sqlite3_column_text(stmt.get(), 0);
+			t_uint32 sub = (t_uint32)sqlite3_column_int(stmt.get(), 1);
+			entry.location = playable_location_impl(loc, sub);
+			entry.stats = filestats_invalid;
+			if (sqlite3_column_type(stmt.get(), 2) != SQLITE_NULL && sqlite3_column_type(stmt.get(), 3) != SQLITE_NULL)
+			{
+				entry.stats.m_size = (t_filesize)sqlite3_column_int64(stmt.get(), 2);
+				entry.stats.m_timestamp = (t_filetimestamp)sqlite3_column_int64(stmt.get(), 3);
+			}
+			entry.has_content_key = sqlite3_column_int(stmt.get(), 4) != 0;
+			out.push_back(entry);
+		}
+	}
+
+	t_int64 sqlite_store::query_pragma(char const* name)
+	{
+		auto stmt = prepare_statement(std::string("PRAGMA ") + name);
+		if (SQLITE_ROW != sqlite3_step(stmt.get()))
+			return 0;
+		return sqlite3_column_int64(stmt.get(), 0);
+	}
+
+	std::shared_ptr<sqlite3_stmt> sqlite_store::prepare_statement(std::string const& query)
+	{
+		sqlite3_stmt* p = 0;
+		sqlite3_prepare_v2(
+			backing_db.get(),
+			query.c_str(),
+			query.size(), &p, 0);
+		return std::shared_ptr<sqlite3_stmt>(p, &sqlite3_finalize);
+	}
+}
@@ -0,0 +1,89 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "BackingStore.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace wave
+{
+	struct sqlite_store : backing_store
+	{
+		explicit sqlite_store(pfc::string const& cache_filename);
+		~sqlite_store();
+
+		bool has(playable_location const& file) override;
+		void remove(playable_location const& file) override;
+		bool get(ref_ptr<waveform>& out, playable_location const& file) override;
+		void put(ref_ptr<waveform> const& in, playable_location const& file) override;
+		void has_all(std::vector<playable_location_impl> const& files, std::vector<bool>& out) override;
+		void put_all(std::vector<encoded_waveform> const& in) override;
+		void set_content_key(playable_location const& file, char const* content_key) override;
+		bool has_content_key(playable_location const& file) override;
+		bool keeps_content_keys() override { return true; }
+		bool find_content(char const* content_key, t_uint32 subsong, pfc::string8& original) override;
+		bool relink(playable_location const& file, char const* content_key, bool original_exists) override;
+		void set_file_stats(playable_location const& file, t_filestats const& stats) override;
+		bool get_file_stats(playable_location const& file, t_filestats& out) override;
+		void remove_all(std::vector<playable_location_impl> const& files) override;
+		void compact() override;
+		t_uint64 compact_step(t_uint64 max_bytes) override;
+		void upgrade(abort_callback& abort_cb) override;
+
+		void get_jobs(std::deque<job>&) override;
+		void put_jobs(std::deque<job> const&) override;
+
+		void get_all(pfc::list_t<playable_location_impl>&) override;
+		void get_all_stamped(std::vector<stamped_location>&) override;
+		void get_statistics(store_statistics& out) override;
+
+	private:
+		// A location as keyed in the file table, the name points into the location it came from.
+		// Tables from before the directory table are keyed by directory and name joined.
+		struct stored_location
+		{
+			bool legacy;
+			sqlite3_int64 did;
+			std::string directory;
+			char const* name;
+			t_uint32 subsong;
+		};
+
+		std::shared_ptr<sqlite3_stmt> prepare_statement(std::string const& query);
+		t_int64 query_pragma(char const* name);
+
+		void migrate_locations(abort_callback& abort_cb);
+		void create_file_trigger_and_index();
+		sqlite3_int64 find_directory_locked(std::string const& path, bool create);
+		bool resolve_locked(playable_location const& file, bool create, stored_location& out);
+		bool resolve(playable_location const& file, stored_location& out);
+		static void bind_location(sqlite3_stmt* stmt, int first, stored_location const& loc);
+		std::unique_lock<std::mutex> lock_writes();
+		bool end_transaction(bool ok);
+		t_uint64 vacuum_locked();
+
+		std::shared_ptr<sqlite3> backing_db;
+
+		// Held around every write. All threads share the one connection, so a statement run
+		// while another thread is inside BEGIN would become part of its transaction.
+		// Taken before directory_mutex.
+		std::mutex write_mutex;
+
+		// Set while the file table keeps whole locations. Writes wait for migrate_locations
+		// to be over, reads use the old layout until it has succeeded.
+		std::atomic<bool> legacy_locations;
+		bool migration_over; // guarded by write_mutex
+		std::condition_variable migration_done;
+
+		// Held from resolving a directory to inserting rows that refer to it, so that
+		// compact never removes a directory in between.
+		std::mutex directory_mutex;
+		std::map<std::string, sqlite3_int64> directory_ids;
+	};
+}
@@ -0,0 +1,164 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "PchSeekbar.h"
+#include "Statistics.h"
+#include "json/json.h"
+
+namespace wave
+{
+	namespace scan_failure
+	{
+		char const* name(type t)
+		{
+			switch (t)
+			{
+			case unsupported: return "unsupported";
+			case not_seekable: return "not_seekable";
+			case bad_length: return "bad_length";
+			case not_found: return "not_found";
+			case io_error: return "io_error";
+			case channel_mismatch: return "channel_mismatch";
+			default: return "other";
+			}
+		}
+	}
+
+	cache_statistics::cache_statistics()
+		: hits(0), sidecar_hits(0), misses(0), stale(0), skipped(0)
+		, scans_started(0), scans_finished(0), scans_aborted(0)
+		, scan_wall_us(0), scan_audio_ms(0)
+		, started_at(std::chrono::steady_clock::now())
+	{
+		for (auto& f : failures)
+			f = 0;
+	}
+
+	void cache_statistics::add_scan(double wall_seconds, double audio_seconds)
+	{
+		++scans_finished;
+		scan_wall_us += (t_uint64)(wall_seconds * 1e6);
+		scan_audio_ms += (t_uint64)(audio_seconds * 1e3);
+	}
+
+	static Json::Value count(t_uint64 n)
+	{
+		return Json::Value((Json::UInt64)n);
+	}
+
+	Json::Value cache_statistics::to_json() const
+	{
+		double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+		t_uint64 lookups = hits + sidecar_hits + misses + stale;
+
+		Json::Value lookup(Json::objectValue);
+		lookup["hits"] = count(hits);
+		lookup["sidecar_hits"] = count(sidecar_hits);
+		lookup["misses"] = count(misses);
+		lookup["stale"] = count(stale);
+		lookup["skipped"] = count(skipped);
+		lookup["hit_ratio"] = lookups ? (double)(hits + sidecar_hits) / lookups : 0.0;
+
+		// Scans run concurrently, so the realtime factor is per worker rather than overall.
+		double wall = scan_wall_us / 1e6, audio = scan_audio_ms / 1e3;
+		Json::Value scans(Json::objectValue);
+		scans["started"] = count(scans_started);
+		scans["finished"] = count(scans_finished);
+		scans["aborted"] = count(scans_aborted);
+		scans["wall_seconds"] = wall;
+		scans["audio_seconds"] = audio;
+		scans["realtime_factor"] = wall > 0.0 ? audio / wall : 0.0;
+		scans["per_hour"] = uptime > 0.0 ? scans_finished * 3600.0 / uptime : 0.0;
+
+		Json::Value failed(Json::objectValue);
+		for (int i = 0; i < scan_failure::count; ++i)
+			failed[scan_failure::name((scan_failure::type)i)] = count(failures[i]);
+		scans["failures"] = failed;
+
+		Json::Value out(Json::objectValue);
+		out["uptime_seconds"] = uptime;
+		out["lookups"] = lookup;
+		out["scans"] = scans;
+		return out;
+	}
+
+	Json::Value store_statistics::to_json() const
+	{
+		Json::Value out(Json::objectValue);
+		out["backend"] = backend;
+		out["file_bytes"] = count(file_bytes);
+		out["free_bytes"] = count(free_bytes);
+
+		Json::Value rows(Json::objectValue);
+		for (auto I = tables.begin(); I != tables.end(); ++I)
+			rows[I->name] = count(I->count);
+		out["rows"] = rows;
+
+		Json::Value blobs(Json::arrayValue);
+		for (auto I = encodings.begin(); I != encodings.end(); ++I)
+		{
+			Json::Value e(Json::objectValue);
+			e["encoding"] = I->name;
+			e["waveforms"] = count(I->count);
+			e["bytes"] = count(I->bytes);
+			e["average_bytes"] = I->count ? (double)I->bytes / I->count : 0.0;
+			blobs.append(e);
+		}
+		out["encodings"] = blobs;
+		return out;
+	}
+
+	static pfc::string8 format_count(Json::Value const& v)
+	{
+		return pfc::format_uint(v.asUInt64()).get_ptr();
+	}
+
+	void print_statistics(Json::Value const& report)
+	{
+		auto const& lookups = report["cache"]["lookups"];
+		auto const& scans = report["cache"]["scans"];
+		auto const& queues = report["queues"];
+		auto const& store = report["store"];
+
+		console::formatter() << "Waveform cache statistics after " << pfc::format_float(report["cache"]["uptime_seconds"].asDouble(), 0, 0) << " s:";
+		console::formatter() << "  lookups: " << format_count(lookups["hits"]) << " hits, " << format_count(lookups["sidecar_hits"]) << " from sidecars, "
+			<< format_count(lookups["misses"]) << " misses, " << format_count(lookups["stale"]) << " stale, "
+			<< format_count(lookups["skipped"]) << " skipped (hit ratio " << pfc::format_float(lookups["hit_ratio"].asDouble() * 100.0, 0, 1) << "%)";
+		console::formatter() << "  scans: " << format_count(scans["started"]) << " started, " << format_count(scans["finished"]) << " finished, "
+			<< format_count(scans["aborted"]) << " aborted, " << pfc::format_float(scans["audio_seconds"].asDouble(), 0, 0) << " s of audio in "
+			<< pfc::format_float(scans["wall_seconds"].asDouble(), 0, 1) << " s (" << pfc::format_float(scans["realtime_factor"].asDouble(), 0, 1)
+			<< "x realtime, " << pfc::format_float(scans["per_hour"].asDouble(), 0, 1) << " per hour)";
+		{
+			console::formatter f;
+			f << "  failures:";
+			for (int i = 0; i < scan_failure::count; ++i)
+			{
+				char const* name = scan_failure::name((scan_failure::type)i);
+				f << " " << name << " " << format_count(scans["failures"][name]);
+			}
+		}
+		console::formatter() << "  queues: " << format_count(queues["needed"]) << " needed, " << format_count(queues["desired"]) << " desired, "
+			<< format_count(queues["bulk"]) << " bulk, " << format_count(queues["in_progress"]) << " in progress";
+
+		if (!store.isObject())
+			return;
+		console::formatter() << "  store: " << store["backend"].asCString() << ", " << format_count(store["file_bytes"]) << " bytes of which "
+			<< format_count(store["free_bytes"]) << " free";
+		{
+			console::formatter f;
+			f << "  rows:";
+			auto names = store["rows"].getMemberNames();
+			for (auto I = names.begin(); I != names.end(); ++I)
+				f << " " << I->c_str() << " " << format_count(store["rows"][*I]);
+		}
+		auto const& encodings = store["encodings"];
+		for (Json::Value::ArrayIndex i = 0; i < encodings.size(); ++i)
+		{
+			auto const& e = encodings[i];
+			console::formatter() << "  " << e["encoding"].asCString() << ": " << format_count(e["waveforms"]) << " waveforms, "
+				<< format_count(e["bytes"]) << " bytes (" << pfc::format_float(e["average_bytes"].asDouble(), 0, 0) << " per waveform)";
+		}
+	}
+}
@@ -0,0 +1,70 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "json/json-forwards.h"
+
+namespace wave
+{
+	namespace scan_failure
+	{
+		enum type
+		{
+			unsupported,
+			not_seekable,
+			bad_length,
+			not_found,
+			io_error,
+			channel_mismatch,
+			other,
+			count
+		};
+
+		char const* name(type t);
+	}
+
+	// Counters bumped by the cache from any thread while it runs.
+	struct cache_statistics
+	{
+		cache_statistics();
+
+		void add_scan(double wall_seconds, double audio_seconds);
+		Json::Value to_json() const;
+
+		std::atomic<t_uint64> hits, sidecar_hits, misses, stale, skipped;
+		std::atomic<t_uint64> scans_started, scans_finished, scans_aborted;
+		std::atomic<t_uint64> failures[scan_failure::count];
+		std::atomic<t_uint64> scan_wall_us, scan_audio_ms;
+
+	private:
+		std::chrono::steady_clock::time_point started_at;
+	};
+
+	// What a backing_store holds, gathered on request.
+	struct store_statistics
+	{
+		store_statistics() : file_bytes(0), free_bytes(0) {}
+
+		struct entry
+		{
+			std::string name;
+			t_uint64 count, bytes;
+		};
+
+		Json::Value to_json() const;
+
+		std::string backend;
+		t_uint64 file_bytes, free_bytes;
+		std::vector<entry> tables;    // rows per table
+		std::vector<entry> encodings; // waveforms and blob bytes per compression scheme and format
+	};
+
+	// Prints a report with "cache", "queues" and "store" sections to the console.
+	void print_statistics(Json::Value const& report);
+}
@@ -5,6 +5,7 @@
 
 #include "Direct2D.h"
 #include "../frontend_sdk/FrontendHelpers.h"
+#include "../waveform_sdk/Lod.h"
 
 std::function<void(std::function<void()>)> in_main_thread;
 
@@ -375,10 +376,17 @@ image_cache::update_texture_target(ref_ptr<waveform> wf,
     auto& fac = factory;
 
     channel_indices.enumerate([&, fac, index_count](int index) {
-      pfc::list_t<float> mini, maxi, rms;
-      wf->get_field("minimum", index, list_array_sink<float>(mini));
-      wf->get_field("maximum", index, list_array_sink<float>(maxi));
-      wf->get_field("rms", index, list_array_sink<float>(rms));
+      // No more points than there are pixels across, each keeping the peaks
+      // of the buckets under it.
+      envelope_columns columns;
+      get_columns(wf,
+                  index,
+                  (std::min)((size_t)get_bucket_count(wf),
+                             (size_t)target_size.width),
+                  columns);
+      auto const& mini = columns.minimum;
+      auto const& maxi = columns.maximum;
+      auto const& rms = columns.rms;
 
       CComPtr<ID2D1PathGeometry> wave_geometry, rms_geometry;
       fac->CreatePathGeometry(&wave_geometry);
@@ -389,7 +397,7 @@ image_cache::update_texture_target(ref_ptr<waveform> wf,
 
       CComPtr<ID2D1GeometrySink> gs, rms_gs;
       wave_geometry->Open(&gs);
-      size_t n = mini.get_size();
+      size_t n = mini.size();
 
       // Prepare waveform
       size_t x;
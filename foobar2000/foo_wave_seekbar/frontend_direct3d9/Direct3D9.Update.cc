@@ -6,19 +6,11 @@
 #include "PchDirect3D9.h"
 #include "Direct3D9.h"
 #include "../frontend_sdk/FrontendHelpers.h"
+#include "../waveform_sdk/Lod.h"
 #include <sstream>
 
 namespace wave
 {
-	inline void reduce_by_two(pfc::list_base_t<float>& data, UINT n)
-	{
-		for (UINT i = 0; i < n; i += 2)
-		{
-			float avg = (data[i] + data[i + 1]) / 2.0f;
-			data.replace_item(i >> 1, avg);
-		}
-	}
-
 	template <typename T>
 	T clamp(T v, T a, T b)
 	{
@@ -52,37 +44,22 @@ namespace wave
 			effect_params.set(parameters::viewport_size, D3DXVECTOR4((float)pp.BackBufferWidth, (float)pp.BackBufferHeight, 0, 0));
 		}
 
-		template <typename I, typename T>
-		T const& min_element_or_default(I first, I last, T const& def)
-		{
-			if (first == last)
-				return def;
-			return *std::min_element(first, last);
-		}
-
-		template <typename I, typename T>
-		T const& max_element_or_default(I first, I last, T const& def)
-		{
-			if (first == last)
-				return def;
-			return *std::max_element(first, last);
-		}
-
 		void frontend_impl::update_data()
 		{
 			if (device_lost)
 				return;
 
-			ref_ptr<waveform> w;
-			if (!callback.get_waveform(w))
-				w = make_placeholder_waveform();
+			ref_ptr<waveform> source;
+			if (!callback.get_waveform(source))
+				source = make_placeholder_waveform();
 
 			{
 				switch (callback.get_downmix_display())
 				{
-				case config::downmix_mono:   if (w->get_channel_count() > 1) w = downmix_waveform(w, 1); break;
-				case config::downmix_stereo: if (w->get_channel_count() > 2) w = downmix_waveform(w, 2); break;
+				case config::downmix_mono:   if (source->get_channel_count() > 1) source = downmix_waveform(source, 1); break;
+				case config::downmix_stereo: if (source->get_channel_count() > 2) source = downmix_waveform(source, 2); break;
 				}
+				auto w = as_waveform_summary(source);
 				channel_numbers = expand_flags(w->get_channel_map());
 
 				D3DXVECTOR4 const init_magnitude(FLT_MAX, -FLT_MAX, 0.0f, 1.0f);
@@ -90,7 +67,7 @@ namespace wave
 				channel_order.clear();
 				pfc::list_t<channel_info> infos;
 				callback.get_channel_infos(list_array_sink<channel_info>(infos));
-				infos.enumerate([this, &w, init_magnitude](channel_info const& info)
+				infos.enumerate([this, &w, &source, init_magnitude](channel_info const& info)
 				{
 					if (!info.enabled)
 						return;
@@ -110,23 +87,12 @@ namespace wave
 						CComPtr<IDirect3DTexture9> tex = channel_textures[info.channel];
 						D3DXVECTOR4& magnitude = channel_magnitudes[info.channel];
 						magnitude = init_magnitude;
-					
-						pfc::list_t<float> avg_min, avg_max, avg_rms;
-						w->get_field("minimum", idx, list_array_sink<float>(avg_min));
-						w->get_field("maximum", idx, list_array_sink<float>(avg_max));
-						w->get_field("rms", idx, list_array_sink<float>(avg_rms));
 
 						{
-							auto min_from = avg_min.get_ptr(), min_to = min_from + avg_min.get_size();
-							auto max_from = avg_max.get_ptr(), max_to = max_from + avg_max.get_size();
-							auto rms_from = avg_rms.get_ptr(), rms_to = rms_from + avg_rms.get_size();
-
-							auto low = min_element_or_default(min_from, min_to, init_magnitude.x);
-							auto high = max_element_or_default(max_from, max_to, init_magnitude.y);
-							auto rms = max_element_or_default(rms_from, rms_to, init_magnitude.z);
-							magnitude.x = (std::min)(magnitude.x, low);
-							magnitude.y = (std::max)(magnitude.y, high);
-							magnitude.z = (std::max)(magnitude.z, rms);
+							auto stats = w->get_channel_stats(idx);
+							magnitude.x = (std::min)(magnitude.x, stats.minimum);
+							magnitude.y = (std::max)(magnitude.y, stats.maximum);
+							magnitude.z = (std::max)(magnitude.z, stats.peak_rms);
 							track_magnitude.x = (std::min)(track_magnitude.x, magnitude.x);
 							track_magnitude.y = (std::max)(track_magnitude.y, magnitude.y);
 							track_magnitude.z = (std::max)(track_magnitude.z, magnitude.z);
@@ -135,7 +101,11 @@ namespace wave
 						}
 						for (UINT mip = 0; mip < mip_count; ++mip)
 						{
+							// Every mip keeps the peaks of the buckets it covers, rather than their averages.
+							// Read from source, so a compact waveform keeps its pyramid between updates.
 							UINT width = 2048 >> mip;
+							envelope_columns columns;
+							get_columns(source, idx, width, columns);
 							D3DLOCKED_RECT lock = {};
 							hr = tex->LockRect(mip, &lock, 0, 0);
 							if (FAILED(hr))
@@ -153,9 +123,9 @@ namespace wave
 									};
 									for (size_t i = 0; i < width; ++i)
 									{
-										uint32_t i_min = project(avg_min[i]);
-										uint32_t i_max = project(avg_max[i]);
-										uint32_t i_rms = project(avg_rms[i]);
+										uint32_t i_min = project(columns.minimum[i]);
+										uint32_t i_max = project(columns.maximum[i]);
+										uint32_t i_rms = project(columns.rms[i]);
 										uint32_t val = ((i_sgn & 0x003) << 30)
 													 + ((i_min & 0x3FF) << 20)
 													 + ((i_max & 0x3FF) << 10)
@@ -172,9 +142,9 @@ namespace wave
 									};
 									for (size_t i = 0; i < width; ++i)
 									{
-										uint32_t i_min = project(avg_min[i]);
-										uint32_t i_max = project(avg_max[i]);
-										uint32_t i_rms = project(avg_rms[i]);
+										uint32_t i_min = project(columns.minimum[i]);
+										uint32_t i_max = project(columns.maximum[i]);
+										uint32_t i_rms = project(columns.rms[i]);
 										uint32_t val = ((i_sgn & 0xFF) << 24)
 													 + ((i_min & 0xFF) << 16)
 													 + ((i_max & 0xFF) <<  8)
@@ -184,9 +154,6 @@ namespace wave
 								}
 							}
 							hr = tex->UnlockRect(mip);
-							reduce_by_two(avg_min, width);
-							reduce_by_two(avg_max, width);
-							reduce_by_two(avg_rms, width);
 						}
 					}
 				});
@@ -0,0 +1,481 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Packs and unpacks signatures with every codec, zlib and LZMA both with new coders for
+// every call and with pooled ones. A seeded made up corpus of music, silence, clipping,
+// noise and transients in 1 to 8 channels is measured at both quantizations, along with
+// what stored rows cost to decode and what holding the corpus at 16 bits costs. Results
+// also go to codec-benchmark.json in the build directory, one entry per codec and corpus,
+// for comparing builds. Not a test; run it by hand.
+
+#include "PchSeekbar.h"
+#include "BackingStore.h"
+#include "Envelope.h"
+#include "Pack.h"
+#include "Signature.h"
+#include "waveform_sdk/Lod.h"
+#include "waveform_sdk/WaveformImpl.h"
+#include "json/json.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <random>
+
+extern const GUID guid_seekbar_branch = {};
+
+namespace
+{
+	using namespace wave;
+	typedef std::chrono::steady_clock clock;
+
+	double elapsed_ms(clock::time_point since)
+	{
+		return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+	}
+
+	// The codecs as the stores use them, on whole signature blobs. Unpacking writes
+	// into a buffer of the blob's size, like the stores do.
+	struct codec
+	{
+		char const* name;
+		bool (*pack)(std::vector<char> const& in, std::vector<char>& out);
+		bool (*unpack)(std::vector<char> const& in, std::vector<char>& out);
+		bool pooled; // whether it takes its coders from the pools in Pack.h
+	};
+
+	bool zlib_pack(std::vector<char> const& in, std::vector<char>& out) { return pack::z_pack(in.data(), in.size(), std::back_inserter(out)); }
+	bool zlib_unpack(std::vector<char> const& in, std::vector<char>& out) { return pack::z_unpack_into(in.data(), in.size(), out.data(), out.size()); }
+	bool lzma_pack(std::vector<char> const& in, std::vector<char>& out) { return pack::lzma_pack(in.data(), in.size(), std::back_inserter(out)); }
+	bool lzma_unpack(std::vector<char> const& in, std::vector<char>& out) { return pack::lzma_unpack_into(in.data(), in.size(), out.data(), out.size()); }
+	bool envelope_pack(std::vector<char> const& in, std::vector<char>& out) { return pack::envelope_pack(in.data(), in.size(), out); }
+	bool envelope_unpack(std::vector<char> const& in, std::vector<char>& out) { return pack::envelope_unpack_into(in.data(), in.size(), out.data(), out.size()); }
+
+	codec const codecs[] =
+	{
+		{ "zlib", &zlib_pack, &zlib_unpack, true },
+		{ "lzma", &lzma_pack, &lzma_unpack, true },
+		{ "envelope", &envelope_pack, &envelope_unpack, false },
+	};
+
+	// The corpus must come out the same on every build for results to be comparable. The
+	// standard pins down raw mt19937 output but not the distributions, so floats come from the former.
+	uint32_t const corpus_seed = 0x5eeb0a12;
+	unsigned const corpus_bucket_count = 2048;
+	size_t const corpus_per_kind = 40;
+
+	struct corpus_generator
+	{
+		corpus_generator() : rng(corpus_seed) {}
+
+		float uniform() { return (rng() >> 8) * (1.0f / 16777216.0f); }
+		float uniform(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+
+		std::mt19937 rng;
+	};
+
+	namespace corpus_kind
+	{
+		enum type { music, silence, clipped, noise, transient, count };
+
+		static char const* const names[count] = { "music", "silence", "clipped", "noise", "transient" };
+	}
+
+	unsigned const corpus_channel_counts[] = { 1, 2, 2, 6, 8 };
+
+	void make_waveform(corpus_generator& gen, corpus_kind::type kind, unsigned channel_count, signature::planar_data& out)
+	{
+		unsigned const n = corpus_bucket_count;
+		out.channel_count = channel_count;
+		out.bucket_count = n;
+		out.channel_map = audio_chunk::g_guess_channel_config(channel_count);
+		out.minimum.assign(channel_count * n, 0.0f);
+		out.maximum.assign(channel_count * n, 0.0f);
+		out.rms.assign(channel_count * n, 0.0f);
+		if (kind == corpus_kind::silence)
+			return;
+
+		float const gain = kind == corpus_kind::clipped ? gen.uniform(2.0f, 4.0f) : 1.0f;
+		for (unsigned c = 0; c < channel_count; ++c)
+		{
+			float level = gen.uniform(0.2f, 0.8f);
+			for (unsigned i = c*n; i < (c+1)*n; ++i)
+			{
+				float lo, hi, rms;
+				if (kind == corpus_kind::noise)
+				{
+					lo = -gen.uniform(0.8f, 1.0f);
+					hi = gen.uniform(0.8f, 1.0f);
+					rms = gen.uniform(0.55f, 0.6f);
+				}
+				else if (kind == corpus_kind::transient)
+				{
+					// Quiet bed with the odd hit decaying over a few buckets.
+					level = gen.uniform() < 0.01f ? gen.uniform(0.5f, 1.0f) : level * 0.7f + 0.003f;
+					lo = -level * gen.uniform(0.8f, 1.0f);
+					hi = level * gen.uniform(0.8f, 1.0f);
+					rms = level * gen.uniform(0.2f, 0.4f);
+				}
+				else
+				{
+					// A slowly wandering loudness with some spread between buckets.
+					level = (std::min)(1.0f, (std::max)(0.02f, level + gen.uniform(-0.03f, 0.03f)));
+					lo = -level * gen.uniform(0.7f, 1.0f) * gain;
+					hi = level * gen.uniform(0.7f, 1.0f) * gain;
+					rms = level * gen.uniform(0.3f, 0.5f) * gain;
+				}
+				out.minimum[i] = (std::max)(-1.0f, lo);
+				out.maximum[i] = (std::min)(1.0f, hi);
+				out.rms[i] = (std::min)(1.0f, rms);
+			}
+		}
+	}
+
+	struct corpus_set
+	{
+		std::string name;
+		std::vector<std::vector<char>> blobs;
+	};
+
+	std::vector<corpus_set> make_corpus(signature::quantization q)
+	{
+		std::vector<corpus_set> out;
+		corpus_generator gen;
+		size_t const channel_variants = sizeof(corpus_channel_counts) / sizeof(corpus_channel_counts[0]);
+		for (int k = 0; k < corpus_kind::count; ++k)
+		{
+			corpus_set set;
+			set.name = corpus_kind::names[k];
+			for (size_t i = 0; i < corpus_per_kind; ++i)
+			{
+				signature::planar_data planar;
+				make_waveform(gen, (corpus_kind::type)k, corpus_channel_counts[i % channel_variants], planar);
+				set.blobs.push_back(std::vector<char>());
+				signature::encode(planar, q, set.blobs.back());
+			}
+			out.push_back(set);
+		}
+		return out;
+	}
+
+	Json::Value measure_codec(codec const& c, char const* label, corpus_set const& set)
+	{
+		auto const& blobs = set.blobs;
+		t_uint64 raw_bytes = 0, packed_bytes = 0;
+		std::vector<std::vector<char>> packed(blobs.size()), unpacked(blobs.size());
+		std::vector<double> pack_us, unpack_us;
+		size_t failures = 0;
+
+		// Other threads packing at the same time are counted too.
+		size_t const allocations = pack::detail::counters.allocations;
+		size_t const base_bytes = pack::detail::counters.bytes;
+		pack::detail::counters.peak_bytes = base_bytes;
+		for (size_t i = 0; i < blobs.size(); ++i)
+		{
+			auto t = clock::now();
+			if (!c.pack(blobs[i], packed[i]))
+				++failures;
+			pack_us.push_back(elapsed_ms(t) * 1000.0);
+			raw_bytes += blobs[i].size();
+			packed_bytes += packed[i].size();
+			unpacked[i].resize(blobs[i].size());
+		}
+		for (size_t i = 0; i < blobs.size(); ++i)
+		{
+			auto t = clock::now();
+			bool ok = c.unpack(packed[i], unpacked[i]);
+			unpack_us.push_back(elapsed_ms(t) * 1000.0);
+			if (!ok || unpacked[i] != blobs[i])
+				++failures;
+		}
+		size_t const peak_bytes = pack::detail::counters.peak_bytes - base_bytes;
+		size_t const held_bytes = pack::detail::counters.bytes - base_bytes;
+		double const coder_allocations = (pack::detail::counters.allocations - allocations) / (double)blobs.size();
+
+		double const pack_s = std::accumulate(pack_us.begin(), pack_us.end(), 0.0) / 1e6;
+		double const unpack_s = std::accumulate(unpack_us.begin(), unpack_us.end(), 0.0) / 1e6;
+		double const raw_mb = raw_bytes / (1024.0 * 1024.0);
+		double const ratio = raw_bytes / (double)(std::max)(packed_bytes, (t_uint64)1);
+		std::sort(pack_us.begin(), pack_us.end());
+		std::sort(unpack_us.begin(), unpack_us.end());
+
+		Json::Value r(Json::objectValue);
+		r["codec"] = label;
+		r["corpus"] = set.name;
+		r["waveforms"] = (Json::UInt64)blobs.size();
+		r["raw_bytes"] = (Json::UInt64)raw_bytes;
+		r["packed_bytes"] = (Json::UInt64)packed_bytes;
+		r["ratio"] = ratio;
+		r["pack_mb_per_s"] = pack_s > 0.0 ? raw_mb / pack_s : 0.0;
+		r["unpack_mb_per_s"] = unpack_s > 0.0 ? raw_mb / unpack_s : 0.0;
+		r["median_pack_us"] = pack_us[pack_us.size() / 2];
+		r["median_unpack_us"] = unpack_us[unpack_us.size() / 2];
+		r["peak_bytes"] = (Json::UInt64)peak_bytes;
+		r["held_bytes"] = (Json::UInt64)held_bytes;
+		r["coder_allocations_per_waveform"] = coder_allocations;
+		r["failures"] = (Json::UInt64)failures;
+
+		std::printf("%s on %s: ratio %.2f (%llu to %llu bytes), pack %.1f MB/s, unpack %.1f MB/s, peak %u bytes, "
+			"%.2f coder allocations per waveform, %u failures over %u waveforms\n", label, set.name.c_str(), ratio,
+			(unsigned long long)raw_bytes, (unsigned long long)packed_bytes, r["pack_mb_per_s"].asDouble(),
+			r["unpack_mb_per_s"].asDouble(), (unsigned)peak_bytes, coder_allocations, (unsigned)failures, (unsigned)blobs.size());
+		return r;
+	}
+
+	void measure_codecs(corpus_set const& set, Json::Value& results)
+	{
+		size_t const codec_count = sizeof(codecs) / sizeof(codecs[0]);
+		for (size_t c = 0; c < codec_count; ++c)
+		{
+			if (!codecs[c].pooled)
+			{
+				results.append(measure_codec(codecs[c], codecs[c].name, set));
+				continue;
+			}
+			std::string label = std::string(codecs[c].name) + ", new coders";
+			pack::detail::use_pools = false;
+			results.append(measure_codec(codecs[c], label.c_str(), set));
+			pack::detail::use_pools = true;
+			label = std::string(codecs[c].name) + ", pooled coders";
+			results.append(measure_codec(codecs[c], label.c_str(), set));
+		}
+	}
+
+	// What a waveform costs to hold in memory as floats and at 16 bits, what going between
+	// the two costs and what a redraw costs when reading either, on the same corpus as the codecs.
+	Json::Value measure_residency()
+	{
+		Json::Value results(Json::arrayValue);
+		corpus_generator gen;
+		size_t const channel_variants = sizeof(corpus_channel_counts) / sizeof(corpus_channel_counts[0]);
+		for (int k = 0; k < corpus_kind::count; ++k)
+		{
+			t_uint64 float_bytes = 0, compact_bytes = 0;
+			std::vector<double> narrow_us, widen_us, redraw_float_us, redraw_compact_us;
+			double max_error = 0.0;
+			for (size_t i = 0; i < corpus_per_kind; ++i)
+			{
+				signature::planar_data planar;
+				make_waveform(gen, (corpus_kind::type)k, corpus_channel_counts[i % channel_variants], planar);
+				auto full = as_waveform_v2(planar_to_waveform(planar));
+				full->get_track_stats();
+				float_bytes += resident_bytes(full);
+
+				auto t = clock::now();
+				auto compact = make_compact_waveform(full);
+				narrow_us.push_back(elapsed_ms(t) * 1000.0);
+				compact_bytes += resident_bytes(compact);
+
+				t = clock::now();
+				auto wide = as_waveform_v2(compact);
+				widen_us.push_back(elapsed_ms(t) * 1000.0);
+
+				// A redraw at full HD width reads the columns of every channel. Both forms keep
+				// their pyramid from the first redraw, so the second one is timed.
+				envelope_columns columns;
+				ref_ptr<waveform> redrawn[] = { full, compact };
+				std::vector<double>* redraw_us[] = { &redraw_float_us, &redraw_compact_us };
+				for (int r = 0; r < 2; ++r)
+				{
+					for (int pass = 0; pass < 2; ++pass)
+					{
+						t = clock::now();
+						for (unsigned c = 0; c < full->get_channel_count(); ++c)
+							get_columns(redrawn[r], c, 1920, columns);
+						if (pass == 1)
+							redraw_us[r]->push_back(elapsed_ms(t) * 1000.0);
+					}
+				}
+
+				for (int f = 0; f < field::count; ++f)
+				{
+					for (unsigned c = 0; c < full->get_channel_count(); ++c)
+					{
+						auto a = full->get_span((field::type)f, c);
+						auto b = wide->get_span((field::type)f, c);
+						for (size_t j = 0; j < a.size(); ++j)
+							max_error = (std::max)(max_error, (double)std::fabs(a[j] - b[j]));
+					}
+				}
+			}
+			std::sort(narrow_us.begin(), narrow_us.end());
+			std::sort(widen_us.begin(), widen_us.end());
+			std::sort(redraw_float_us.begin(), redraw_float_us.end());
+			std::sort(redraw_compact_us.begin(), redraw_compact_us.end());
+
+			Json::Value r(Json::objectValue);
+			r["corpus"] = corpus_kind::names[k];
+			r["waveforms"] = (Json::UInt64)corpus_per_kind;
+			r["float_bytes_per_waveform"] = (Json::UInt64)(float_bytes / corpus_per_kind);
+			r["compact_bytes_per_waveform"] = (Json::UInt64)(compact_bytes / corpus_per_kind);
+			r["median_narrow_us"] = narrow_us[narrow_us.size() / 2];
+			r["median_widen_us"] = widen_us[widen_us.size() / 2];
+			r["median_redraw_float_us"] = redraw_float_us[redraw_float_us.size() / 2];
+			r["median_redraw_compact_us"] = redraw_compact_us[redraw_compact_us.size() / 2];
+			r["max_error"] = max_error;
+
+			std::printf("residency of %s: %u bytes per waveform as floats, %u bytes at 16 bits, narrowing %.1f us, "
+				"widening %.1f us, redrawing %.1f us as floats and %.1f us at 16 bits, largest error %.7f\n",
+				corpus_kind::names[k], (unsigned)(float_bytes / corpus_per_kind), (unsigned)(compact_bytes / corpus_per_kind),
+				r["median_narrow_us"].asDouble(), r["median_widen_us"].asDouble(), r["median_redraw_float_us"].asDouble(),
+				r["median_redraw_compact_us"].asDouble(), max_error);
+			results.append(r);
+		}
+		return results;
+	}
+
+	// A format 1 row as sqlite_store::get reads it, each field one LZMA blob of floats.
+	ref_ptr<waveform> decode_float_planes(std::vector<char> const (&packed)[field::count], signature::planar_data const& shape)
+	{
+		ref_ptr<waveform_impl> w(new waveform_impl(shape.channel_count, shape.bucket_count, shape.channel_map));
+		std::vector<float> scratch(shape.channel_count * shape.bucket_count);
+		for (int f = 0; f < field::count; ++f)
+		{
+			if (!pack::lzma_unpack_into(packed[f].data(), packed[f].size(), scratch.data(), scratch.size() * sizeof(float)))
+				return ref_ptr<waveform>();
+			for (unsigned c = 0; c < shape.channel_count; ++c)
+				std::memcpy(w->get_mutable((field::type)f, c), scratch.data() + c * shape.bucket_count, shape.bucket_count * sizeof(float));
+		}
+		return w;
+	}
+
+	// A format 2 row as put_all packs it and sqlite_store::get reads it.
+	ref_ptr<waveform> decode_signature_row(std::vector<char> const& packed, bool enveloped)
+	{
+		std::vector<char> blob(enveloped ? pack::envelope_unpacked_size(packed.data(), packed.size())
+			: pack::lzma_unpacked_size(packed.data(), packed.size()));
+		bool ok = !blob.empty() && (enveloped
+			? pack::envelope_unpack_into(packed.data(), packed.size(), blob.data(), blob.size())
+			: pack::lzma_unpack_into(packed.data(), packed.size(), blob.data(), blob.size()));
+		return ok ? signature_to_waveform(blob.data(), blob.size()) : ref_ptr<waveform>();
+	}
+
+	// What a stored row costs in bytes and in time to decode into a waveform, for the float
+	// planes of format 1 and for format 2 at both quantizations, on the same corpus as the codecs.
+	Json::Value measure_row_formats()
+	{
+		struct row_format
+		{
+			char const* name;
+			unsigned format, bits; // bits is 32 for float planes
+		};
+		static row_format const formats[] =
+		{
+			{ "v1 float planes", 1, 32 },
+			{ "v2 8-bit", 2, signature::quantization_8bit },
+			{ "v2 16-bit", 2, signature::quantization_16bit },
+		};
+
+		Json::Value results(Json::arrayValue);
+		size_t const channel_variants = sizeof(corpus_channel_counts) / sizeof(corpus_channel_counts[0]);
+		for (auto const& fmt : formats)
+		{
+			corpus_generator gen;
+			for (int k = 0; k < corpus_kind::count; ++k)
+			{
+				t_uint64 row_bytes = 0;
+				std::vector<double> decode_us;
+				size_t failures = 0;
+				for (size_t i = 0; i < corpus_per_kind; ++i)
+				{
+					signature::planar_data planar;
+					make_waveform(gen, (corpus_kind::type)k, corpus_channel_counts[i % channel_variants], planar);
+
+					ref_ptr<waveform> decoded;
+					auto t = clock::now();
+					if (fmt.format == 1)
+					{
+						std::vector<float> const* fields[field::count] = { &planar.minimum, &planar.maximum, &planar.rms };
+						std::vector<char> packed[field::count];
+						for (int f = 0; f < field::count; ++f)
+						{
+							pack::lzma_pack(fields[f]->data(), fields[f]->size() * sizeof(float), std::back_inserter(packed[f]));
+							row_bytes += packed[f].size();
+						}
+						t = clock::now();
+						decoded = decode_float_planes(packed, planar);
+					}
+					else
+					{
+						std::vector<char> blob, packed;
+						signature::encode(planar, (signature::quantization)fmt.bits, blob);
+						bool const enveloped = pack::envelope_pack(blob.data(), blob.size(), packed);
+						if (!enveloped)
+						{
+							packed.clear();
+							pack::lzma_pack(blob.data(), blob.size(), std::back_inserter(packed));
+						}
+						row_bytes += packed.size();
+						t = clock::now();
+						decoded = decode_signature_row(packed, enveloped);
+					}
+					decode_us.push_back(elapsed_ms(t) * 1000.0);
+					if (!decoded.is_valid() || decoded->get_channel_count() != planar.channel_count)
+						++failures;
+				}
+				std::sort(decode_us.begin(), decode_us.end());
+
+				Json::Value r(Json::objectValue);
+				r["row_format"] = fmt.name;
+				r["format"] = fmt.format;
+				r["bits"] = fmt.bits;
+				r["corpus"] = corpus_kind::names[k];
+				r["waveforms"] = (Json::UInt64)corpus_per_kind;
+				r["bytes_per_row"] = (Json::UInt64)(row_bytes / corpus_per_kind);
+				r["median_decode_us"] = decode_us[decode_us.size() / 2];
+				r["failures"] = (Json::UInt64)failures;
+
+				std::printf("%s rows of %s: %u bytes per row, decoding %.1f us, %u failures over %u waveforms\n",
+					fmt.name, corpus_kind::names[k], (unsigned)(row_bytes / corpus_per_kind),
+					r["median_decode_us"].asDouble(), (unsigned)failures, (unsigned)corpus_per_kind);
+				results.append(r);
+			}
+		}
+		return results;
+	}
+}
+
+int main()
+{
+	signature::quantization const quantizations[] = { signature::quantization_8bit, signature::quantization_16bit };
+
+	Json::Value report(Json::objectValue);
+	report["corpus_seed"] = (Json::UInt64)corpus_seed;
+	report["bucket_count"] = corpus_bucket_count;
+	report["waveforms_per_corpus"] = (Json::UInt64)corpus_per_kind;
+	report["signature_format"] = (unsigned)signature::format_version;
+	Json::Value& results = report["results"] = Json::Value(Json::arrayValue);
+
+	size_t failures = 0;
+	for (auto q : quantizations)
+	{
+		auto corpus = make_corpus(q);
+		for (auto I = corpus.begin(); I != corpus.end(); ++I)
+		{
+			Json::Value set_results(Json::arrayValue);
+			measure_codecs(*I, set_results);
+			for (Json::ArrayIndex i = 0; i < set_results.size(); ++i)
+			{
+				set_results[i]["quantization_bits"] = (unsigned)q;
+				failures += set_results[i]["failures"].asUInt();
+				results.append(set_results[i]);
+			}
+		}
+	}
+	report["row_formats"] = measure_row_formats();
+	report["residency"] = measure_residency();
+
+	char const* const json_path = BENCH_OUTPUT_DIR "/codec-benchmark.json";
+	std::ofstream out(json_path, std::ios::binary);
+	out << Json::StyledWriter().write(report);
+	if (!out.flush())
+	{
+		std::printf("could not write %s\n", json_path);
+		return 1;
+	}
+	std::printf("results written to %s\n", json_path);
+	return failures ? 1 : 0;
+}
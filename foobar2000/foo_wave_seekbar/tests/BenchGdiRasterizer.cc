@@ -0,0 +1,148 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Megapixels per second of the GDI rasterizer on one thread, against shade_one per pixel,
+// which is as fast as the per-pixel shading it replaced, and how a 7.1 frame at 3840x400
+// scales over threads. Not a test; run it by hand, optionally with the most threads to try.
+
+#include "GdiRasterizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace wave::raster;
+
+namespace
+{
+	struct layout
+	{
+		unsigned width, height, channel_count;
+		bool vertical;
+	};
+
+	struct envelope
+	{
+		envelope(unsigned channel_count, size_t bucket_count, std::mt19937& rng)
+			: minimum(channel_count, std::vector<float>(bucket_count)), maximum(minimum)
+		{
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			for (unsigned c = 0; c < channel_count; ++c)
+			{
+				for (size_t i = 0; i < bucket_count; ++i)
+				{
+					minimum[c][i] = -unit(rng);
+					maximum[c][i] = unit(rng);
+				}
+			}
+		}
+
+		std::vector<lane> lanes(layout const& o) const
+		{
+			std::vector<lane> out;
+			for (unsigned i = 0; i < o.channel_count; ++i)
+			{
+				unsigned x = 0, y = 0, w = o.width, h = o.height;
+				if (o.vertical)
+				{
+					x = o.width * i / o.channel_count;
+					w = o.width * (i + 1) / o.channel_count - x;
+				}
+				else
+				{
+					y = o.height * i / o.channel_count;
+					h = o.height * (i + 1) / o.channel_count - y;
+				}
+				lane l = { x, y, w, h, o.vertical, false, minimum[i].data(), maximum[i].data(), minimum[i].size() };
+				out.push_back(l);
+			}
+			return out;
+		}
+
+		std::vector<std::vector<float>> minimum, maximum;
+	};
+
+	void render_per_pixel(image& unshaded, image& shaded, std::vector<lane> const& lanes, shade_colors const& colors)
+	{
+		for (auto I = lanes.begin(); I != lanes.end(); ++I)
+		{
+			lane const& l = *I;
+			unsigned const major = l.vertical ? l.height : l.width;
+			unsigned const minor = l.vertical ? l.width : l.height;
+			for (unsigned q = 0; q < minor; ++q)
+			{
+				float const y = 1.0f - 2.0f * q / (float)(minor - 1);
+				for (unsigned p = 0; p < major; ++p)
+				{
+					size_t const ix = p * l.bucket_count / major;
+					unsigned const px = l.x + (l.vertical ? q : p), py = l.y + (l.vertical ? p : q);
+					unshaded.row(py)[px] = shade_one(y, l.minimum[ix], l.maximum[ix], colors, shaded.row(py)[px]);
+				}
+			}
+		}
+	}
+
+	// Renders for about half a second and gives the megapixels per second.
+	template <typename F>
+	double megapixels_per_second(layout const& o, F render)
+	{
+		typedef std::chrono::steady_clock clock;
+		size_t frames = 0;
+		auto const start = clock::now();
+		double seconds = 0.0;
+		do
+		{
+			render();
+			++frames;
+			seconds = std::chrono::duration<double>(clock::now() - start).count();
+		}
+		while (seconds < 0.5);
+		return (double)o.width * o.height * frames / seconds / 1e6;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::mt19937 rng(47);
+	shade_colors const colors = { { 0.0f, 0.0f, 0.0f, 1.0f }, { 0.2f, 0.6f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } };
+	layout const layouts[] = {
+		{ 1920, 40, 2, false },
+		{ 3840, 400, 8, false },
+		{ 400, 3840, 8, true },
+	};
+	std::printf("%-22s %12s %12s\n", "layout", "per pixel", "sse2");
+	for (auto const& o : layouts)
+	{
+		envelope const e(o.channel_count, 2048, rng);
+		std::vector<lane> const lanes = e.lanes(o);
+		image unshaded(o.width, o.height), shaded(o.width, o.height);
+		double const scalar = megapixels_per_second(o, [&] { render_per_pixel(unshaded, shaded, lanes, colors); });
+		double const vector = megapixels_per_second(o, [&] { render_lanes(unshaded, shaded, lanes, colors, 1); });
+		char name[32];
+		std::snprintf(name, sizeof(name), "%ux%u %u ch %s", o.width, o.height, o.channel_count, o.vertical ? "vert" : "horz");
+		std::printf("%-22s %9.1f MP/s %9.1f MP/s\n", name, scalar, vector);
+	}
+
+	// The tiles of a full frame, as the GDI frontend renders it, over 1..N threads.
+	size_t max_threads = argc > 1 ? (size_t)std::atoi(argv[1]) : (size_t)std::thread::hardware_concurrency();
+	max_threads = (std::max)((size_t)4, max_threads);
+	layout const frame = layouts[1];
+	envelope const e(frame.channel_count, 2048, rng);
+	std::vector<lane> const lanes = e.lanes(frame);
+	image unshaded(frame.width, frame.height), shaded(frame.width, frame.height);
+	std::printf("\n%u hardware threads, %ux%u %u ch\n", std::thread::hardware_concurrency(), frame.width, frame.height, frame.channel_count);
+	double single = 0.0;
+	for (size_t threads = 1; threads <= max_threads; ++threads)
+	{
+		double const rate = megapixels_per_second(frame, [&] { render_lanes(unshaded, shaded, lanes, colors, threads); });
+		if (threads == 1)
+			single = rate;
+		std::printf("%2u threads %9.1f MP/s %6.2f ms/frame %5.2fx\n", (unsigned)threads, rate,
+			frame.width * frame.height / rate / 1e3, rate / single);
+	}
+}
@@ -0,0 +1,225 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares the file table with whole paths against the directory table on made up
+// locations: database size, migrating from the former and lookups in both. Not a test;
+// run it by hand, optionally with the number of locations, 500,000 by default.
+
+#include "PchSeekbar.h"
+#include "BackingStore.h"
+#include "Pack.h"
+#include "SqliteStore.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern const GUID guid_seekbar_branch = {};
+
+namespace
+{
+	using namespace wave;
+	typedef std::chrono::steady_clock clock;
+
+	size_t const probe_count = 20000;
+
+	double elapsed_ms(clock::time_point since)
+	{
+		return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+	}
+
+	struct timings
+	{
+		timings() : first(0.0) {}
+
+		double first; // the first lookup, kept apart as it reads the pages in
+		std::vector<double> lookups;
+	};
+
+	void report(char const* name, timings t)
+	{
+		std::sort(t.lookups.begin(), t.lookups.end());
+		double total = std::accumulate(t.lookups.begin(), t.lookups.end(), t.first);
+		double median = t.lookups.empty() ? 0.0 : t.lookups[t.lookups.size() / 2];
+		double p95 = t.lookups.empty() ? 0.0 : t.lookups[t.lookups.size() * 95 / 100];
+		std::printf("%s: first %.3f ms, median %.3f ms, 95th percentile %.3f ms, total %.3f ms for %u lookups\n",
+			name, t.first, median, p95, total, (unsigned)(t.lookups.size() + 1));
+	}
+
+	// 500 artists with 20 albums of 50 tracks each.
+	pfc::string8 corpus_location(size_t i)
+	{
+		pfc::string8 path;
+		path << "file://D:\\Music\\Artist " << pfc::format_uint(i / 1000, 3) << "\\Album " << pfc::format_uint(i / 50 % 20, 2)
+			<< "\\" << pfc::format_uint(i % 50, 2) << " - Track Title.flac";
+		return path;
+	}
+
+	// Silence packs down to almost nothing, so the file table dominates the database.
+	std::vector<char> silent_signature()
+	{
+		signature::planar_data planar;
+		planar.channel_count = 1;
+		planar.bucket_count = 2048;
+		planar.channel_map = audio_chunk::channel_config_mono;
+		planar.minimum.assign(planar.bucket_count, 0.0f);
+		planar.maximum.assign(planar.bucket_count, 0.0f);
+		planar.rms.assign(planar.bucket_count, 0.0f);
+		std::vector<char> blob, packed;
+		signature::encode(planar, signature::quantization_8bit, blob);
+		pack::lzma_pack(blob.data(), blob.size(), std::back_inserter(packed));
+		return packed;
+	}
+
+	t_uint64 file_size(char const* path)
+	{
+		struct stat st;
+		return stat(path, &st) ? 0 : (t_uint64)st.st_size;
+	}
+
+	// Lookups the way they were made before the directory table.
+	bool legacy_has(sqlite3* db, playable_location const& file)
+	{
+		sqlite3_stmt* p = 0;
+		sqlite3_prepare_v2(db,
+			"SELECT 1 FROM file as f, wave AS w "
+			"WHERE f.location = ? AND f.subsong = ? AND f.fid = w.fid", -1, &p, 0);
+		std::shared_ptr<sqlite3_stmt> stmt(p, &sqlite3_finalize);
+		sqlite3_bind_text(p, 1, file.get_path(), -1, SQLITE_STATIC);
+		sqlite3_bind_int(p, 2, file.get_subsong());
+		return SQLITE_ROW == sqlite3_step(p);
+	}
+
+	bool legacy_get(sqlite3* db, playable_location const& file, ref_ptr<waveform>& out)
+	{
+		sqlite3_stmt* p = 0;
+		sqlite3_prepare_v2(db,
+			"SELECT w.data FROM file AS f NATURAL JOIN wave AS w "
+			"WHERE f.location = ? AND f.subsong = ?", -1, &p, 0);
+		std::shared_ptr<sqlite3_stmt> stmt(p, &sqlite3_finalize);
+		sqlite3_bind_text(p, 1, file.get_path(), -1, SQLITE_STATIC);
+		sqlite3_bind_int(p, 2, file.get_subsong());
+		if (SQLITE_ROW != sqlite3_step(p))
+			return false;
+		void const* data = sqlite3_column_blob(p, 0);
+		size_t count = sqlite3_column_bytes(p, 0);
+		std::vector<char> blob(pack::lzma_unpacked_size(data, count));
+		if (blob.empty() || !pack::lzma_unpack_into(data, count, blob.data(), blob.size()))
+			return false;
+		out = signature_to_waveform(blob.data(), blob.size());
+		return out.is_valid();
+	}
+
+	template <typename F>
+	timings time_probes(std::vector<playable_location_impl> const& probes, F f)
+	{
+		timings t;
+		for (size_t k = 0; k < probes.size(); ++k)
+		{
+			auto then = clock::now();
+			f(probes[k]);
+			if (k == 0)
+				t.first = elapsed_ms(then);
+			else
+				t.lookups.push_back(elapsed_ms(then));
+		}
+		return t;
+	}
+
+	// The tables as they were before the directory table, filled in one transaction.
+	void write_legacy_database(char const* path, size_t corpus_size)
+	{
+		sqlite3* p = 0;
+		sqlite3_open(path, &p);
+		std::shared_ptr<sqlite3> db(p, &sqlite3_close);
+		sqlite3_exec(p,
+			"CREATE TABLE file (fid INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, location TEXT NOT NULL, "
+			"subsong INTEGER NOT NULL, UNIQUE (location, subsong));"
+			"CREATE TABLE wave (fid INTEGER PRIMARY KEY NOT NULL, min BLOB, max BLOB, rms BLOB, channels INT, "
+			"compression INT, format INT, data BLOB, FOREIGN KEY (fid) REFERENCES file(fid));",
+			0, 0, 0);
+
+		std::vector<char> const blob = silent_signature();
+		sqlite3_stmt* file_p = 0;
+		sqlite3_stmt* wave_p = 0;
+		sqlite3_prepare_v2(p, "INSERT INTO file (location, subsong) VALUES (?, 0)", -1, &file_p, 0);
+		sqlite3_prepare_v2(p, "INSERT INTO wave (fid, channels, compression, format, data) VALUES (?, ?, 1, ?, ?)", -1, &wave_p, 0);
+		std::shared_ptr<sqlite3_stmt> file_stmt(file_p, &sqlite3_finalize), wave_stmt(wave_p, &sqlite3_finalize);
+		sqlite3_exec(p, "BEGIN", 0, 0, 0);
+		for (size_t i = 0; i < corpus_size; ++i)
+		{
+			pfc::string8 location = corpus_location(i);
+			sqlite3_bind_text(file_p, 1, location, -1, SQLITE_STATIC);
+			sqlite3_step(file_p);
+			sqlite3_reset(file_p);
+			sqlite3_bind_int64(wave_p, 1, sqlite3_last_insert_rowid(p));
+			sqlite3_bind_int(wave_p, 2, audio_chunk::channel_config_mono);
+			sqlite3_bind_int(wave_p, 3, signature::format_version);
+			sqlite3_bind_blob(wave_p, 4, blob.data(), (int)blob.size(), SQLITE_STATIC);
+			sqlite3_step(wave_p);
+			sqlite3_reset(wave_p);
+		}
+		sqlite3_exec(p, "COMMIT", 0, 0, 0);
+		sqlite3_exec(p, "VACUUM", 0, 0, 0);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t const corpus_size = argc > 1 ? (size_t)std::atoi(argv[1]) : 500000;
+	if (!corpus_size)
+		return 1;
+
+	std::vector<playable_location_impl> probes;
+	{
+		std::mt19937 rng(1);
+		std::uniform_int_distribution<size_t> pick(0, corpus_size - 1);
+		for (size_t i = 0; i < probe_count; ++i)
+			probes.push_back(playable_location_impl(corpus_location(pick(rng)), 0));
+	}
+
+	pfc::string8 const path = "bench-locations.db";
+	unlink(path.get_ptr());
+	write_legacy_database(path, corpus_size);
+	t_uint64 const legacy_bytes = file_size(path);
+
+	timings legacy_has_t, legacy_get_t, has_t, get_t;
+	{
+		sqlite3* p = 0;
+		sqlite3_open(path, &p);
+		std::shared_ptr<sqlite3> db(p, &sqlite3_close);
+		ref_ptr<waveform> wf;
+		legacy_has_t = time_probes(probes, [&](playable_location const& loc) { legacy_has(p, loc); });
+		legacy_get_t = time_probes(probes, [&](playable_location const& loc) { legacy_get(p, loc, wf); });
+	}
+
+	double migrate_ms;
+	t_uint64 bytes;
+	{
+		abort_callback_dummy abort_cb;
+		auto start = clock::now();
+		sqlite_store store(path);
+		store.upgrade(abort_cb);
+		migrate_ms = elapsed_ms(start);
+		store.compact();
+		bytes = file_size(path);
+
+		ref_ptr<waveform> wf;
+		has_t = time_probes(probes, [&](playable_location const& loc) { store.has(loc); });
+		get_t = time_probes(probes, [&](playable_location const& loc) { store.get(wf, loc); });
+	}
+	unlink(path.get_ptr());
+
+	std::printf("%u locations take %llu bytes with whole paths and %llu bytes with the directory table, migrating took %.0f ms\n",
+		(unsigned)corpus_size, (unsigned long long)legacy_bytes, (unsigned long long)bytes, migrate_ms);
+	report("has, whole paths", legacy_has_t);
+	report("has, directory table", has_t);
+	report("get, whole paths", legacy_get_t);
+	report("get, directory table", get_t);
+}
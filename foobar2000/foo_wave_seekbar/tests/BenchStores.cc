@@ -0,0 +1,146 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Times every backing_store that builds here on sequential inserts, lookups in random
+// order, enumeration and a sweep over tracks that are all gone. Not a test; run it by
+// hand, optionally with the number of waveforms to store.
+
+#include "PchSeekbar.h"
+#include "BackingStore.h"
+#include "SqliteStore.h"
+#include "waveform_sdk/WaveformImpl.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <unistd.h>
+
+extern const GUID guid_seekbar_branch = {};
+
+namespace
+{
+	using namespace wave;
+	typedef std::chrono::steady_clock clock;
+
+	backing_store* open_sqlite(pfc::string8 const& path) { return new sqlite_store(path); }
+
+	struct store_backend
+	{
+		char const* name;
+		char const* file_name;
+		backing_store* (*open)(pfc::string8 const& path);
+	};
+
+	store_backend const store_backends[] =
+	{
+		{ "sqlite", "bench-stores.db", &open_sqlite },
+	};
+
+	double elapsed_ms(clock::time_point since)
+	{
+		return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+	}
+
+	ref_ptr<waveform> make_waveform(std::mt19937& rng, unsigned channel_count, unsigned channel_map)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		ref_ptr<waveform_impl> w(new waveform_impl(channel_count, 2048, channel_map));
+		for (unsigned c = 0; c < channel_count; ++c)
+		{
+			float* mins = w->get_mutable(field::minimum, c);
+			float* maxs = w->get_mutable(field::maximum, c);
+			float* rmss = w->get_mutable(field::rms, c);
+			for (unsigned i = 0; i < 2048; ++i)
+			{
+				float const a = unit(rng);
+				mins[i] = -a;
+				maxs[i] = a * unit(rng);
+				rmss[i] = 0.5f * a;
+			}
+		}
+		return ref_ptr<waveform>(w);
+	}
+
+	struct null_status : threaded_process_status {};
+
+	void measure_store(store_backend const& backend, pfc::string8 const& path, std::vector<ref_ptr<waveform>> const& samples,
+		std::vector<playable_location_impl> const& locations, std::vector<size_t> const& order)
+	{
+		std::unique_ptr<backing_store> store(backend.open(path));
+		abort_callback_dummy abort_cb;
+		auto start = clock::now();
+		for (size_t i = 0; i < locations.size(); ++i)
+			store->put(samples[i % samples.size()], locations[i]);
+		double const insert_ms = elapsed_ms(start);
+
+		std::vector<double> lookups;
+		for (size_t k = 0; k < order.size(); ++k)
+		{
+			auto then = clock::now();
+			ref_ptr<waveform> w;
+			store->get(w, locations[order[k]]);
+			lookups.push_back(elapsed_ms(then));
+		}
+		std::sort(lookups.begin(), lookups.end());
+
+		start = clock::now();
+		pfc::list_t<playable_location_impl> all;
+		store->get_all(all);
+		double const enumerate_ms = elapsed_ms(start);
+
+		start = clock::now();
+		null_status status;
+		store->remove_dead(status, abort_cb);
+		double const sweep_ms = elapsed_ms(start);
+		pfc::list_t<playable_location_impl> left;
+		store->get_all(left);
+
+		std::printf("%s: inserted %u waveforms in %.3f ms (%.0f per second)\n", backend.name, (unsigned)locations.size(),
+			insert_ms, locations.size() * 1000.0 / insert_ms);
+		std::printf("%s: lookups median %.3f ms, 95th percentile %.3f ms, total %.3f ms\n", backend.name,
+			lookups[lookups.size() / 2], lookups[lookups.size() * 95 / 100], std::accumulate(lookups.begin(), lookups.end(), 0.0));
+		std::printf("%s: enumerated %u waveforms in %.3f ms, swept them in %.3f ms%s\n", backend.name, (unsigned)all.get_count(),
+			enumerate_ms, sweep_ms, left.get_count() ? ", but some were left behind" : "");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t const entry_count = argc > 1 ? (size_t)std::atoi(argv[1]) : 2000;
+	std::mt19937 rng(32);
+	std::vector<ref_ptr<waveform>> samples;
+	for (unsigned i = 0; i < 50; ++i)
+	{
+		bool const stereo = i % 5 != 0;
+		samples.push_back(make_waveform(rng, stereo ? 2 : 1, stereo ? audio_chunk::channel_config_stereo : audio_chunk::channel_config_mono));
+	}
+
+	// The tracks are in a directory that exists but does not hold them, so the sweep
+	// has a real directory listing to do.
+	char directory[] = "bench-stores-XXXXXX";
+	if (!mkdtemp(directory))
+		return 1;
+	std::vector<playable_location_impl> locations;
+	for (size_t i = 0; i < entry_count; ++i)
+	{
+		pfc::string8 path;
+		path << "file://" << directory << "\\track" << i << ".flac";
+		locations.push_back(playable_location_impl(path, 0));
+	}
+	std::vector<size_t> order(locations.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+	for (auto const& backend : store_backends)
+	{
+		pfc::string8 path = backend.file_name;
+		unlink(path.get_ptr());
+		measure_store(backend, path, samples, locations, order);
+		unlink(path.get_ptr());
+	}
+	rmdir(directory);
+}
@@ -0,0 +1,308 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks every pixel the SSE2 rasterizer renders against the per-pixel float4 shading
+// it replaces, over random layouts, envelopes and colours, and that rendering only the
+// changed tiles of a scan gives the same frames as rendering them whole.
+
+#include "GdiRasterizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace wave::raster;
+
+namespace
+{
+	// The channels side by side across the minor axis, as the GDI frontend lays them out.
+	std::vector<lane> make_lanes(unsigned width, unsigned height, bool vertical, bool flip,
+		std::vector<std::vector<float>> const& minimum, std::vector<std::vector<float>> const& maximum)
+	{
+		std::vector<lane> lanes;
+		size_t const n = minimum.size();
+		for (size_t i = 0; i < n; ++i)
+		{
+			unsigned x = 0, y = 0, w = width, h = height;
+			if (vertical)
+			{
+				x = (unsigned)(width * i / n);
+				w = (unsigned)(width * (i + 1) / n) - x;
+			}
+			else
+			{
+				y = (unsigned)(height * i / n);
+				h = (unsigned)(height * (i + 1) / n) - y;
+			}
+			lane l = { x, y, w, h, vertical, flip, minimum[i].data(), maximum[i].data(), minimum[i].size() };
+			lanes.push_back(l);
+		}
+		return lanes;
+	}
+
+	// The per-pixel shading update_data had before the rasterizer, kept as it was apart from
+	// writing into images instead of device contexts and picking from bucket_count buckets.
+	struct float4
+	{
+		float4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+		float4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+		float x, y, z, w;
+	};
+
+	float4* saturate(float4* in)
+	{
+		in->x = (std::max)(0.0f, (std::min)(1.0f, in->x));
+		in->y = (std::max)(0.0f, (std::min)(1.0f, in->y));
+		in->z = (std::max)(0.0f, (std::min)(1.0f, in->z));
+		in->w = (std::max)(0.0f, (std::min)(1.0f, in->w));
+		return in;
+	}
+
+	float4* lerp(float4* out, float4 const* a, float4 const* b, float f)
+	{
+		float const omf = 1.0f - f;
+		out->x = omf * a->x + f * b->x;
+		out->y = omf * a->y + f * b->y;
+		out->z = omf * a->z + f * b->z;
+		out->w = omf * a->w + f * b->w;
+		return out;
+	}
+
+	struct color
+	{
+		explicit color(float r = 0.f, float g = 0.f, float b = 0.f, float a = 1.f) : r(r), g(g), b(b), a(a) {}
+		float r, g, b, a;
+	};
+
+	uint32_t color_to_xrgb(color c)
+	{
+		return (uint32_t)(uint8_t)(c.a * c.b * 255) | (uint32_t)(uint8_t)(c.a * c.g * 255) << 8 | (uint32_t)(uint8_t)(c.a * c.r * 255) << 16;
+	}
+
+	void reference_render(image& unshaded, image& shaded, bool vertical, bool flip,
+		std::vector<std::vector<float>> const& minimum, std::vector<std::vector<float>> const& maximum, shade_colors const& colors)
+	{
+		size_t const index_count = minimum.size();
+		for (size_t quad_index = 0; quad_index < index_count; ++quad_index)
+		{
+			size_t channel_width = unshaded.width, channel_x_offset = 0;
+			size_t channel_height = unshaded.height, channel_y_offset = 0;
+			if (vertical) {
+				channel_x_offset = channel_width * quad_index / index_count;
+				channel_width = channel_width * (quad_index+1) / index_count - channel_x_offset;
+			}
+			else {
+				channel_y_offset = channel_height * quad_index / index_count;
+				channel_height = channel_height * (quad_index+1) / index_count - channel_y_offset;
+			}
+			auto const& avg_min = minimum[quad_index];
+			auto const& avg_max = maximum[quad_index];
+
+			float4 backgroundColor(colors.background[0], colors.background[1], colors.background[2], colors.background[3]);
+			float4 textColor(colors.foreground[0], colors.foreground[1], colors.foreground[2], colors.foreground[3]);
+			float4 hilightColor(colors.highlight[0], colors.highlight[1], colors.highlight[2], colors.highlight[3]);
+
+			size_t major_extent = (size_t)(vertical ? unshaded.height : unshaded.width);
+			std::vector<float4> samples(major_extent);
+			for (size_t x = 0; x < major_extent; ++x) {
+				size_t ix = (x * avg_min.size() / major_extent);
+				samples[x] = float4(avg_min[ix], avg_max[ix], 0, 1);
+			}
+			for (size_t target_y = 0; target_y < channel_height; ++target_y) {
+				for (size_t target_x = 0; target_x < channel_width; ++target_x) {
+					size_t tc_x;
+					float tc_y;
+					if (vertical) {
+						tc_x = flip ? (channel_height - target_y - 1) : target_y;
+						tc_y = 1.0f - 2.0f * target_x / (float)(channel_width-1);
+					}
+					else {
+						tc_x = flip ? (channel_width - target_x - 1) : target_x;
+						tc_y = 1.0f - 2.0f * target_y / (float)(channel_height-1);
+					}
+					float4 c;
+					auto sample = samples[tc_x];
+					float below = tc_y - sample.x;
+					float above = tc_y - sample.y;
+					float factor = (std::min)(std::fabs(below), std::fabs(above));
+					bool outside = (below < 0 || above > 0);
+
+					if (outside)
+						c = backgroundColor;
+					else
+						lerp(&c, &backgroundColor, &textColor, 7.0f * factor);
+
+					saturate(&c);
+					float4 shaded_color;
+					lerp(&shaded_color, &hilightColor, &c, 0.75f);
+					color cc(c.x, c.y, c.z, c.w);
+					color ac(shaded_color.x, shaded_color.y, shaded_color.z, 1.0f);
+
+					unshaded.row((unsigned)(target_y + channel_y_offset))[target_x + channel_x_offset] = color_to_xrgb(cc);
+					shaded.row((unsigned)(target_y + channel_y_offset))[target_x + channel_x_offset] = color_to_xrgb(ac);
+				}
+			}
+		}
+	}
+}
+
+// Every pixel of random layouts against the per-pixel shading.
+static bool check_shading()
+{
+	std::mt19937 rng(47);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	size_t pixels = 0, mismatches = 0;
+	for (int it = 0; it < 400; ++it)
+	{
+		// Odd sizes leave scalar tails, and lanes one pixel across put NaN heights into
+		// the shading, both of which the vector path has to handle the same way.
+		unsigned const width = 1 + rng() % 700, height = it % 50 ? 1 + rng() % 160 : 1;
+		bool const vertical = rng() & 1, flip = rng() & 1;
+		unsigned const channel_count = 1 + rng() % 6;
+		size_t const bucket_count = it % 5 ? 2048 : 1 + rng() % 900;
+
+		// Some envelopes overshoot the lane and some are upside down.
+		float const reach = it % 3 ? 1.0f : 1.3f;
+		std::vector<std::vector<float>> minimum(channel_count, std::vector<float>(bucket_count)), maximum = minimum;
+		for (unsigned c = 0; c < channel_count; ++c)
+		{
+			for (size_t i = 0; i < bucket_count; ++i)
+			{
+				minimum[c][i] = -reach * unit(rng);
+				maximum[c][i] = reach * unit(rng);
+				if (it % 7 == 0 && i % 5 == 0)
+					std::swap(minimum[c][i], maximum[c][i]);
+			}
+		}
+
+		// Colours out of range have to saturate the same way too.
+		shade_colors colors;
+		for (int k = 0; k < 4; ++k)
+		{
+			colors.background[k] = unit(rng);
+			colors.foreground[k] = unit(rng);
+			colors.highlight[k] = unit(rng);
+		}
+		if (it % 4 == 0)
+			colors.foreground[3] = 1.5f;
+
+		std::vector<lane> const lanes = make_lanes(width, height, vertical, flip, minimum, maximum);
+		image expected(width, height), expected_shaded(width, height);
+		reference_render(expected, expected_shaded, vertical, flip, minimum, maximum, colors);
+		image actual(width, height), actual_shaded(width, height);
+		render_lanes(actual, actual_shaded, lanes, colors, 1 + it % 4);
+
+		size_t bad = 0;
+		for (size_t i = 0; i < expected.pixels.size(); ++i)
+		{
+			if (expected.pixels[i] != actual.pixels[i] || expected_shaded.pixels[i] != actual_shaded.pixels[i])
+				++bad;
+		}
+		if (bad)
+		{
+			std::printf("layout %d, %ux%u %s%s, %u channels: %u pixels differ\n", it, width, height,
+				vertical ? "vertical" : "horizontal", flip ? " flipped" : "", channel_count, (unsigned)bad);
+		}
+		pixels += expected.pixels.size();
+		mismatches += bad;
+	}
+	std::printf("%u of %u pixels differ from the per-pixel shading\n", (unsigned)mismatches, (unsigned)pixels);
+	return !mismatches;
+}
+
+// Scans random tracks the way the GDI frontend draws them: a full render first, then only
+// the tiles of the buckets each update changed, every frame against a render from scratch.
+static bool check_scans()
+{
+	std::mt19937 rng(49);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	shade_colors const colors = { { 0.1f, 0.1f, 0.1f, 1.0f }, { 1.0f, 0.5f, 0.2f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } };
+	size_t frames = 0, bad_frames = 0, bad_ranges = 0;
+	for (int it = 0; it < 200; ++it)
+	{
+		unsigned const width = 1 + rng() % 900, height = 1 + rng() % 120;
+		bool const vertical = rng() & 1, flip = rng() & 1;
+		unsigned const channel_count = 1 + rng() % 4;
+
+		// The frontend asks for a column per pixel, but bucket_tile has to round any count outwards.
+		size_t const major = vertical ? height : width;
+		size_t const bucket_count = it % 3 ? major : 1 + rng() % 3000;
+		std::vector<std::vector<float>> minimum(channel_count, std::vector<float>(bucket_count)), maximum = minimum;
+		std::vector<std::vector<float>> drawn_minimum = minimum, drawn_maximum = maximum;
+
+		image unshaded(width, height), shaded(width, height);
+		render_lanes(unshaded, shaded, make_lanes(width, height, vertical, flip, minimum, maximum), colors, 2);
+		size_t scanned = 0;
+		while (scanned < bucket_count)
+		{
+			// The scan fills in the next buckets, and now and then a level above them settles
+			// differently, changing buckets further back. Some updates change nothing at all.
+			size_t const next = (std::min)(bucket_count, scanned + rng() % 300);
+			for (unsigned c = 0; c < channel_count; ++c)
+			{
+				for (size_t i = scanned; i < next; ++i)
+				{
+					minimum[c][i] = -unit(rng);
+					maximum[c][i] = unit(rng);
+				}
+			}
+			if (rng() % 8 == 0 && scanned)
+			{
+				size_t const i = rng() % scanned;
+				maximum[rng() % channel_count][i] = unit(rng);
+			}
+			scanned = next;
+
+			std::vector<lane> const drawn = make_lanes(width, height, vertical, flip, drawn_minimum, drawn_maximum);
+			std::vector<lane> const lanes = make_lanes(width, height, vertical, flip, minimum, maximum);
+			size_t first, last;
+			find_dirty_buckets(drawn, lanes, first, last);
+			for (unsigned c = 0; c < channel_count; ++c)
+			{
+				for (size_t i = 0; i < bucket_count; ++i)
+				{
+					if ((i < first || i >= last) && (minimum[c][i] != drawn_minimum[c][i] || maximum[c][i] != drawn_maximum[c][i]))
+					{
+						++bad_ranges;
+						c = channel_count;
+						break;
+					}
+				}
+			}
+
+			std::vector<tile> tiles;
+			for (auto I = lanes.begin(); I != lanes.end(); ++I)
+				tiles.push_back(bucket_tile(*I, first, last));
+			render_tiles(unshaded, shaded, tiles, colors, 1 + frames % 3);
+			drawn_minimum = minimum;
+			drawn_maximum = maximum;
+
+			image expected(width, height), expected_shaded(width, height);
+			render_lanes(expected, expected_shaded, lanes, colors, 1);
+			++frames;
+			if (expected.pixels != unshaded.pixels || expected_shaded.pixels != shaded.pixels)
+			{
+				if (++bad_frames <= 10)
+				{
+					std::printf("scan %d, %ux%u %s%s, %u buckets: frame differs after buckets [%u, %u)\n", it, width, height,
+						vertical ? "vertical" : "horizontal", flip ? " flipped" : "", (unsigned)bucket_count, (unsigned)first, (unsigned)last);
+				}
+				unshaded = expected;
+				shaded = expected_shaded;
+			}
+		}
+	}
+	std::printf("%u of %u scanned frames differ from a full render, %u miss changed buckets\n",
+		(unsigned)bad_frames, (unsigned)frames, (unsigned)bad_ranges);
+	return !bad_frames && !bad_ranges;
+}
+
+int main()
+{
+	bool const shading = check_shading();
+	bool const scans = check_scans();
+	return shading && scans ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks that the columns get_columns reads off the pyramid of halvings keep the envelope
+// of the buckets under them, at full precision and at 16 bits.
+
+#include "waveform_sdk/Lod.h"
+#include "waveform_sdk/WaveformImpl.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace
+{
+	using namespace wave;
+
+	struct checker
+	{
+		checker() : failures(0), cases(0), failed(false) {}
+
+		void fail(char const* what, unsigned buckets, size_t columns, size_t column)
+		{
+			if (failures < 20 && !failed)
+				std::printf("%s: %u buckets in %u columns, column %u\n", what, buckets, (unsigned)columns, (unsigned)column);
+			failures += !failed;
+			failed = true;
+		}
+
+		int failures, cases;
+		bool failed; // whether the current case has failed yet
+	};
+
+	// Every bucket shows in the column it falls in, and no column shows more than the
+	// buckets within one column's share either side of it. Samples may be off by tolerance.
+	void check_envelope(checker& check, ref_ptr<waveform> const& w, ref_ptr<waveform_impl> const& reference,
+		unsigned channel, size_t column_count, float tolerance)
+	{
+		unsigned const n = reference->get_bucket_count();
+		auto mins = reference->get_span(field::minimum, channel);
+		auto maxs = reference->get_span(field::maximum, channel);
+		auto rmss = reference->get_span(field::rms, channel);
+
+		++check.cases;
+		check.failed = false;
+		envelope_columns e;
+		if (!get_columns(w, channel, column_count, e) || e.minimum.size() != column_count)
+		{
+			check.fail("no columns", n, column_count, 0);
+			return;
+		}
+
+		for (size_t i = 0; i < column_count; ++i)
+		{
+			size_t const first = i * n / column_count, last = (i + 1) * n / column_count;
+			for (size_t j = first; j < last; ++j)
+			{
+				if (e.minimum[i] > mins[j] + tolerance || e.maximum[i] < maxs[j] - tolerance)
+				{
+					check.fail("a bucket is missing from its column", n, column_count, i);
+					break;
+				}
+			}
+
+			size_t const share = n / column_count + 1;
+			size_t const near_first = first > share ? first - share : 0;
+			size_t const near_last = (std::min)((size_t)n, (std::max)(last, first + 1) + share);
+			float lo = 0.0f, hi = 0.0f;
+			for (size_t j = near_first; j < near_last; ++j)
+			{
+				lo = (std::min)(lo, mins[j]);
+				hi = (std::max)(hi, maxs[j]);
+			}
+			if (e.minimum[i] < lo - tolerance || e.maximum[i] > hi + tolerance)
+				check.fail("a column shows buckets from further away", n, column_count, i);
+		}
+
+		// Where the columns fall on a level exactly, their rms is that of the energy under them.
+		size_t const factor = n / column_count;
+		if (n % column_count == 0 && (factor & (factor - 1)) == 0)
+		{
+			for (size_t i = 0; i < column_count; ++i)
+			{
+				double energy = 0.0;
+				for (size_t j = i * factor; j < (i + 1) * factor; ++j)
+					energy += (double)rmss[j] * rmss[j];
+				if (std::fabs(std::sqrt(energy / factor) - e.rms[i]) > 1e-5 + 2.0 * tolerance)
+				{
+					check.fail("the rms of a column is off", n, column_count, i);
+					break;
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(50);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	checker check;
+	for (int it = 0; it < 300; ++it)
+	{
+		unsigned const bucket_count = 1 + rng() % 3000, channel_count = 1 + rng() % 3;
+		ref_ptr<waveform_impl> w(new waveform_impl(channel_count, bucket_count, (1u << channel_count) - 1));
+		for (unsigned c = 0; c < channel_count; ++c)
+		{
+			float* mins = w->get_mutable(field::minimum, c);
+			float* maxs = w->get_mutable(field::maximum, c);
+			float* rmss = w->get_mutable(field::rms, c);
+			for (unsigned i = 0; i < bucket_count; ++i)
+			{
+				// Mostly quiet with the odd full-scale peak, which no level may lose.
+				float const a = rng() % 97 ? unit(rng) * unit(rng) * unit(rng) : 1.0f;
+				mins[i] = -a;
+				maxs[i] = 0.9f * a;
+				rmss[i] = 0.5f * a;
+			}
+		}
+
+		// One code of the 16-bit form, whose scale is the largest magnitude.
+		ref_ptr<waveform> compact = make_compact_waveform(ref_ptr<waveform>(w));
+		float const code = 1.0f / 32767;
+		for (int k = 0; k < 6; ++k)
+		{
+			size_t const column_count = k == 0 ? bucket_count : k == 1 ? (std::max)(1u, bucket_count >> rng() % 5) : 1 + rng() % 4000;
+			for (unsigned c = 0; c < channel_count; ++c)
+			{
+				check_envelope(check, ref_ptr<waveform>(w), w, c, column_count, 0.0f);
+				check_envelope(check, compact, w, c, column_count, code);
+			}
+		}
+	}
+	std::printf("%d of %d column sets lose the envelope\n", check.failures, check.cases);
+	return check.failures ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks the mono envelope the cache accumulates while decoding against mixing the
+// whole bucket at double precision first and reducing it after.
+
+#include "MonoMix.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+	struct envelope
+	{
+		double minimum, maximum, rms;
+	};
+
+	envelope reference_envelope(std::vector<float> const& data, std::vector<float> const& weights)
+	{
+		size_t const channel_count = weights.size(), frames = data.size() / channel_count;
+		std::vector<double> mix(frames);
+		for (size_t i = 0; i < frames; ++i)
+		{
+			for (size_t c = 0; c < channel_count; ++c)
+				mix[i] += (double)weights[c] * data[i * channel_count + c];
+		}
+		envelope e = { mix[0], mix[0], 0.0 };
+		for (size_t i = 0; i < frames; ++i)
+		{
+			e.minimum = (std::min)(e.minimum, mix[i]);
+			e.maximum = (std::max)(e.maximum, mix[i]);
+			e.rms += mix[i] * mix[i];
+		}
+		e.rms = std::sqrt(e.rms / frames);
+		return e;
+	}
+
+	// Fed in pieces of random length, as decoded chunks end anywhere in a bucket.
+	envelope accumulated_envelope(std::vector<float> const& data, std::vector<float> const& weights, std::mt19937& rng)
+	{
+		unsigned const channel_count = (unsigned)weights.size();
+		size_t const frames = data.size() / channel_count;
+		float min = FLT_MAX, max = -FLT_MAX, sum = 0.0f;
+		for (size_t i = 0; i < frames;)
+		{
+			size_t const n = (std::min)(frames - i, (size_t)(1 + rng() % 300));
+			wave::accumulate_mixed(&data[i * channel_count], n, weights.data(), channel_count, min, max, sum);
+			i += n;
+		}
+		envelope e = { min, max, std::sqrt(sum / frames) };
+		return e;
+	}
+
+	bool close(double expected, double actual)
+	{
+		return std::fabs(expected - actual) <= 1e-5 * (std::max)(1.0, std::fabs(expected));
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(45);
+	std::uniform_real_distribution<float> amplitude(-1.0f, 1.0f), weight(0.0f, 1.0f);
+	int failures = 0, cases = 0;
+	for (int it = 0; it < 2000; ++it)
+	{
+		unsigned const channel_count = 1 + rng() % 8;
+		std::vector<float> weights(channel_count);
+		for (unsigned c = 0; c < channel_count; ++c)
+			weights[c] = it % 4 ? weight(rng) : 1.0f / channel_count;
+
+		// Every fourth bucket has channels in antiphase, where reducing first and mixing
+		// after would give a full-scale envelope for a silent mix.
+		size_t const frames = 1 + rng() % 4000;
+		std::vector<float> data(frames * channel_count);
+		for (size_t i = 0; i < frames; ++i)
+		{
+			float const common = amplitude(rng);
+			for (unsigned c = 0; c < channel_count; ++c)
+			{
+				float& s = data[i * channel_count + c];
+				s = it % 4 == 1 ? (c % 2 ? -common : common) : amplitude(rng);
+			}
+		}
+
+		envelope const expected = reference_envelope(data, weights);
+		envelope const actual = accumulated_envelope(data, weights, rng);
+		++cases;
+		if (!close(expected.minimum, actual.minimum) || !close(expected.maximum, actual.maximum) || !close(expected.rms, actual.rms))
+		{
+			std::printf("bucket %d, %u channels, %u frames: expected [%g, %g] rms %g, got [%g, %g] rms %g\n",
+				it, channel_count, (unsigned)frames, expected.minimum, expected.maximum, expected.rms,
+				actual.minimum, actual.maximum, actual.rms);
+			++failures;
+		}
+	}
+	std::printf("%d of %d buckets differ from the reference mix\n", failures, cases);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Holds every backing_store that builds here to the behaviour the cache relies on.
+// The pack store maps its files with Win32 calls and is not among them yet.
+
+#include "PchSeekbar.h"
+#include "BackingStore.h"
+#include "SqliteStore.h"
+#include "Signature.h"
+#include "waveform_sdk/WaveformImpl.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <unistd.h>
+
+extern const GUID guid_seekbar_branch = {};
+
+namespace
+{
+	using namespace wave;
+
+	backing_store* open_sqlite(pfc::string8 const& path) { return new sqlite_store(path); }
+
+	struct store_backend
+	{
+		char const* name;
+		char const* file_name;
+		backing_store* (*open)(pfc::string8 const& path);
+	};
+
+	store_backend const store_backends[] =
+	{
+		{ "sqlite", "test-stores.db", &open_sqlite },
+	};
+
+	struct checker
+	{
+		explicit checker(char const* backend) : backend(backend), failures(0) {}
+
+		void expect(bool ok, char const* what)
+		{
+			if (ok)
+				return;
+			++failures;
+			std::printf("%s: %s failed\n", backend, what);
+		}
+
+		char const* backend;
+		size_t failures;
+	};
+
+	ref_ptr<waveform> make_waveform(std::mt19937& rng, unsigned channel_count, unsigned channel_map)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		ref_ptr<waveform_impl> w(new waveform_impl(channel_count, 2048, channel_map));
+		for (unsigned c = 0; c < channel_count; ++c)
+		{
+			float* mins = w->get_mutable(field::minimum, c);
+			float* maxs = w->get_mutable(field::maximum, c);
+			float* rmss = w->get_mutable(field::rms, c);
+			for (unsigned i = 0; i < 2048; ++i)
+			{
+				mins[i] = -unit(rng);
+				maxs[i] = unit(rng);
+				rmss[i] = 0.5f * unit(rng);
+			}
+		}
+		return ref_ptr<waveform>(w);
+	}
+
+	// What a store should hand back for a waveform, which is quantized on the way in.
+	signature::planar_data stored_form(ref_ptr<waveform> const& w)
+	{
+		signature::planar_data planar, out;
+		std::vector<char> blob;
+		waveform_to_planar(w, planar);
+		signature::encode(planar, preferred_quantization(), blob);
+		signature::decode(blob.data(), blob.size(), out);
+		return out;
+	}
+
+	bool nearly_equal(std::vector<float> const& a, std::vector<float> const& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); ++i)
+			if (std::abs(a[i] - b[i]) > 1e-6f)
+				return false;
+		return true;
+	}
+
+	bool matches(ref_ptr<waveform> const& got, ref_ptr<waveform> const& put)
+	{
+		signature::planar_data a, b = stored_form(put);
+		waveform_to_planar(got, a);
+		return a.channel_count == b.channel_count && a.bucket_count == b.bucket_count && a.channel_map == b.channel_map &&
+			nearly_equal(a.minimum, b.minimum) && nearly_equal(a.maximum, b.maximum) && nearly_equal(a.rms, b.rms);
+	}
+
+	// Behaviour the cache relies on, run against a fresh store.
+	size_t check_store(store_backend const& backend, pfc::string8 const& path, ref_ptr<waveform> const& first, ref_ptr<waveform> const& second)
+	{
+		checker c(backend.name);
+		playable_location_impl a("file://check\\track.flac", 0), b("file://check\\track.flac", 1);
+		t_filestats const stamp = { 12345, 67890 };
+		{
+			std::unique_ptr<backing_store> store(backend.open(path));
+			abort_callback_dummy abort_cb;
+			store->upgrade(abort_cb);
+			ref_ptr<waveform> w;
+			c.expect(!store->has(a) && !store->get(w, a), "lookup in an empty store");
+
+			store->put(first, a);
+			c.expect(store->has(a), "has after put");
+			c.expect(store->get(w, a) && matches(w, first), "get after put");
+			c.expect(!store->has(b), "keeping subsongs apart");
+
+			store->put(second, a);
+			c.expect(store->get(w, a) && matches(w, second), "get after overwrite");
+
+			t_filestats stats;
+			c.expect(!store->get_file_stats(a, stats), "file stats before they are set");
+			store->set_file_stats(a, stamp);
+			c.expect(store->get_file_stats(a, stats) && stats.m_size == stamp.m_size && stats.m_timestamp == stamp.m_timestamp,
+				"file stats after they are set");
+
+			store->put(first, b);
+			std::vector<stamped_location> all;
+			store->get_all_stamped(all);
+			auto find = [&](playable_location const& loc) -> stamped_location const*
+			{
+				for (auto I = all.begin(); I != all.end(); ++I)
+					if (I->location == loc)
+						return &*I;
+				return nullptr;
+			};
+			c.expect(all.size() == 2 && find(a) && find(b), "enumerating every waveform");
+			c.expect(find(a) && find(a)->stats.m_size == stamp.m_size && find(b) && find(b)->stats.m_size == filesize_invalid,
+				"enumerating file stats");
+
+			if (store->keeps_content_keys())
+			{
+				c.expect(!store->has_content_key(a), "content key before it is set");
+				store->set_content_key(a, "0123456789abcdef");
+				c.expect(store->has_content_key(a), "content key after it is set");
+				pfc::string8 original;
+				c.expect(store->find_content("0123456789abcdef", 0, original) && !std::strcmp(original, a.get_path()), "finding by content key");
+				c.expect(!store->find_content("0123456789abcdef", 1, original), "keeping subsongs apart by content key");
+			}
+
+			store->remove(a);
+			c.expect(!store->has(a) && !store->get(w, a), "lookup after remove");
+			c.expect(store->has(b), "keeping other subsongs on remove");
+
+			std::deque<job> jobs, got;
+			jobs.push_back(make_job(a, true));
+			jobs.push_back(make_job(b, false));
+			store->put_jobs(jobs);
+			store->get_jobs(got);
+			c.expect(got.size() == 2 && got[0].loc == a && got[0].user && got[1].loc == b && !got[1].user, "job round trip");
+
+			store->remove_all(std::vector<playable_location_impl>(1, b));
+			pfc::list_t<playable_location_impl> left;
+			store->get_all(left);
+			c.expect(left.get_count() == 0, "remove_all");
+
+			std::vector<encoded_waveform> batch(1);
+			batch[0].location = b;
+			batch[0].channel_map = first->get_channel_map();
+			signature::planar_data planar;
+			waveform_to_planar(first, planar);
+			signature::encode(planar, preferred_quantization(), batch[0].signature);
+			store->put_all(batch);
+			std::vector<playable_location_impl> both;
+			both.push_back(a);
+			both.push_back(b);
+			std::vector<bool> present;
+			store->has_all(both, present);
+			c.expect(present.size() == 2 && !present[0] && present[1], "bulk put and lookup");
+			c.expect(store->get(w, b) && matches(w, first), "get after bulk put");
+			store->remove(b);
+
+			store->put(second, a);
+			store->compact();
+			c.expect(store->get(w, a) && matches(w, second), "get after compact");
+		}
+		{
+			std::unique_ptr<backing_store> store(backend.open(path));
+			ref_ptr<waveform> w;
+			c.expect(store->get(w, a) && matches(w, second), "get after reopening");
+			c.expect(!store->has(b), "removal after reopening");
+		}
+		return c.failures;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(32);
+	ref_ptr<waveform> const first = make_waveform(rng, 2, audio_chunk::channel_config_stereo);
+	ref_ptr<waveform> const second = make_waveform(rng, 1, audio_chunk::channel_config_mono);
+
+	size_t failures = 0;
+	for (auto const& backend : store_backends)
+	{
+		pfc::string8 path = backend.file_name;
+		unlink(path.get_ptr());
+		size_t const n = check_store(backend, path, first, second);
+		std::printf("%s: %s\n", backend.name, n ? "FAIL" : "PASS");
+		unlink(path.get_ptr());
+		failures += n;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,363 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Stands in for the foobar2000 SDK in tests/, with only what the waveform SDK and the store
+// code use of it and of pfc. Found through its directory being first on the include path,
+// as the waveform SDK includes "../SDK/foobar2000.h" and PchSeekbar.h "foobar2000.h".
+// Files are plain POSIX paths behind file://, with either separator.
+
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// An MSVC keyword the SDK uses for pure virtual functions.
+#define abstract = 0
+
+typedef size_t t_size;
+typedef int16_t t_int16;
+typedef uint8_t t_uint8;
+typedef int32_t t_int32;
+typedef uint32_t t_uint32;
+typedef int64_t t_int64;
+typedef uint64_t t_uint64;
+typedef t_uint64 t_filesize;
+typedef t_uint64 t_filetimestamp;
+
+static t_filesize const filesize_invalid = (t_filesize)-1;
+static t_filetimestamp const filetimestamp_invalid = 0;
+
+struct t_filestats
+{
+	t_filesize m_size;
+	t_filetimestamp m_timestamp;
+};
+
+static t_filestats const filestats_invalid = { filesize_invalid, filetimestamp_invalid };
+
+struct GUID
+{
+	uint32_t Data1;
+	uint16_t Data2, Data3;
+	uint8_t Data4[8];
+};
+
+namespace pfc
+{
+	struct string8
+	{
+		string8() {}
+		string8(char const* s) : s(s) {}
+		string8(char const* s, t_size n) : s(s, n) {}
+
+		char const* get_ptr() const { return s.c_str(); }
+		operator char const* () const { return s.c_str(); }
+		t_size get_length() const { return s.size(); }
+		bool is_empty() const { return s.empty(); }
+		void reset() { s.clear(); }
+		void set_string(char const* p) { s = p; }
+		void add_string(char const* p) { s += p; }
+
+		string8& operator = (char const* p) { s = p; return *this; }
+		string8& operator += (char const* p) { s += p; return *this; }
+		template <typename T>
+		string8& operator << (T const& t)
+		{
+			std::ostringstream o;
+			o << t;
+			s += o.str();
+			return *this;
+		}
+
+	private:
+		std::string s;
+	};
+
+	struct string
+	{
+		string(char const* s = "") : s(s) {}
+		string(string8 const& s) : s(s.get_ptr()) {}
+
+		char const* get_ptr() const { return s.c_str(); }
+		static bool g_equals(char const* a, char const* b) { return !std::strcmp(a, b); }
+
+	private:
+		std::string s;
+	};
+
+	inline std::string format_float(double v, unsigned, unsigned digits)
+	{
+		std::ostringstream o;
+		o.setf(std::ios::fixed);
+		o.precision(digits);
+		o << v;
+		return o.str();
+	}
+
+	// Zero padded to width digits.
+	inline std::string format_uint(t_uint64 v, unsigned width)
+	{
+		std::ostringstream o;
+		o.fill('0');
+		o.width(width);
+		o << v;
+		return o.str();
+	}
+
+	namespace io
+	{
+		namespace path
+		{
+			inline int compare(char const* a, char const* b) { return std::strcmp(a, b); }
+		}
+	}
+
+	template <typename T>
+	struct list_base_t
+	{
+		t_size get_count() const { return items.size(); }
+		t_size get_size() const { return items.size(); }
+		T const* get_ptr() const { return items.data(); }
+		void set_size(t_size n) { items.resize(n); }
+		void remove_all() { items.clear(); }
+		void add_item(T const& t) { items.push_back(t); }
+		void add_items_fromptr(T const* p, t_size n) { items.insert(items.end(), p, p + n); }
+		T& operator [] (t_size i) { return items[i]; }
+		T const& operator [] (t_size i) const { return items[i]; }
+
+		template <typename F>
+		void enumerate(F f) const
+		{
+			for (auto I = items.begin(); I != items.end(); ++I)
+				f(*I);
+		}
+
+	protected:
+		std::vector<T> items;
+	};
+
+	template <typename T>
+	struct list_t : list_base_t<T> {};
+
+	template <typename T, t_size N>
+	struct list_hybrid_t : list_t<T>
+	{
+		template <t_size M>
+		list_hybrid_t& operator = (T const (&a)[M])
+		{
+			this->items.assign(a, a + M);
+			return *this;
+		}
+	};
+}
+
+struct audio_chunk
+{
+	enum
+	{
+		channel_front_left = 1 << 0,
+		channel_front_right = 1 << 1,
+		channel_front_center = 1 << 2,
+		channel_lfe = 1 << 3,
+		channel_back_left = 1 << 4,
+		channel_back_right = 1 << 5,
+		channel_front_center_left = 1 << 6,
+		channel_front_center_right = 1 << 7,
+		channel_back_center = 1 << 8,
+		channel_side_left = 1 << 9,
+		channel_side_right = 1 << 10,
+		channel_top_center = 1 << 11,
+		channel_top_front_left = 1 << 12,
+		channel_top_front_center = 1 << 13,
+		channel_top_front_right = 1 << 14,
+		channel_top_back_left = 1 << 15,
+		channel_top_back_center = 1 << 16,
+		channel_top_back_right = 1 << 17,
+
+		channel_config_mono = channel_front_center,
+		channel_config_stereo = channel_front_left | channel_front_right,
+		channel_config_5point1 = channel_front_left | channel_front_right | channel_front_center | channel_lfe | channel_back_left | channel_back_right,
+
+		defined_channel_count = 18,
+	};
+
+	// The layouts audio_chunk_channel_config.cpp guesses for up to 8 channels.
+	static unsigned g_guess_channel_config(unsigned count)
+	{
+		static unsigned const table[] =
+		{
+			0,
+			channel_config_mono,
+			channel_config_stereo,
+			channel_front_left | channel_front_right | channel_lfe,
+			channel_front_left | channel_front_right | channel_back_left | channel_back_right,
+			channel_front_left | channel_front_right | channel_back_left | channel_back_right | channel_lfe,
+			channel_config_5point1,
+			channel_front_left | channel_front_right | channel_back_left | channel_back_right | channel_lfe | channel_front_center_right | channel_front_center_left,
+			channel_front_left | channel_front_right | channel_back_left | channel_back_right | channel_front_center | channel_lfe | channel_front_center_right | channel_front_center_left,
+		};
+		return count < sizeof(table) / sizeof(table[0]) ? table[count] : 0;
+	}
+
+	static unsigned g_count_channels(unsigned config)
+	{
+		unsigned n = 0;
+		for (; config; config &= config - 1)
+			++n;
+		return n;
+	}
+};
+
+struct playable_location
+{
+	virtual char const* get_path() const = 0;
+	virtual t_uint32 get_subsong() const = 0;
+
+	bool operator == (playable_location const& other) const
+	{
+		return !std::strcmp(get_path(), other.get_path()) && get_subsong() == other.get_subsong();
+	}
+
+	bool operator != (playable_location const& other) const { return !(*this == other); }
+
+protected:
+	~playable_location() {}
+};
+
+struct playable_location_impl : playable_location
+{
+	playable_location_impl() : subsong(0) {}
+	playable_location_impl(char const* path, t_uint32 subsong) : path(path), subsong(subsong) {}
+	playable_location_impl(playable_location const& other) : path(other.get_path()), subsong(other.get_subsong()) {}
+	playable_location_impl(playable_location_impl const& other) : path(other.path), subsong(other.subsong) {}
+
+	playable_location_impl& operator = (playable_location const& other)
+	{
+		path = other.get_path();
+		subsong = other.get_subsong();
+		return *this;
+	}
+
+	playable_location_impl& operator = (playable_location_impl const& other)
+	{
+		return *this = static_cast<playable_location const&>(other);
+	}
+
+	char const* get_path() const override { return path.c_str(); }
+	t_uint32 get_subsong() const override { return subsong; }
+
+private:
+	std::string path;
+	t_uint32 subsong;
+};
+
+struct exception_io : std::runtime_error
+{
+	exception_io(char const* what = "I/O error") : std::runtime_error(what) {}
+};
+
+struct exception_io_not_found : exception_io
+{
+	exception_io_not_found() : exception_io("Object not found") {}
+};
+
+struct exception_aborted : std::runtime_error
+{
+	exception_aborted() : std::runtime_error("User abort") {}
+};
+
+struct abort_callback
+{
+	virtual bool is_aborting() const = 0;
+	void check() const { if (is_aborting()) throw exception_aborted(); }
+
+protected:
+	~abort_callback() {}
+};
+
+struct abort_callback_dummy : abort_callback
+{
+	bool is_aborting() const override { return false; }
+};
+
+struct threaded_process_status
+{
+	virtual void set_progress(t_size, t_size) {}
+	virtual void set_progress_secondary(t_size, t_size) {}
+
+protected:
+	~threaded_process_status() {}
+};
+
+// Messages go to standard error.
+namespace console
+{
+	inline void info(char const* message) { std::cerr << message << std::endl; }
+
+	struct formatter : pfc::string8
+	{
+		~formatter() { info(get_ptr()); }
+	};
+}
+
+// Settings keep their defaults.
+struct advconfig_checkbox_factory
+{
+	advconfig_checkbox_factory(char const*, GUID const&, GUID const&, double, bool initial) : initial(initial) {}
+	bool get() const { return initial; }
+
+private:
+	bool initial;
+};
+
+struct directory_callback_impl
+{
+	explicit directory_callback_impl(bool) {}
+	t_size get_count() const { return entries.size(); }
+	char const* operator [] (t_size i) const { return entries[i].c_str(); }
+
+	std::vector<std::string> entries;
+};
+
+namespace filesystem
+{
+	inline std::string native_path(char const* location)
+	{
+		std::string path = std::strncmp(location, "file://", 7) ? location : location + 7;
+		std::replace(path.begin(), path.end(), '\\', '/');
+		return path;
+	}
+
+	inline bool g_exists(char const* location, abort_callback&)
+	{
+		struct stat st;
+		return !stat(native_path(location).c_str(), &st);
+	}
+
+	// Entries come back as locations in the form of the one listed.
+	inline void g_list_directory(char const* location, directory_callback_impl& out, abort_callback&)
+	{
+		DIR* dir = opendir(native_path(location).c_str());
+		if (!dir)
+			throw exception_io_not_found();
+		char const separator = std::strchr(location, '\\') ? '\\' : '/';
+		while (dirent* e = readdir(dir))
+		{
+			if (std::strcmp(e->d_name, ".") && std::strcmp(e->d_name, ".."))
+				out.entries.push_back(std::string(location) + separator + e->d_name);
+		}
+		closedir(dir);
+	}
+}
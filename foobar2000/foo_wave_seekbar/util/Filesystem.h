@@ -4,6 +4,7 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
+#include <atomic>
 #include <string>
 
 namespace util
@@ -16,6 +17,7 @@ namespace util
 		return *prefix == '\0';
 	}
 
+#if defined(_WIN32)
 	static std::wstring file_location_to_wide_path(char const* fb2k_file)
 	{
 		pfc::string8 native;
@@ -40,12 +42,38 @@ namespace util
 		return std::wstring(L"\\\\?\\") + w.get_ptr();
 	}
 
-	std::wstring extract_directory_name(std::wstring path)
+	static std::wstring extract_directory_name(std::wstring path)
 	{
 		auto off = path.find_last_of(L'\\');
 		return path.substr(0, off+1);
 	}
 
+	// Writes the file beside its destination and swaps it in, readers never see a partial file.
+	// The file written is named after the machine and process, as others may write on a share too.
+	static bool replace_file_contents(std::wstring const& path, void const* data, size_t size)
+	{
+		if (size > MAXDWORD)
+			return false;
+		static std::atomic<unsigned> serial(0);
+		wchar_t computer[MAX_COMPUTERNAME_LENGTH + 1] = {};
+		DWORD computer_length = MAX_COMPUTERNAME_LENGTH + 1;
+		GetComputerNameW(computer, &computer_length);
+		std::wstring temp_path = path + L"." + computer + L"-" + std::to_wstring((unsigned long long)GetCurrentProcessId())
+			+ L"-" + std::to_wstring((unsigned long long)serial++) + L".tmp";
+		HANDLE h = CreateFileW(temp_path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (h == INVALID_HANDLE_VALUE)
+			return false;
+		DWORD written = 0;
+		BOOL ok = WriteFile(h, data, (DWORD)size, &written, nullptr) && written == size;
+		CloseHandle(h);
+		if (!ok || !MoveFileExW(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		{
+			DeleteFileW(temp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
 	template <typename F>
 	void enumerate_file_glob(std::wstring glob, F f) {
 		WIN32_FIND_DATAW find_data = {};
@@ -65,4 +93,5 @@ namespace util
 		}
 		if (search_handle != INVALID_HANDLE_VALUE) FindClose(search_handle);
 	}
+#endif
 }
\ No newline at end of file
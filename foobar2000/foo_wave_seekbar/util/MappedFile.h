@@ -0,0 +1,131 @@
+//          Copyright Lars Viklund 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <windows.h>
+#include <stdint.h>
+#include <string>
+
+namespace util
+{
+	// View of a whole file. Writable views can be grown, which remaps them
+	// and invalidates earlier data pointers.
+	struct mapped_file
+	{
+		enum access_mode
+		{
+			read_only,
+			read_write,
+		};
+
+		mapped_file()
+			: file(INVALID_HANDLE_VALUE), mapping(nullptr), view(nullptr), view_size(0), mode(read_only)
+		{}
+
+		~mapped_file()
+		{
+			close();
+		}
+
+		// Read-write opens create missing files, and an empty file is open but unmapped.
+		bool open(std::wstring const& path, access_mode mode = read_only)
+		{
+			close();
+			this->mode = mode;
+			DWORD desired = mode == read_write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+			DWORD share = mode == read_write ? FILE_SHARE_READ : FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+			DWORD disposition = mode == read_write ? OPEN_ALWAYS : OPEN_EXISTING;
+			file = CreateFileW(path.c_str(), desired, share, nullptr,
+				disposition, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER size = {};
+			if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > SIZE_MAX)
+			{
+				close();
+				return false;
+			}
+			if (size.QuadPart == 0)
+			{
+				if (mode == read_write)
+					return true;
+				close();
+				return false;
+			}
+			if (!map((size_t)size.QuadPart))
+			{
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		bool resize(size_t new_size)
+		{
+			if (mode != read_write || file == INVALID_HANDLE_VALUE)
+				return false;
+			unmap();
+			LARGE_INTEGER li;
+			li.QuadPart = (LONGLONG)new_size;
+			if (!SetFilePointerEx(file, li, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+				return false;
+			return new_size == 0 || map(new_size);
+		}
+
+		bool flush()
+		{
+			if (view && !FlushViewOfFile(view, 0))
+				return false;
+			return file == INVALID_HANDLE_VALUE || mode != read_write || FlushFileBuffers(file);
+		}
+
+		void close()
+		{
+			unmap();
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+
+		bool is_open() const { return file != INVALID_HANDLE_VALUE; }
+		char const* data() const { return (char const*)view; }
+		char* writable_data() const { return mode == read_write ? (char*)view : nullptr; }
+		size_t size() const { return view_size; }
+
+	private:
+		mapped_file(mapped_file const&);
+		mapped_file& operator = (mapped_file const&);
+
+		bool map(size_t size)
+		{
+			DWORD protect = mode == read_write ? PAGE_READWRITE : PAGE_READONLY;
+			DWORD access = mode == read_write ? FILE_MAP_WRITE : FILE_MAP_READ;
+			mapping = CreateFileMappingW(file, nullptr, protect, 0, 0, nullptr);
+			if (mapping)
+				view = MapViewOfFile(mapping, access, 0, 0, 0);
+			if (!view)
+			{
+				unmap();
+				return false;
+			}
+			view_size = size;
+			return true;
+		}
+
+		void unmap()
+		{
+			if (view) UnmapViewOfFile(view);
+			if (mapping) CloseHandle(mapping);
+			mapping = nullptr;
+			view = nullptr;
+			view_size = 0;
+		}
+
+		HANDLE file, mapping;
+		void* view;
+		size_t view_size;
+		access_mode mode;
+	};
+}
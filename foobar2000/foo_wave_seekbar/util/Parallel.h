@@ -0,0 +1,31 @@
+//          Copyright Lars Viklund 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+	// Calls f(i) for every i in [first, last) on up to thread_count threads,
+	// including the calling one. f must not throw.
+	template <typename F>
+	void parallel_for(size_t first, size_t last, size_t thread_count, F f)
+	{
+		std::atomic<size_t> next(first);
+		auto body = [&]
+		{
+			for (size_t i = next++; i < last; i = next++)
+				f(i);
+		};
+		std::vector<std::thread> threads;
+		for (size_t t = 1; t < thread_count && t < last - first; ++t)
+			threads.push_back(std::thread(body));
+		body();
+		for (auto& t : threads)
+			t.join();
+	}
+}
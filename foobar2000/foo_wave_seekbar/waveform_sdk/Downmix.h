@@ -4,7 +4,7 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
-#include "../../pfc/list.h"
+#include "../SDK/foobar2000.h"
 
 template <typename T>
 void get_downmix_coefficients(t_size n, pfc::list_hybrid_t<T, 18>& left, pfc::list_hybrid_t<T, 18>& right)
@@ -62,13 +62,31 @@ void get_downmix_coefficients(t_size n, pfc::list_hybrid_t<T, 18>& left, pfc::li
 	}
 }
 
+// Coefficients for every channel count, as a waveform can have any of them.
+template <typename T>
+struct downmix_table
+{
+	downmix_table()
+	{
+		for (t_size n = 0; n <= 18; ++n)
+			get_downmix_coefficients(n, left[n], right[n]);
+	}
+
+	pfc::list_hybrid_t<T, 18> left[19], right[19];
+};
+
+template <typename T>
+downmix_table<T> const& get_downmix_table()
+{
+	static downmix_table<T> table;
+	return table;
+}
+
 template <typename T>
 float downmix_to_mono(T const* frame, size_t n_ch)
 {
-	static pfc::list_hybrid_t<T, 18> left, right;
-	static bool once = [&]() -> bool {
-		get_downmix_coefficients(n_ch, left, right); return false;
-	}();
+	auto const& left = get_downmix_table<T>().left[n_ch];
+	auto const& right = get_downmix_table<T>().right[n_ch];
 	T ret = T(0.0);
 	for (t_size i = 0; i < n_ch; ++i)
 	{
@@ -81,10 +99,8 @@ template <typename T>
 std::pair<T, T> downmix_to_stereo(T const* frame, size_t n_ch)
 {
 	typedef std::pair<T, T> R;
-	static pfc::list_hybrid_t<T, 18> left, right;
-	static bool once = [&]() -> bool {
-		get_downmix_coefficients(n_ch, left, right); return false;
-	}();
+	auto const& left = get_downmix_table<T>().left[n_ch];
+	auto const& right = get_downmix_table<T>().right[n_ch];
 	R ret = R(T(0.0), T(0.0));
 	for (t_size i = 0; i < n_ch; ++i)
 	{
@@ -0,0 +1,241 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Lod.h"
+#include "WaveformImpl.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace wave
+{
+	// The even and the odd ones of eight consecutive elements, src 16-byte aligned.
+	static void deinterleave(float const* src, __m128& even, __m128& odd)
+	{
+		__m128 const a = _mm_load_ps(src), b = _mm_load_ps(src + 4);
+		even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+	}
+
+	// Every pair of buckets made one: the lower minimum, the higher maximum and the rms of
+	// the two energies. An odd last bucket is carried over as it is.
+	static std::shared_ptr<waveform_payload> halve_payload(waveform_payload const& in)
+	{
+		unsigned const n = in.bucket_count, pairs = n / 2, vector_pairs = pairs & ~3u;
+		auto out = std::make_shared<waveform_payload>(in.channel_count, (n + 1) / 2);
+		__m128 const half = _mm_set1_ps(0.5f);
+		for (unsigned c = 0; c < in.channel_count; ++c)
+		{
+			float const* mins = in.row(field::minimum, c);
+			float const* maxs = in.row(field::maximum, c);
+			float const* rmss = in.row(field::rms, c);
+			float* out_mins = out->row(field::minimum, c);
+			float* out_maxs = out->row(field::maximum, c);
+			float* out_rmss = out->row(field::rms, c);
+
+			unsigned i = 0;
+			for (; i < vector_pairs; i += 4)
+			{
+				__m128 even, odd;
+				deinterleave(mins + 2*i, even, odd);
+				_mm_store_ps(out_mins + i, _mm_min_ps(even, odd));
+				deinterleave(maxs + 2*i, even, odd);
+				_mm_store_ps(out_maxs + i, _mm_max_ps(even, odd));
+				deinterleave(rmss + 2*i, even, odd);
+				__m128 const energy = _mm_add_ps(_mm_mul_ps(even, even), _mm_mul_ps(odd, odd));
+				_mm_store_ps(out_rmss + i, _mm_sqrt_ps(_mm_mul_ps(half, energy)));
+			}
+			for (; i < pairs; ++i)
+			{
+				out_mins[i] = (std::min)(mins[2*i], mins[2*i + 1]);
+				out_maxs[i] = (std::max)(maxs[2*i], maxs[2*i + 1]);
+				out_rmss[i] = std::sqrt(0.5f * (rmss[2*i] * rmss[2*i] + rmss[2*i + 1] * rmss[2*i + 1]));
+			}
+			if (n & 1)
+			{
+				out_mins[pairs] = mins[n - 1];
+				out_maxs[pairs] = maxs[n - 1];
+				out_rmss[pairs] = rmss[n - 1];
+			}
+		}
+		return out;
+	}
+
+	// The even and the odd ones of sixteen consecutive codes, src need not be aligned.
+	static void deinterleave(t_int16 const* src, __m128i& even, __m128i& odd)
+	{
+		__m128i const a = _mm_loadu_si128((__m128i const*)src), b = _mm_loadu_si128((__m128i const*)(src + 8));
+		even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+		odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+	}
+
+	// The rms of the energies of four pairs of codes, as codes.
+	static __m128i pair_rms(__m128i even, __m128i odd)
+	{
+		__m128 const e = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(even, even), 16));
+		__m128 const o = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(odd, odd), 16));
+		__m128 const energy = _mm_add_ps(_mm_mul_ps(e, e), _mm_mul_ps(o, o));
+		return _mm_cvtps_epi32(_mm_sqrt_ps(_mm_mul_ps(_mm_set1_ps(0.5f), energy)));
+	}
+
+	// As halve_payload above, on the codes of a compact payload at the same scale.
+	static std::shared_ptr<compact_payload> halve_payload(compact_payload const& in)
+	{
+		unsigned const n = in.bucket_count, pairs = n / 2, vector_pairs = pairs & ~7u;
+		auto out = std::make_shared<compact_payload>(in.channel_count, (n + 1) / 2, in.scale);
+		for (unsigned c = 0; c < in.channel_count; ++c)
+		{
+			t_int16 const* mins = in.row(field::minimum, c);
+			t_int16 const* maxs = in.row(field::maximum, c);
+			t_int16 const* rmss = in.row(field::rms, c);
+			t_int16* out_mins = out->row(field::minimum, c);
+			t_int16* out_maxs = out->row(field::maximum, c);
+			t_int16* out_rmss = out->row(field::rms, c);
+
+			unsigned i = 0;
+			for (; i < vector_pairs; i += 8)
+			{
+				__m128i even, odd;
+				deinterleave(mins + 2*i, even, odd);
+				_mm_storeu_si128((__m128i*)(out_mins + i), _mm_min_epi16(even, odd));
+				deinterleave(maxs + 2*i, even, odd);
+				_mm_storeu_si128((__m128i*)(out_maxs + i), _mm_max_epi16(even, odd));
+				deinterleave(rmss + 2*i, even, odd);
+				__m128i const lo = pair_rms(even, odd);
+				__m128i const hi = pair_rms(_mm_srli_si128(even, 8), _mm_srli_si128(odd, 8));
+				_mm_storeu_si128((__m128i*)(out_rmss + i), _mm_packs_epi32(lo, hi));
+			}
+			for (; i < pairs; ++i)
+			{
+				out_mins[i] = (std::min)(mins[2*i], mins[2*i + 1]);
+				out_maxs[i] = (std::max)(maxs[2*i], maxs[2*i + 1]);
+				float const a = rmss[2*i], b = rmss[2*i + 1];
+				out_rmss[i] = (t_int16)_mm_cvtss_si32(_mm_set_ss(std::sqrt(0.5f * (a * a + b * b))));
+			}
+			if (n & 1)
+			{
+				out_mins[pairs] = mins[n - 1];
+				out_maxs[pairs] = maxs[n - 1];
+				out_rmss[pairs] = rmss[n - 1];
+			}
+		}
+		return out;
+	}
+
+	// The coarsest of the payload and its halvings that has at least column_count buckets, and how
+	// many times it is halved. Every halving down to a single bucket is made on first use and kept
+	// with the payload.
+	template <typename Payload>
+	static std::shared_ptr<Payload> level_for(std::shared_ptr<Payload> const& base, size_t column_count, unsigned& shift)
+	{
+		std::lock_guard<std::mutex> lk(base->derived_mutex);
+		auto& levels = base->levels;
+		if (levels.empty())
+		{
+			for (Payload const* p = base.get(); p->bucket_count > 1; p = levels.back().get())
+				levels.push_back(halve_payload(*p));
+		}
+
+		auto out = base;
+		shift = 0;
+		for (auto I = levels.begin(); I != levels.end() && (*I)->bucket_count >= column_count; ++I, ++shift)
+			out = *I;
+		return out;
+	}
+
+	// Column i covers the full buckets [i*n/column_count, (i+1)*n/column_count), or bucket i*n/column_count
+	// alone when there are more columns than buckets. It is read off the buckets of a level halved shift
+	// times that hold any of them, so every bucket shows in the column it falls in. Samples are scaled by
+	// factor.
+	template <typename T>
+	static void reduce_columns(T const* mins, T const* maxs, T const* rmss, float factor, size_t n, unsigned shift,
+		size_t column_count, float* out_mins, float* out_maxs, float* out_rmss)
+	{
+		if (!n)
+		{
+			std::fill_n(out_mins, column_count, 0.0f);
+			std::fill_n(out_maxs, column_count, 0.0f);
+			std::fill_n(out_rmss, column_count, 0.0f);
+			return;
+		}
+
+		for (size_t i = 0; i < column_count; ++i)
+		{
+			size_t const first = i * n / column_count >> shift;
+			size_t const last = ((std::max)(i * n / column_count + 1, (i + 1) * n / column_count) - 1 >> shift) + 1;
+			T lo = mins[first], hi = maxs[first];
+			float rms = rmss[first] * factor;
+			if (last - first > 1)
+			{
+				float energy = rms * rms;
+				for (size_t j = first + 1; j < last; ++j)
+				{
+					lo = (std::min)(lo, mins[j]);
+					hi = (std::max)(hi, maxs[j]);
+					float const r = rmss[j] * factor;
+					energy += r * r;
+				}
+				rms = std::sqrt(energy / (last - first));
+			}
+			out_mins[i] = lo * factor;
+			out_maxs[i] = hi * factor;
+			out_rmss[i] = rms;
+		}
+	}
+
+	template <typename Payload>
+	static void columns_of(std::shared_ptr<Payload> const& base, unsigned channel, float factor, size_t column_count,
+		float* minimum, float* maximum, float* rms)
+	{
+		unsigned shift;
+		auto level = level_for(base, column_count, shift);
+		reduce_columns(level->row(field::minimum, channel), level->row(field::maximum, channel),
+			level->row(field::rms, channel), factor, base->bucket_count, shift, column_count, minimum, maximum, rms);
+	}
+
+	void waveform_impl::get_columns(unsigned channel, size_t column_count, float* minimum, float* maximum, float* rms) const
+	{
+		if (channel < payload->channel_count)
+			columns_of(payload, channel, 1.0f, column_count, minimum, maximum, rms);
+	}
+
+	void compact_waveform::get_columns(unsigned channel, size_t column_count, float* minimum, float* maximum, float* rms) const
+	{
+		if (channel < payload->channel_count)
+			columns_of(payload, channel, payload->scale / compact_payload::largest_code, column_count, minimum, maximum, rms);
+	}
+
+	// The pyramid is only kept with waveforms the component made. Any other is read at full
+	// resolution, as copying it to keep one would last only as long as the call.
+	bool get_columns(ref_ptr<waveform> const& w, unsigned channel, size_t column_count, envelope_columns& out)
+	{
+		if (channel >= w->get_channel_count())
+			return false;
+
+		out.minimum.assign(column_count, 0.0f);
+		out.maximum.assign(column_count, 0.0f);
+		out.rms.assign(column_count, 0.0f);
+		if (!column_count)
+			return true;
+
+		if (auto summary = dynamic_cast<waveform_summary*>(*w))
+		{
+			summary->get_columns(channel, column_count, out.minimum.data(), out.maximum.data(), out.rms.data());
+		}
+		else
+		{
+			auto v2 = as_waveform_v2(w);
+			reduce_columns(v2->get_span(field::minimum, channel).data(), v2->get_span(field::maximum, channel).data(),
+				v2->get_span(field::rms, channel).data(), 1.0f, v2->get_bucket_count(), 0, column_count,
+				out.minimum.data(), out.maximum.data(), out.rms.data());
+		}
+		return true;
+	}
+
+	unsigned get_bucket_count(ref_ptr<waveform> const& w)
+	{
+		return as_waveform_summary(w)->get_bucket_count();
+	}
+}
@@ -0,0 +1,26 @@
+//          Copyright Lars Viklund 2008 - 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "Waveform.h"
+#include <vector>
+
+namespace wave
+{
+	// One channel of a waveform resampled to the columns of a display.
+	struct envelope_columns
+	{
+		std::vector<float> minimum, maximum, rms;
+	};
+
+	// The channel as column_count columns, each the lowest minimum, the highest maximum and
+	// the rms of the energy of the buckets under it. Read off a pyramid of halvings kept with
+	// the waveform, so no column skips a peak however narrow the display; wider displays
+	// repeat buckets. False if there is no such channel.
+	bool get_columns(ref_ptr<waveform> const& w, unsigned channel, size_t column_count, envelope_columns& out);
+
+	// The number of buckets in every channel, without widening a compact waveform.
+	unsigned get_bucket_count(ref_ptr<waveform> const& w);
+}
@@ -6,120 +6,239 @@
 #include "Waveform.h"
 #include "WaveformImpl.h"
 #include "Downmix.h"
-
-#include <list>
-#include <memory>
+#include <xmmintrin.h>
 
 namespace wave
 {
-	ref_ptr<waveform> downmix_waveform(ref_ptr<waveform> w, size_t target_channels)
+	namespace field
 	{
-		typedef pfc::list_t<float> t_channel;
-		typedef pfc::list_t<float> t_frame;
-
-		auto channel_count = w->get_channel_count();
-		auto source_samples = std::make_unique<float[]>(2048 * channel_count);
-		auto target_samples = std::make_unique<float[]>(2048 * target_channels);
-		float* src = source_samples.get();
-		float* dst = target_samples.get();
+		static char const* const names[count] = { "minimum", "maximum", "rms" };
 
-		ref_ptr<waveform_impl> ret(new waveform_impl);
-		switch(target_channels)
+		char const* name(type f)
 		{
-		case 1: ret->channel_map = audio_chunk::channel_config_mono; break;
-		case 2: ret->channel_map = audio_chunk::channel_config_stereo; break;
-		default: return make_placeholder_waveform();
+			return f < count ? names[f] : "";
 		}
 
-		char const* field_names[] = {
-			"minimum", "maximum", "rms", 0
-		};
-
-		for (auto I = &field_names[0]; *I; ++I)
+		bool from_name(char const* what, type& out)
 		{
-			auto name = *I;
-
-			float frame[audio_chunk::defined_channel_count];
-
-			for (size_t channel_idx = 0; channel_idx < channel_count; ++channel_idx)
+			for (int f = 0; f < count; ++f)
 			{
-				w->get_field(name, channel_idx, pointer_array_sink<float>(src + channel_idx*2048, 2048));
-			}
-
-			for (size_t sample_index = 0; sample_index < 2048; ++sample_index)
-			{
-				for (size_t channel_idx = 0; channel_idx < channel_count; ++channel_idx)
-				{
-					frame[channel_idx] = src[channel_idx * 2048 + sample_index];
-				}
-				switch (target_channels)
+				if (pfc::string::g_equals(what, names[f]))
 				{
-				case 1: dst[sample_index] = downmix_to_mono(frame, channel_count); break;
-				case 2:
-					{
-						auto pair = downmix_to_stereo(frame, channel_count);
-						dst[0*2048 + sample_index] = pair.first;
-						dst[1*2048 + sample_index] = pair.second;
-						break;
-					}
+					out = (type)f;
+					return true;
 				}
 			}
-			pfc::list_t<t_channel> mix;
-			for (size_t channel_idx = 0; channel_idx < target_channels; ++channel_idx)
+			return false;
+		}
+	}
+
+	static ref_ptr<waveform_impl> copy_waveform(ref_ptr<waveform> const& w)
+	{
+		unsigned const channel_count = w->get_channel_count();
+		pfc::list_t<float> first;
+		w->get_field(field::name(field::minimum), 0, list_array_sink<float>(first));
+		unsigned const bucket_count = first.get_count();
+
+		ref_ptr<waveform_impl> ret(new waveform_impl(channel_count, bucket_count, w->get_channel_map()));
+		for (int f = 0; f < field::count; ++f)
+		{
+			for (unsigned c = 0; c < channel_count; ++c)
 			{
-				t_channel ch;
-				ch.add_items_fromptr(dst + channel_idx*2048, 2048);
-				mix.add_item(ch);
+				w->get_field(field::name((field::type)f), c, pointer_array_sink<float>(ret->get_mutable((field::type)f, c), bucket_count));
 			}
-			ret->fields[name].add_items(mix);
 		}
 		return ret;
 	}
 
-	struct waveform_placeholder : waveform
+	// w itself if it is a waveform_impl, otherwise one with its samples.
+	static ref_ptr<waveform_impl> widen_waveform(ref_ptr<waveform> const& w)
+	{
+		if (auto impl = dynamic_cast<waveform_impl*>(*w))
+			return ref_ptr<waveform_impl>(impl);
+		if (auto compact = dynamic_cast<compact_waveform*>(*w))
+			return compact->widen();
+		return copy_waveform(w);
+	}
+
+	ref_ptr<waveform_v2> as_waveform_v2(ref_ptr<waveform> const& w)
+	{
+		if (auto v2 = dynamic_cast<waveform_v2*>(*w))
+			return ref_ptr<waveform_v2>(v2);
+		return widen_waveform(w);
+	}
+
+	ref_ptr<waveform_summary> as_waveform_summary(ref_ptr<waveform> const& w)
+	{
+		if (auto summary = dynamic_cast<waveform_summary*>(*w))
+			return ref_ptr<waveform_summary>(summary);
+		return copy_waveform(w);
+	}
+
+	ref_ptr<waveform> make_compact_waveform(ref_ptr<waveform> const& w)
+	{
+		if (dynamic_cast<compact_waveform*>(*w))
+			return w;
+		auto impl = widen_waveform(w);
+		auto payload = std::make_shared<compact_payload>(*impl->get_payload());
+		return ref_ptr<waveform>(new compact_waveform(payload, impl->get_channel_map()));
+	}
+
+	// Left and right weights of every input channel, worked out from the channel layout.
+	struct downmix_matrix
+	{
+		float left[audio_chunk::defined_channel_count], right[audio_chunk::defined_channel_count];
+	};
+
+	// Front left and right go to their own side and the LFE to both at half weight. The other
+	// speakers of a side go to it at -3 dB, or at full weight when there is no centre speaker,
+	// and centre speakers go to both sides at -3 dB. For mono, stereo, quad, 5.0, 5.1 and 7.1
+	// these are the weights of the tables in Downmix.h.
+	static void speaker_weights(unsigned speaker, bool has_centre, float& left, float& right)
+	{
+		float const sqrt_half = 0.70710678f, side = has_centre ? sqrt_half : 1.0f;
+		unsigned const left_side = audio_chunk::channel_back_left | audio_chunk::channel_front_center_left |
+			audio_chunk::channel_side_left | audio_chunk::channel_top_front_left | audio_chunk::channel_top_back_left;
+		unsigned const right_side = audio_chunk::channel_back_right | audio_chunk::channel_front_center_right |
+			audio_chunk::channel_side_right | audio_chunk::channel_top_front_right | audio_chunk::channel_top_back_right;
+
+		left = right = 0.0f;
+		if (speaker == audio_chunk::channel_front_left)
+			left = 1.0f;
+		else if (speaker == audio_chunk::channel_front_right)
+			right = 1.0f;
+		else if (speaker == audio_chunk::channel_lfe)
+			left = right = 0.5f;
+		else if (speaker & left_side)
+			left = side;
+		else if (speaker & right_side)
+			right = side;
+		else // the centre speakers
+			left = right = sqrt_half;
+	}
+
+	static downmix_matrix make_downmix_matrix(unsigned channel_map, unsigned channel_count)
 	{
-		waveform_placeholder()
+		downmix_matrix m = {};
+		unsigned speakers[audio_chunk::defined_channel_count];
+		unsigned speaker_count = 0;
+		for (unsigned bit = 0; bit < audio_chunk::defined_channel_count; ++bit)
 		{
-			minimum.set_size(2048);
-			maximum.set_size(2048);
-			rms.set_size(2048);
-			for (size_t i = 0; i < 2048; ++i)
+			if (channel_map & (1u << bit))
+				speakers[speaker_count++] = 1u << bit;
+		}
+
+		if (channel_count == 1)
+		{
+			m.left[0] = m.right[0] = 1.0f;
+		}
+		else if (speaker_count == channel_count)
+		{
+			bool const has_centre = !!(channel_map & audio_chunk::channel_front_center);
+			for (unsigned c = 0; c < channel_count; ++c)
+				speaker_weights(speakers[c], has_centre, m.left[c], m.right[c]);
+		}
+		else
+		{
+			// The layout does not describe the channels, so go by the usual layout of the count.
+			auto const& left = get_downmix_table<float>().left[channel_count];
+			auto const& right = get_downmix_table<float>().right[channel_count];
+			for (unsigned c = 0; c < channel_count; ++c)
 			{
-				minimum[i] = 0.0f;
-				maximum[i] = 0.0f;
-				rms[i] = 0.0f;
+				m.left[c] = left[c];
+				m.right[c] = right[c];
 			}
 		}
+		return m;
+	}
+
+	// dst = the sum of weights[c] * src[c] over the channels, n a multiple of four and every row 16-byte aligned.
+	static void mix_row(float* dst, float const* const* src, float const* weights, unsigned channel_count, unsigned n)
+	{
+		__m128 w[audio_chunk::defined_channel_count];
+		for (unsigned c = 0; c < channel_count; ++c)
+			w[c] = _mm_set1_ps(weights[c]);
 
-		virtual bool get_field(char const* what, unsigned index, array_sink<float> const& out)
+		for (unsigned i = 0; i < n; i += 4)
 		{
-			if (index >= get_channel_count())
-				return false;
-			if (pfc::string::g_equals(what, "minimum"))
-				return out.set(minimum.get_ptr(), minimum.get_count()), true;
-			if (pfc::string::g_equals(what, "maximum"))
-				return out.set(maximum.get_ptr(), maximum.get_count()), true;
-			if (pfc::string::g_equals(what, "rms"))
-				return out.set(rms.get_ptr(), rms.get_count()), true;
-			return false;
+			__m128 acc = _mm_setzero_ps();
+			for (unsigned c = 0; c < channel_count; ++c)
+				acc = _mm_add_ps(acc, _mm_mul_ps(w[c], _mm_load_ps(src[c] + i)));
+			_mm_store_ps(dst + i, acc);
 		}
+	}
+
+	static std::shared_ptr<waveform_payload> downmix_payload(waveform_payload const& in, unsigned channel_map, unsigned target_channels)
+	{
+		auto ret = std::make_shared<waveform_payload>(target_channels, in.bucket_count);
+		auto m = make_downmix_matrix(channel_map, in.channel_count);
+		float mono[audio_chunk::defined_channel_count];
+		for (unsigned c = 0; c < in.channel_count; ++c)
+			mono[c] = 0.5f * (m.left[c] + m.right[c]);
 
-		virtual unsigned get_channel_count() const { return audio_chunk::defined_channel_count; }
-		virtual unsigned get_channel_map() const { return (1 << audio_chunk::defined_channel_count) - 1; } // channel mask of bits 0 to 17 set.
-		virtual ref_ptr<waveform> clone() const {
-			waveform_placeholder* out = new waveform_placeholder;
-			out->minimum = minimum;
-			out->maximum = maximum;
-			out->rms = rms;
-			return ref_ptr<waveform>(out);
+		for (int f = 0; f < field::count; ++f)
+		{
+			auto id = (field::type)f;
+			float const* src[audio_chunk::defined_channel_count];
+			for (unsigned c = 0; c < in.channel_count; ++c)
+				src[c] = in.row(id, c);
+
+			if (target_channels == 1)
+			{
+				mix_row(ret->row(id, 0), src, mono, in.channel_count, in.stride);
+			}
+			else
+			{
+				mix_row(ret->row(id, 0), src, m.left, in.channel_count, in.stride);
+				mix_row(ret->row(id, 1), src, m.right, in.channel_count, in.stride);
+			}
 		}
+		return ret;
+	}
 
-	private:
-		pfc::list_t<float> minimum, maximum, rms;
-	};
+	static unsigned downmix_channel_map(unsigned target_channels)
+	{
+		return target_channels == 1 ? audio_chunk::channel_config_mono : audio_chunk::channel_config_stereo;
+	}
+
+	// Every frontend downmixes on every redraw, so the mix is kept with the samples.
+	ref_ptr<waveform> waveform_impl::get_downmix(unsigned target_channels) const
+	{
+		if (target_channels < 1 || target_channels > 2 || payload->channel_count > audio_chunk::defined_channel_count)
+			return make_placeholder_waveform();
+
+		std::lock_guard<std::mutex> lk(payload->derived_mutex);
+		auto& mix = payload->downmixed[target_channels - 1];
+		if (!mix)
+			mix = downmix_payload(*payload, channel_map, target_channels);
+		return ref_ptr<waveform>(new waveform_impl(mix, downmix_channel_map(target_channels)));
+	}
+
+	// The payload is widened once to make the mix, which is kept at 16 bits.
+	ref_ptr<waveform> compact_waveform::get_downmix(unsigned target_channels) const
+	{
+		if (target_channels < 1 || target_channels > 2 || payload->channel_count > audio_chunk::defined_channel_count)
+			return make_placeholder_waveform();
+
+		std::lock_guard<std::mutex> lk(payload->derived_mutex);
+		auto& mix = payload->downmixed[target_channels - 1];
+		if (!mix)
+			mix = std::make_shared<compact_payload>(*downmix_payload(*payload->widen(), channel_map, target_channels));
+		return ref_ptr<waveform>(new compact_waveform(mix, downmix_channel_map(target_channels)));
+	}
+
+	// Waveforms made elsewhere are copied first, so a mix is only ever kept with a copy of our own.
+	ref_ptr<waveform> downmix_waveform(ref_ptr<waveform> in, size_t target_channels)
+	{
+		if (target_channels < 1 || target_channels > 2 || in->get_channel_count() > audio_chunk::defined_channel_count)
+			return make_placeholder_waveform();
+		return as_waveform_summary(in)->get_downmix((unsigned)target_channels);
+	}
 
 	ref_ptr<waveform> make_placeholder_waveform()
 	{
-		return ref_ptr<waveform>(new waveform_placeholder);
+		// Silence in every channel, with a channel mask of bits 0 to 17 set.
+		unsigned const channel_count = audio_chunk::defined_channel_count;
+		return ref_ptr<waveform>(new waveform_impl(channel_count, 2048, (1 << channel_count) - 1));
 	}
-}
\ No newline at end of file
+}
@@ -60,6 +60,78 @@ namespace wave
 		virtual unsigned get_channel_map() const = 0;
 		virtual ref_ptr<waveform> clone() const = 0;
 	};
+
+	namespace field
+	{
+		enum type
+		{
+			minimum,
+			maximum,
+			rms,
+			count
+		};
+
+		char const* name(type f);
+		bool from_name(char const* what, type& out);
+	}
+
+	// Borrowed elements, valid for as long as the waveform they came from is held.
+	template <typename T>
+	struct const_span
+	{
+		const_span() : p(0), n(0) {}
+		const_span(T const* p, size_t n) : p(p), n(n) {}
+
+		T const* data() const { return p; }
+		size_t size() const { return n; }
+		bool empty() const { return n == 0; }
+		T const* begin() const { return p; }
+		T const* end() const { return p + n; }
+		T const& operator [] (size_t i) const { return p[i]; }
+
+	private:
+		T const* p;
+		size_t n;
+	};
+
+	// Over all buckets of one channel, or of every channel for the whole track.
+	struct channel_stats
+	{
+		float minimum, maximum; // lowest minimum and highest maximum
+		float peak_rms, mean_rms;
+	};
+
+	// What every waveform the component makes can tell without reading out its samples,
+	// those held at 16 bits included.
+	struct waveform_summary : waveform
+	{
+		virtual unsigned get_bucket_count() const = 0;
+
+		// Worked out once per waveform, so frontends need not scan the samples.
+		virtual channel_stats get_channel_stats(unsigned channel) const = 0;
+		virtual channel_stats get_track_stats() const = 0;
+
+		// What downmix_waveform and get_columns in Lod.h hand out. Made on first use and kept
+		// with the samples by the module that made the waveform, so that a frontend in a
+		// module of its own never leaves anything it allocated in there. The columns are
+		// written to column_count floats each.
+		virtual ref_ptr<waveform> get_downmix(unsigned target_channels) const = 0;
+		virtual void get_columns(unsigned channel, size_t column_count, float* minimum, float* maximum, float* rms) const = 0;
+	};
+
+	// A waveform read in place instead of through a sink. Every waveform the component
+	// makes is one, save those held at 16 bits which become one when asked to;
+	// third-party frontends keep seeing the plain interface above.
+	struct waveform_v2 : waveform_summary
+	{
+		virtual const_span<float> get_span(field::type f, unsigned channel) const = 0;
+	};
+
+	// w itself if it is a waveform_v2, otherwise a copy of it that is, widened if it is held at 16 bits.
+	ref_ptr<waveform_v2> as_waveform_v2(ref_ptr<waveform> const& w);
+
+	// w itself if it is a waveform_summary, otherwise a copy of it that is. Never widens.
+	ref_ptr<waveform_summary> as_waveform_summary(ref_ptr<waveform> const& w);
 	
 	ref_ptr<waveform> make_placeholder_waveform();
 	ref_ptr<waveform> downmix_waveform(ref_ptr<waveform> in, size_t target_channels);
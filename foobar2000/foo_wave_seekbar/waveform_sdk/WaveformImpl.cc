@@ -5,30 +5,240 @@
 
 #include "WaveformImpl.h"
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <emmintrin.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
 
 namespace wave
 {
-	bool waveform_impl::get_field(char const* what, unsigned index, array_sink<float> const& out)
+	static size_t const row_alignment = 16;
+
+	// Rows come from the aligned allocator of the platform, as new only aligns to 8 bytes.
+	static void* aligned_malloc(size_t cb, size_t alignment)
 	{
-		auto I = fields.find(what);
-		if (!I.is_valid())
-			return false;
+#if defined(_WIN32)
+		return _aligned_malloc(cb, alignment);
+#else
+		void* p = 0;
+		return posix_memalign(&p, alignment, cb) ? 0 : p;
+#endif
+	}
+
+	static void aligned_free(void* p)
+	{
+#if defined(_WIN32)
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+
+	template <typename T>
+	static T* allocate_rows(size_t cb)
+	{
+		T* p = (T*)aligned_malloc((std::max)(cb, row_alignment), row_alignment);
+		if (!p)
+			throw std::bad_alloc();
+		std::memset(p, 0, cb);
+		return p;
+	}
+
+	waveform_payload::waveform_payload(unsigned channel_count, unsigned bucket_count)
+		: channel_count(channel_count), bucket_count(bucket_count), stride((bucket_count + 3) & ~3u)
+		, samples(allocate_rows<float>((size_t)field::count * channel_count * stride * sizeof(float)))
+	{
+	}
+
+	waveform_payload::~waveform_payload()
+	{
+		aligned_free(samples);
+	}
+
+	float* waveform_payload::row(field::type f, unsigned channel) const
+	{
+		assert(f < field::count && channel < channel_count);
+		return samples + ((size_t)f * channel_count + channel) * stride;
+	}
+
+	std::shared_ptr<waveform_payload> waveform_payload::copy() const
+	{
+		auto out = std::make_shared<waveform_payload>(channel_count, bucket_count);
+		std::memcpy(out->samples, samples, (size_t)field::count * channel_count * stride * sizeof(float));
+		return out;
+	}
+
+	std::vector<channel_stats> const& waveform_payload::get_stats()
+	{
+		std::lock_guard<std::mutex> lk(derived_mutex);
+		if (!stats.empty())
+			return stats;
+
+		channel_stats track = {};
+		for (unsigned c = 0; c < channel_count; ++c)
+		{
+			channel_stats s = {};
+			float const* mins = row(field::minimum, c);
+			float const* maxs = row(field::maximum, c);
+			float const* rmss = row(field::rms, c);
+			double rms_sum = 0.0;
+			for (unsigned i = 0; i < bucket_count; ++i)
+			{
+				if (i == 0 || mins[i] < s.minimum) s.minimum = mins[i];
+				if (i == 0 || maxs[i] > s.maximum) s.maximum = maxs[i];
+				if (i == 0 || rmss[i] > s.peak_rms) s.peak_rms = rmss[i];
+				rms_sum += rmss[i];
+			}
+			s.mean_rms = bucket_count ? (float)(rms_sum / bucket_count) : 0.0f;
+			stats.push_back(s);
+
+			if (c == 0 || s.minimum < track.minimum) track.minimum = s.minimum;
+			if (c == 0 || s.maximum > track.maximum) track.maximum = s.maximum;
+			if (c == 0 || s.peak_rms > track.peak_rms) track.peak_rms = s.peak_rms;
+			track.mean_rms += s.mean_rms / channel_count;
+		}
+		stats.push_back(track);
+		return stats;
+	}
+
+	size_t waveform_payload::resident_bytes()
+	{
+		std::lock_guard<std::mutex> lk(derived_mutex);
+		size_t n = sizeof(*this) + (size_t)field::count * channel_count * stride * sizeof(float);
+		n += stats.capacity() * sizeof(channel_stats);
+		for (int i = 0; i < 2; ++i)
+		{
+			if (downmixed[i])
+				n += downmixed[i]->resident_bytes();
+		}
+		for (auto I = levels.begin(); I != levels.end(); ++I)
+			n += (*I)->resident_bytes();
+		return n;
+	}
+
+	static float const code_range = compact_payload::largest_code;
+
+	// n a multiple of four and src 16-byte aligned.
+	static void narrow_row(t_int16* dst, float const* src, float factor, unsigned n)
+	{
+		__m128 const k = _mm_set1_ps(factor);
+		for (unsigned i = 0; i < n; i += 4)
+		{
+			__m128i q = _mm_cvtps_epi32(_mm_mul_ps(_mm_load_ps(src + i), k));
+			_mm_storel_epi64((__m128i*)(dst + i), _mm_packs_epi32(q, q));
+		}
+	}
+
+	// n a multiple of four, dst need not be aligned.
+	static void widen_row(float* dst, t_int16 const* src, float factor, unsigned n)
+	{
+		__m128 const k = _mm_set1_ps(factor);
+		for (unsigned i = 0; i < n; i += 4)
+		{
+			__m128i q = _mm_loadl_epi64((__m128i const*)(src + i));
+			__m128i wide = _mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(wide), k));
+		}
+	}
+
+	static float largest_magnitude(waveform_payload const& p)
+	{
+		float m = 0.0f;
+		float const* s = p.samples;
+		for (size_t i = 0, n = (size_t)field::count * p.channel_count * p.stride; i < n; ++i)
+			m = (std::max)(m, std::fabs(s[i]));
+		return m;
+	}
+
+	compact_payload::compact_payload(waveform_payload& source)
+		: channel_count(source.channel_count), bucket_count(source.bucket_count), stride(source.stride)
+		, scale(largest_magnitude(source))
+		, samples(allocate_rows<t_int16>((size_t)field::count * channel_count * stride * sizeof(t_int16)))
+		, stats(source.get_stats())
+	{
+		if (!(scale > 0.0f))
+			scale = 1.0f;
+		t_int16* dst = samples;
+		for (int f = 0; f < field::count; ++f)
+		{
+			for (unsigned c = 0; c < channel_count; ++c, dst += stride)
+				narrow_row(dst, source.row((field::type)f, c), code_range / scale, stride);
+		}
+	}
+
+	compact_payload::compact_payload(unsigned channel_count, unsigned bucket_count, float scale)
+		: channel_count(channel_count), bucket_count(bucket_count), stride((bucket_count + 3) & ~3u), scale(scale)
+		, samples(allocate_rows<t_int16>((size_t)field::count * channel_count * stride * sizeof(t_int16)))
+	{
+	}
+
+	compact_payload::~compact_payload()
+	{
+		aligned_free(samples);
+	}
+
+	t_int16* compact_payload::row(field::type f, unsigned channel) const
+	{
+		assert(f < field::count && channel < channel_count);
+		return samples + ((size_t)f * channel_count + channel) * stride;
+	}
+
+	std::shared_ptr<waveform_payload> compact_payload::widen() const
+	{
+		auto out = std::make_shared<waveform_payload>(channel_count, bucket_count);
+		for (int f = 0; f < field::count; ++f)
+		{
+			for (unsigned c = 0; c < channel_count; ++c)
+				widen_row(out->row((field::type)f, c), row((field::type)f, c), scale / code_range, stride);
+		}
+		// The statistics of the full precision samples, which the frontends scale by.
+		out->stats = stats;
+		return out;
+	}
+
+	size_t compact_payload::resident_bytes() const
+	{
+		std::lock_guard<std::mutex> lk(derived_mutex);
+		size_t n = sizeof(*this) + (size_t)field::count * channel_count * stride * sizeof(t_int16)
+			+ stats.capacity() * sizeof(channel_stats);
+		for (int i = 0; i < 2; ++i)
+		{
+			if (downmixed[i])
+				n += downmixed[i]->resident_bytes();
+		}
+		for (auto I = levels.begin(); I != levels.end(); ++I)
+			n += (*I)->resident_bytes();
+		return n;
+	}
 
-		auto& field = I->m_value;
-		if (index >= field.get_size())
+	waveform_impl::waveform_impl(unsigned channel_count, unsigned bucket_count, unsigned channel_map)
+		: payload(std::make_shared<waveform_payload>(channel_count, bucket_count)), channel_map(channel_map)
+	{
+	}
+
+	waveform_impl::waveform_impl(std::shared_ptr<waveform_payload> payload, unsigned channel_map)
+		: payload(payload), channel_map(channel_map)
+	{
+	}
+
+	bool waveform_impl::get_field(char const* what, unsigned index, array_sink<float> const& out)
+	{
+		field::type f;
+		if (!field::from_name(what, f) || index >= payload->channel_count)
 			return false;
 
-		pfc::list_t<float> data;
-		data.add_items(field[index]);
-		out.set(data.get_ptr(), data.get_count());
+		out.set(payload->row(f, index), payload->bucket_count);
 		return true;
 	}
 
 	unsigned waveform_impl::get_channel_count() const
 	{
-		if (fields.get_count() == 0)
+		if (payload->channel_count == 0)
 			throw std::runtime_error("channel count query on empty waveform");
-		return fields.first()->m_value.get_count();
+		return payload->channel_count;
 	}
 
 	unsigned waveform_impl::get_channel_map() const
@@ -38,9 +248,123 @@ namespace wave
 
 	ref_ptr<waveform> waveform_impl::clone() const
 	{
-		waveform_impl* out = new waveform_impl;
-		out->channel_map = channel_map;
-		out->fields = fields;
-		return ref_ptr<waveform>(out);
+		return ref_ptr<waveform>(new waveform_impl(payload, channel_map));
+	}
+
+	unsigned waveform_impl::get_bucket_count() const
+	{
+		return payload->bucket_count;
+	}
+
+	const_span<float> waveform_impl::get_span(field::type f, unsigned channel) const
+	{
+		if (f >= field::count || channel >= payload->channel_count)
+			return const_span<float>();
+		return const_span<float>(payload->row(f, channel), payload->bucket_count);
+	}
+
+	channel_stats waveform_impl::get_channel_stats(unsigned channel) const
+	{
+		if (channel >= payload->channel_count)
+		{
+			channel_stats none = {};
+			return none;
+		}
+		return payload->get_stats()[channel];
+	}
+
+	channel_stats waveform_impl::get_track_stats() const
+	{
+		return payload->get_stats().back();
+	}
+
+	float* waveform_impl::get_mutable(field::type f, unsigned channel)
+	{
+		if (payload.use_count() > 1)
+		{
+			payload = payload->copy();
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lk(payload->derived_mutex);
+			payload->downmixed[0].reset();
+			payload->downmixed[1].reset();
+			payload->stats.clear();
+			payload->levels.clear();
+		}
+		return payload->row(f, channel);
+	}
+
+	compact_waveform::compact_waveform(std::shared_ptr<compact_payload const> payload, unsigned channel_map)
+		: payload(payload), channel_map(channel_map)
+	{
+	}
+
+	bool compact_waveform::get_field(char const* what, unsigned index, array_sink<float> const& out)
+	{
+		field::type f;
+		if (!field::from_name(what, f) || index >= payload->channel_count)
+			return false;
+
+		std::vector<float> wide(payload->stride);
+		widen_row(wide.data(), payload->row(f, index), payload->scale / code_range, payload->stride);
+		out.set(wide.data(), payload->bucket_count);
+		return true;
+	}
+
+	unsigned compact_waveform::get_channel_count() const
+	{
+		if (payload->channel_count == 0)
+			throw std::runtime_error("channel count query on empty waveform");
+		return payload->channel_count;
+	}
+
+	unsigned compact_waveform::get_channel_map() const
+	{
+		return channel_map;
+	}
+
+	ref_ptr<waveform> compact_waveform::clone() const
+	{
+		return ref_ptr<waveform>(new compact_waveform(payload, channel_map));
+	}
+
+	unsigned compact_waveform::get_bucket_count() const
+	{
+		return payload->bucket_count;
+	}
+
+	channel_stats compact_waveform::get_channel_stats(unsigned channel) const
+	{
+		if (channel >= payload->channel_count || channel >= payload->stats.size())
+		{
+			channel_stats none = {};
+			return none;
+		}
+		return payload->stats[channel];
+	}
+
+	channel_stats compact_waveform::get_track_stats() const
+	{
+		if (payload->stats.empty())
+		{
+			channel_stats none = {};
+			return none;
+		}
+		return payload->stats.back();
+	}
+
+	ref_ptr<waveform_impl> compact_waveform::widen() const
+	{
+		return ref_ptr<waveform_impl>(new waveform_impl(payload->widen(), channel_map));
+	}
+
+	size_t resident_bytes(ref_ptr<waveform> const& w)
+	{
+		if (auto impl = dynamic_cast<waveform_impl*>(*w))
+			return sizeof(*impl) + impl->get_payload()->resident_bytes();
+		if (auto compact = dynamic_cast<compact_waveform*>(*w))
+			return sizeof(*compact) + compact->get_payload()->resident_bytes();
+		return 0;
 	}
 }
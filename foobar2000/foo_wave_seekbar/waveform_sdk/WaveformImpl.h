@@ -5,20 +5,131 @@
 
 #pragma once
 #include "Waveform.h"
+#include <memory>
+#include <mutex>
 
 namespace wave
 {
-	struct waveform_impl : waveform
+	// All fields of all channels in one allocation, field by field and channel by channel,
+	// each channel starting on a 16-byte boundary. Payloads are shared between waveforms
+	// and never change once they are, so anything derived from one is made once and kept
+	// with it.
+	struct waveform_payload
 	{
+		waveform_payload(unsigned channel_count, unsigned bucket_count);
+		~waveform_payload();
+
+		float* row(field::type f, unsigned channel) const;
+		std::shared_ptr<waveform_payload> copy() const;
+
+		unsigned const channel_count, bucket_count, stride;
+		float* const samples;
+
+		// One entry per channel, then one for the track.
+		std::vector<channel_stats> const& get_stats();
+
+		// The samples, the statistics and any downmixes and halvings made so far.
+		size_t resident_bytes();
+
+		// Downmixes to one and two channels, the statistics and the halvings that
+		// get_columns reads from, each made on first use.
+		std::mutex derived_mutex;
+		std::shared_ptr<waveform_payload> downmixed[2];
+		std::vector<channel_stats> stats;
+		std::vector<std::shared_ptr<waveform_payload>> levels;
+
+	private:
+		waveform_payload(waveform_payload const&);
+		waveform_payload& operator = (waveform_payload const&);
+	};
+
+	// A payload narrowed to 16-bit fixed point, scaled by the largest magnitude in it,
+	// for waveforms that are held on to more than they are read.
+	struct compact_payload
+	{
+		explicit compact_payload(waveform_payload& source);
+		compact_payload(unsigned channel_count, unsigned bucket_count, float scale);
+		~compact_payload();
+
+		t_int16* row(field::type f, unsigned channel) const;
+		std::shared_ptr<waveform_payload> widen() const;
+		size_t resident_bytes() const;
+
+		enum { largest_code = 32767 };
+
+		unsigned const channel_count, bucket_count, stride;
+		float scale; // the value of the largest code
+		t_int16* const samples;
+		std::vector<channel_stats> stats;
+
+		// Downmixes and halvings as for waveform_payload, kept at 16 bits as well so that
+		// reading them needs no widening of the whole payload.
+		mutable std::mutex derived_mutex;
+		mutable std::shared_ptr<compact_payload> downmixed[2];
+		mutable std::vector<std::shared_ptr<compact_payload>> levels;
+
+	private:
+		compact_payload(compact_payload const&);
+		compact_payload& operator = (compact_payload const&);
+	};
+
+	struct waveform_impl : waveform_v2
+	{
+		waveform_impl(unsigned channel_count, unsigned bucket_count, unsigned channel_map);
+		waveform_impl(std::shared_ptr<waveform_payload> payload, unsigned channel_map);
+
 		virtual bool get_field(char const* what, unsigned index, array_sink<float> const& out) override;
 		virtual unsigned get_channel_count() const override;
 		virtual unsigned get_channel_map() const override;
 		virtual ref_ptr<waveform> clone() const override;
 
-		typedef pfc::list_t<float> signal;
-		typedef pfc::list_t<signal> bundle;
+		virtual unsigned get_bucket_count() const override;
+		virtual const_span<float> get_span(field::type f, unsigned channel) const override;
+		virtual channel_stats get_channel_stats(unsigned channel) const override;
+		virtual channel_stats get_track_stats() const override;
+		virtual ref_ptr<waveform> get_downmix(unsigned target_channels) const override; // in Waveform.cc
+		virtual void get_columns(unsigned channel, size_t column_count, float* minimum, float* maximum, float* rms) const override; // in Lod.cc
 
-		pfc::map_t<pfc::string, bundle> fields;
+		// For filling in the waveform, copying the payload first if it is shared.
+		float* get_mutable(field::type f, unsigned channel);
+
+		std::shared_ptr<waveform_payload> const& get_payload() const { return payload; }
+
+	private:
+		std::shared_ptr<waveform_payload> payload;
 		unsigned channel_map;
 	};
+
+	// Held at 16 bits. Its statistics, downmixes and get_columns read it as it is,
+	// as_waveform_v2 widens it to a waveform_impl that is not kept, so reading spans costs
+	// a conversion every time.
+	struct compact_waveform : waveform_summary
+	{
+		compact_waveform(std::shared_ptr<compact_payload const> payload, unsigned channel_map);
+
+		virtual bool get_field(char const* what, unsigned index, array_sink<float> const& out) override;
+		virtual unsigned get_channel_count() const override;
+		virtual unsigned get_channel_map() const override;
+		virtual ref_ptr<waveform> clone() const override;
+
+		virtual unsigned get_bucket_count() const override;
+		virtual channel_stats get_channel_stats(unsigned channel) const override;
+		virtual channel_stats get_track_stats() const override;
+		virtual ref_ptr<waveform> get_downmix(unsigned target_channels) const override; // in Waveform.cc
+		virtual void get_columns(unsigned channel, size_t column_count, float* minimum, float* maximum, float* rms) const override; // in Lod.cc
+
+		ref_ptr<waveform_impl> widen() const;
+
+		std::shared_ptr<compact_payload const> const& get_payload() const { return payload; }
+
+	private:
+		std::shared_ptr<compact_payload const> payload;
+		unsigned channel_map;
+	};
+
+	// w at 16 bits, itself if it already is.
+	ref_ptr<waveform> make_compact_waveform(ref_ptr<waveform> const& w);
+
+	// Bytes held by a waveform made by the component, 0 for any other.
+	size_t resident_bytes(ref_ptr<waveform> const& w);
 }